@@ -0,0 +1,524 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "config.h"
+#include "cgroup.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+
+
+
+/**
+ * The name of the cgroup daemond moves itself into,
+ * processes may not be in cgroups with controlled subgroups
+ */
+#define SUPERVISOR_CGROUP  "supervisor"
+
+/**
+ * The name of the cgroup under which services' cgroups are created
+ */
+#define SERVICES_CGROUP  "services"
+
+
+
+/**
+ * Command line arguments
+ */
+extern char** argv;
+
+/**
+ * The pathname of the cgroup under which services' cgroups
+ * are created, `NULL` if cgroups are not used
+ */
+static char* services_cgroup = NULL;
+
+/**
+ * The controllers to enable for services, if available
+ */
+static const char* const controllers[] = { "cpu", "memory", "io", "pids", NULL };
+
+
+
+/**
+ * Concatenate strings
+ * 
+ * @param   first  The first string
+ * @param   ...    The rest of the strings, terminated by `NULL`
+ * @return         The concatenation, `NULL` on error
+ */
+static char* concat(const char* restrict first, ...)
+{
+  const char* part;
+  size_t n = 0;
+  va_list args;
+  char* rc;
+  
+  va_start(args, first);
+  for (part = first; part != NULL; part = va_arg(args, const char*))
+    n += strlen(part);
+  va_end(args);
+  
+  if (rc = malloc((n + 1) * sizeof(char)), rc == NULL)
+    return NULL;
+  *rc = '\0';
+  
+  va_start(args, first);
+  for (part = first; part != NULL; part = va_arg(args, const char*))
+    strcat(rc, part);
+  va_end(args);
+  
+  return rc;
+}
+
+
+/**
+ * Get the pathname of a file in the cgroup of a service
+ * 
+ * @param   name  The name of the service
+ * @param   file  The name of the file, `NULL` for the cgroup itself
+ * @return        The pathname, `NULL` on error
+ */
+char* cgroup_path(const char* restrict name, const char* restrict file)
+{
+  if (file == NULL)
+    return concat(services_cgroup, "/", name, NULL);
+  return concat(services_cgroup, "/", name, "/", file, NULL);
+}
+
+
+/**
+ * Write a string to a file, without creating or truncating it
+ * 
+ * @param   pathname  The pathname of the file
+ * @param   text      The string to write
+ * @return            Zero on success, -1 on error
+ */
+static int write_string(const char* restrict pathname, const char* restrict text)
+{
+  size_t n = strlen(text);
+  int fd, saved_errno;
+  
+  if (fd = open(pathname, O_WRONLY | O_CLOEXEC), fd < 0)
+    return -1;
+  if (write(fd, text, n) < (ssize_t)n)
+    {
+      saved_errno = errno;
+      close(fd);
+      return errno = saved_errno, -1;
+    }
+  return close(fd);
+}
+
+
+/**
+ * Write a string to a file in the cgroup of a service
+ * 
+ * @param   name  The name of the service
+ * @param   file  The name of the file
+ * @param   text  The string to write
+ * @return        Zero on success, -1 on error
+ */
+int cgroup_write(const char* restrict name, const char* restrict file, const char* restrict text)
+{
+  char* pathname = cgroup_path(name, file);
+  int r, saved_errno;
+  if (pathname == NULL)
+    return -1;
+  r = write_string(pathname, text);
+  saved_errno = errno;
+  free(pathname);
+  return errno = saved_errno, r;
+}
+
+
+/**
+ * Open a file in the cgroup of a service for reading
+ * 
+ * @param   name  The name of the service
+ * @param   file  The name of the file
+ * @return        The opened file, `NULL` on error
+ */
+static FILE* cgroup_open(const char* restrict name, const char* restrict file)
+{
+  char* pathname = cgroup_path(name, file);
+  int saved_errno;
+  FILE* f;
+  if (pathname == NULL)
+    return NULL;
+  f = fopen(pathname, "re");
+  saved_errno = errno;
+  free(pathname);
+  return errno = saved_errno, f;
+}
+
+
+/**
+ * Get the cgroup v2 cgroup of the process
+ * 
+ * @return  The pathname of the cgroup relative to the
+ *          mount point of the hierarchy, `NULL` on error
+ */
+static char* read_own_cgroup(void)
+{
+  char line[4096];
+  char* rc = NULL;
+  FILE* f;
+  
+  if (f = fopen(SELF_CGROUP, "re"), f == NULL)
+    return NULL;
+  while (fgets(line, (int)sizeof(line), f) != NULL)
+    if (strstr(line, "0::") == line)
+      {
+	line[strcspn(line, "\n")] = '\0';
+	rc = strdup(line + 3);
+	break;
+      }
+  fclose(f);
+  
+  if ((rc == NULL) && (errno == 0))
+    errno = ENOENT;
+  return rc;
+}
+
+
+/**
+ * Enable all wanted and available controllers for the subgroups of a cgroup
+ * 
+ * @param  cgroup  The pathname of the cgroup
+ */
+static void enable_controllers(const char* restrict cgroup)
+{
+  char available[256];
+  char request[32];
+  char* pathname;
+  const char* p;
+  size_t i, n;
+  ssize_t got;
+  int fd;
+  
+  if (pathname = concat(cgroup, "/cgroup.controllers", NULL), pathname == NULL)
+    return;
+  fd = open(pathname, O_RDONLY | O_CLOEXEC);
+  free(pathname);
+  if (fd < 0)
+    return;
+  got = read(fd, available + 1, sizeof(available) - 3);
+  close(fd);
+  if (got < 0)
+    return;
+  available[0] = ' ';
+  available[got + 1] = '\0';
+  available[strcspn(available, "\n")] = ' ';
+  
+  if (pathname = concat(cgroup, "/cgroup.subtree_control", NULL), pathname == NULL)
+    return;
+  for (i = 0; controllers[i] != NULL; i++)
+    {
+      n = strlen(controllers[i]);
+      for (p = available; (p = strstr(p, controllers[i])); p += n)
+	if ((p[-1] == ' ') && (p[n] == ' '))
+	  break;
+      if (p == NULL)
+	continue;
+      sprintf(request, "+%s", controllers[i]);
+      write_string(pathname, request);
+    }
+  free(pathname);
+}
+
+
+/**
+ * Check whether a cgroup has been delegated to daemond
+ * 
+ * A cgroup is delegated if it is marked as delegated,
+ * as systemd does, if it is the root of our cgroup
+ * namespace, as in a container or when running as init,
+ * or if it is owned by us and we are not root
+ * 
+ * @param   base  The pathname of the cgroup
+ * @param   own   The pathname of the cgroup relative to the mount point
+ * @return        Whether the cgroup has been delegated to daemond
+ */
+static int is_delegated(const char* restrict base, const char* restrict own)
+{
+  struct stat dir, procs;
+  char* pathname;
+  int r;
+  
+  if ((getxattr(base, "trusted.delegate", NULL, 0) >= 0) ||
+      (getxattr(base, "user.delegate", NULL, 0) >= 0))
+    return 1;
+  if (!*own || !strcmp(own, "/"))
+    return 1;
+  
+  /* Root owns every cgroup that has not been delegated to another user. */
+  if (geteuid() == 0)
+    return 0;
+  if (pathname = concat(base, "/cgroup.procs", NULL), pathname == NULL)
+    return 0;
+  r = (stat(base, &dir) == 0) && (stat(pathname, &procs) == 0) &&
+      (dir.st_uid == geteuid()) && (procs.st_uid == geteuid());
+  free(pathname);
+  return r;
+}
+
+
+/**
+ * Set up a cgroup v2 subtree for services, if the
+ * cgroup of daemond has been delegated to daemond
+ * 
+ * @return  Zero on success, -1 if cgroups will not be used
+ */
+int cgroup_initialise(void)
+{
+  char pid_str[3 * sizeof(pid_t) + 2];
+  const char* mount = CGROUP_FS;
+  char* own = NULL;
+  char* base = NULL;
+  char* procs = NULL;
+  char* services = NULL;
+  struct statfs fs;
+  size_t n, m = strlen("/" SUPERVISOR_CGROUP);
+  int saved_errno;
+  
+  /* Find the cgroup v2 hierarchy, it could be mounted in hybrid mode. */
+  if (statfs(mount, &fs) < 0)
+    return -1;
+  if (fs.f_type != CGROUP2_SUPER_MAGIC)
+    {
+      mount = CGROUP_FS "/unified";
+      if (statfs(mount, &fs) < 0)
+	return -1;
+      if (fs.f_type != CGROUP2_SUPER_MAGIC)
+	return errno = 0, -1;
+    }
+  
+  /* Find our cgroup, and do not nest deeper every time we are re-executed. */
+  if (own = read_own_cgroup(), own == NULL)
+    return -1;
+  n = strlen(own);
+  if ((n >= m) && !strcmp(own + n - m, "/" SUPERVISOR_CGROUP))
+    own[n - m] = '\0';
+  
+  /* Move out of the way, and take `daemond-resurrectd` with us. */
+  if (base = concat(mount, own, NULL), base == NULL)
+    goto fail;
+  if (!is_delegated(base, own))
+    {
+      fprintf(stderr, "%s: %s has not been delegated to daemond, not using cgroups\n", *argv, base);
+      errno = 0;
+      goto fail;
+    }
+  if (procs = concat(base, "/" SUPERVISOR_CGROUP, NULL), procs == NULL)
+    goto fail;
+  if ((mkdir(procs, 0755) < 0) && (errno != EEXIST))
+    goto fail;
+  free(procs);
+  if (procs = concat(base, "/" SUPERVISOR_CGROUP "/cgroup.procs", NULL), procs == NULL)
+    goto fail;
+  if (write_string(procs, "0") < 0)
+    goto fail;
+  /* As init, we have no parent to take with us. */
+  if (getppid() > 1)
+    {
+      sprintf(pid_str, "%ji", (intmax_t)getppid());
+      if (write_string(procs, pid_str) < 0)
+	fprintf(stderr, "%s: could not move daemond-resurrectd to %s: %s\n",
+		*argv, procs, strerror(errno));
+    }
+  
+  /* Create the cgroup for services. */
+  enable_controllers(base);
+  if (services = concat(base, "/" SERVICES_CGROUP, NULL), services == NULL)
+    goto fail;
+  if ((mkdir(services, 0755) < 0) && (errno != EEXIST))
+    goto fail;
+  enable_controllers(services);
+  
+  free(own);
+  free(base);
+  free(procs);
+  services_cgroup = services;
+  return 0;
+  
+ fail:
+  saved_errno = errno;
+  free(own);
+  free(base);
+  free(procs);
+  free(services);
+  return errno = saved_errno, -1;
+}
+
+
+/**
+ * Check whether services are placed in cgroups
+ * 
+ * @return  Whether services are placed in cgroups
+ */
+int cgroup_enabled(void)
+{
+  return services_cgroup != NULL;
+}
+
+
+/**
+ * Create the cgroup for a service
+ * 
+ * @param   name  The name of the service
+ * @return        Zero on success, -1 on error
+ */
+int cgroup_create(const char* restrict name)
+{
+  char* pathname = cgroup_path(name, NULL);
+  int r, saved_errno;
+  if (pathname == NULL)
+    return -1;
+  r = mkdir(pathname, 0755);
+  saved_errno = errno;
+  free(pathname);
+  if ((r < 0) && (saved_errno == EEXIST))
+    r = 0;
+  return errno = saved_errno, r;
+}
+
+
+/**
+ * Move the calling process into the cgroup of a service,
+ * all descendants that are forked later will remain in it
+ * 
+ * @param   name  The name of the service
+ * @return        Zero on success, -1 on error
+ */
+int cgroup_enter(const char* restrict name)
+{
+  return cgroup_write(name, "cgroup.procs", "0");
+}
+
+
+/**
+ * Check whether any process is in the cgroup of a service
+ * 
+ * @param   name  The name of the service
+ * @return        1 if populated, 0 if empty, -1 on error
+ */
+int cgroup_populated(const char* restrict name)
+{
+  int populated = -1;
+  char line[64];
+  FILE* f;
+  
+  if (f = cgroup_open(name, "cgroup.events"), f == NULL)
+    return -1;
+  while (fgets(line, (int)sizeof(line), f) != NULL)
+    if (sscanf(line, "populated %i", &populated) == 1)
+      break;
+  fclose(f);
+  
+  return populated < 0 ? (errno = EIO, -1) : !!populated;
+}
+
+
+/**
+ * Kill all processes in the cgroup of a service
+ * 
+ * @param   name  The name of the service
+ * @return        Zero on success, -1 on error
+ */
+int cgroup_kill(const char* restrict name)
+{
+  intmax_t pid;
+  FILE* f;
+  
+  if (cgroup_write(name, "cgroup.kill", "1") == 0)
+    return 0;
+  else if (errno != ENOENT)
+    return -1;
+  
+  /* cgroup.kill requires Linux 5.14, freeze the
+     cgroup so that nothing can escape by forking. */
+  cgroup_write(name, "cgroup.freeze", "1");
+  if (f = cgroup_open(name, "cgroup.procs"), f != NULL)
+    {
+      while (fscanf(f, "%ji\n", &pid) == 1)
+	kill((pid_t)pid, SIGKILL);
+      fclose(f);
+    }
+  cgroup_write(name, "cgroup.freeze", "0");
+  
+  return f == NULL ? -1 : 0;
+}
+
+
+/**
+ * Read the resource usage of a service
+ * 
+ * @param   name   The name of the service
+ * @param   usage  Output parameter for the resource usage
+ * @return         Zero on success, -1 on error
+ */
+int cgroup_usage(const char* restrict name, struct cgroup_usage* restrict usage)
+{
+  char line[512];
+  unsigned long long value;
+  char* p;
+  FILE* f;
+  
+  memset(usage, 0, sizeof(*usage));
+  
+  /* cpu.stat is available even without the cpu controller. */
+  if (f = cgroup_open(name, "cpu.stat"), f == NULL)
+    return -1;
+  while (fgets(line, (int)sizeof(line), f) != NULL)
+    if (sscanf(line, "usage_usec %llu", &value) == 1)
+      usage->cpu = value;
+  fclose(f);
+  
+  if (f = cgroup_open(name, "memory.current"), f != NULL)
+    {
+      usage->have_memory = fscanf(f, "%llu", &(usage->memory)) == 1;
+      fclose(f);
+    }
+  
+  if (f = cgroup_open(name, "io.stat"), f != NULL)
+    {
+      usage->have_io = 1;
+      while (fgets(line, (int)sizeof(line), f) != NULL)
+	{
+	  if ((p = strstr(line, " rbytes=")))
+	    usage->io_read += strtoull(p + strlen(" rbytes="), NULL, 10);
+	  if ((p = strstr(line, " wbytes=")))
+	    usage->io_written += strtoull(p + strlen(" wbytes="), NULL, 10);
+	}
+      fclose(f);
+    }
+  
+  return 0;
+}
+
@@ -0,0 +1,139 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef DAEMOND_CGROUP_H
+#define DAEMOND_CGROUP_H
+
+
+
+/**
+ * Resource usage of a service
+ */
+struct cgroup_usage
+{
+  /**
+   * Consumed CPU time, in microseconds
+   */
+  unsigned long long cpu;
+  
+  /**
+   * Current memory usage, in bytes
+   */
+  unsigned long long memory;
+  
+  /**
+   * The number of bytes read from block devices
+   */
+  unsigned long long io_read;
+  
+  /**
+   * The number of bytes written to block devices
+   */
+  unsigned long long io_written;
+  
+  /**
+   * Whether `memory` is known
+   */
+  int have_memory;
+  
+  /**
+   * Whether `io_read` and `io_written` are known
+   */
+  int have_io;
+};
+
+
+
+/**
+ * Set up a cgroup v2 subtree for services, if the
+ * cgroup of daemond has been delegated to daemond
+ * 
+ * @return  Zero on success, -1 if cgroups will not be used
+ */
+int cgroup_initialise(void);
+
+/**
+ * Check whether services are placed in cgroups
+ * 
+ * @return  Whether services are placed in cgroups
+ */
+int cgroup_enabled(void) __attribute__((pure));
+
+/**
+ * Get the pathname of a file in the cgroup of a service
+ * 
+ * @param   name  The name of the service
+ * @param   file  The name of the file, `NULL` for the cgroup itself
+ * @return        The pathname, `NULL` on error
+ */
+char* cgroup_path(const char* restrict name, const char* restrict file);
+
+/**
+ * Write a string to a file in the cgroup of a service
+ * 
+ * @param   name  The name of the service
+ * @param   file  The name of the file
+ * @param   text  The string to write
+ * @return        Zero on success, -1 on error
+ */
+int cgroup_write(const char* restrict name, const char* restrict file, const char* restrict text);
+
+/**
+ * Create the cgroup for a service
+ * 
+ * @param   name  The name of the service
+ * @return        Zero on success, -1 on error
+ */
+int cgroup_create(const char* restrict name);
+
+/**
+ * Move the calling process into the cgroup of a service,
+ * all descendants that are forked later will remain in it
+ * 
+ * @param   name  The name of the service
+ * @return        Zero on success, -1 on error
+ */
+int cgroup_enter(const char* restrict name);
+
+/**
+ * Check whether any process is in the cgroup of a service
+ * 
+ * @param   name  The name of the service
+ * @return        1 if populated, 0 if empty, -1 on error
+ */
+int cgroup_populated(const char* restrict name);
+
+/**
+ * Kill all processes in the cgroup of a service
+ * 
+ * @param   name  The name of the service
+ * @return        Zero on success, -1 on error
+ */
+int cgroup_kill(const char* restrict name);
+
+/**
+ * Read the resource usage of a service
+ * 
+ * @param   name   The name of the service
+ * @param   usage  Output parameter for the resource usage
+ * @return         Zero on success, -1 on error
+ */
+int cgroup_usage(const char* restrict name, struct cgroup_usage* restrict usage);
+
+
+#endif
+
@@ -43,6 +43,35 @@
 # define SYSCONFDIR  ".etc"
 #endif
 
+/**
+ * The directory where daemon scripts and
+ * service descriptors are placed
+ */
+#ifndef DAEMONDIR
+# define DAEMONDIR  SYSCONFDIR "/daemons"
+#endif
+
+/**
+ * The table of environment variables given to daemons
+ */
+#ifndef ENVIRONTAB
+# define ENVIRONTAB  SYSCONFDIR "/" PKGNAME ".d/environtab"
+#endif
+
+/**
+ * The suffix of the filename of service descriptors
+ */
+#ifndef DESCRIPTOR_SUFFIX
+# define DESCRIPTOR_SUFFIX  ".conf"
+#endif
+
+/**
+ * The compiled descriptor cache
+ */
+#ifndef DESCRIPTOR_CACHE
+# define DESCRIPTOR_CACHE  RUNDIR "/" PKGNAME "/descriptors.cache"
+#endif
+
 /**
  * The pathname of the /proc/self/fd directory
  */
@@ -50,6 +79,35 @@
 # define SELF_FD  "/proc/self/fd"
 #endif
 
+/**
+ * The pathname of the /proc/self/statm file
+ */
+#ifndef SELF_STATM
+# define SELF_STATM  "/proc/self/statm"
+#endif
+
+/**
+ * The pathname of the /proc/self/oom_score_adj file
+ */
+#ifndef SELF_OOM_SCORE_ADJ
+# define SELF_OOM_SCORE_ADJ  "/proc/self/oom_score_adj"
+#endif
+
+/**
+ * The pathname of the /proc/self/cgroup file
+ */
+#ifndef SELF_CGROUP
+# define SELF_CGROUP  "/proc/self/cgroup"
+#endif
+
+/**
+ * The mount point of the cgroup hierarchy, if it is not a
+ * cgroup v2 hierarchy, the subdirectory "unified" is used
+ */
+#ifndef CGROUP_FS
+# define CGROUP_FS  "/sys/fs/cgroup"
+#endif
+
 /**
  * The pathname of the /dev/null device
  */
@@ -72,6 +130,174 @@
 # define ENV_DAEMON_NAME_TAG  "DAEMON_NAME"
 #endif
 
+/**
+ * Environment variable used to tell instances of
+ * templates, NAME@INSTANCE, their instance
+ */
+#ifndef ENV_DAEMON_INSTANCE_TAG
+# define ENV_DAEMON_INSTANCE_TAG  "DAEMON_INSTANCE"
+#endif
+
+/**
+ * Environment variable used to tell daemon scripts
+ * the pathname of the cgroup of their service
+ */
+#ifndef ENV_DAEMON_CGROUP_TAG
+# define ENV_DAEMON_CGROUP_TAG  "DAEMON_CGROUP"
+#endif
+
+/**
+ * Environment variable used to tell daemons how many
+ * listening sockets they have inherited, from file
+ * descriptor 3 and upwards
+ */
+#ifndef ENV_LISTEN_FDS_TAG
+# define ENV_LISTEN_FDS_TAG  "LISTEN_FDS"
+#endif
+
+/**
+ * Environment variable used to tell daemons the PID
+ * of the process `ENV_LISTEN_FDS_TAG` is meant for
+ */
+#ifndef ENV_LISTEN_PID_TAG
+# define ENV_LISTEN_PID_TAG  "LISTEN_PID"
+#endif
+
+/**
+ * The number of seconds between each rewrite
+ * of the metrics file
+ */
+#ifndef METRICS_INTERVAL
+# define METRICS_INTERVAL  10
+#endif
+
+/**
+ * The number of services there is room
+ * for in the status table
+ */
+#ifndef STATUS_CAPACITY
+# define STATUS_CAPACITY  4096
+#endif
+
+/**
+ * The greatest number of instances a template can be
+ * scaled to, services are never forgotten once they
+ * have been registered, so this must leave room in the
+ * status table for the other services
+ */
+#ifndef MAX_INSTANCES
+# define MAX_INSTANCES  1024
+#endif
+#if MAX_INSTANCES > STATUS_CAPACITY
+# error MAX_INSTANCES must not be greater than STATUS_CAPACITY
+#endif
+
+/**
+ * The number of state changes that are kept for
+ * a subscriber before they start to be dropped
+ */
+#ifndef EVENT_BUFFER_SIZE
+# define EVENT_BUFFER_SIZE  256
+#endif
+
+/**
+ * The message type of control requests that are neither
+ * urgent nor bulk, this is the type of requests from
+ * clients that do not know about request classes
+ */
+#define REQUEST_NORMAL  1
+
+/**
+ * The message type of urgent control requests, such as
+ * stop, kill and shutdown, which should jump the queue
+ */
+#define REQUEST_URGENT  2
+
+/**
+ * The message type of bulk control requests,
+ * such as status queries from monitors
+ */
+#define REQUEST_BULK  3
+
+/**
+ * The number of request classes, the message types
+ * from 1 to this value are reserved for requests
+ */
+#define REQUEST_CLASSES  3
+
+/**
+ * The message type of the empty messages daemond sends
+ * itself to wake up its main loop, it is not a request
+ * class, but it is reserved in the same way
+ */
+#define REQUEST_WAKE_UP  (REQUEST_CLASSES + 1)
+
+/**
+ * The number of urgent control requests daemond takes
+ * in a row while there are other requests waiting
+ */
+#ifndef REQUEST_URGENT_WEIGHT
+# define REQUEST_URGENT_WEIGHT  16
+#endif
+
+/**
+ * The number of normal control requests daemond takes
+ * in a row while there are other requests waiting
+ */
+#ifndef REQUEST_NORMAL_WEIGHT
+# define REQUEST_NORMAL_WEIGHT  4
+#endif
+
+/**
+ * The number of bulk control requests daemond takes
+ * in a row while there are other requests waiting
+ */
+#ifndef REQUEST_BULK_WEIGHT
+# define REQUEST_BULK_WEIGHT  1
+#endif
+
+/**
+ * The maximum number of children daemond reaps
+ * at a time, before it looks at its messages
+ */
+#ifndef REAP_BATCH
+# define REAP_BATCH  64
+#endif
+
+/**
+ * The number of services memory is allocated for at
+ * a time, the memory is kept for as long as daemond runs
+ */
+#ifndef SERVICE_CHUNK
+# define SERVICE_CHUNK  64
+#endif
+
+/**
+ * The number of subscribers memory is allocated for at
+ * a time, the memory is kept for as long as daemond runs
+ */
+#ifndef EVENT_SUBSCRIBER_CHUNK
+# define EVENT_SUBSCRIBER_CHUNK  4
+#endif
+
+/**
+ * The number of seconds between each report
+ * of daemond's own resource usage, when
+ * self-checking has been turned on
+ */
+#ifndef SELF_CHECK_INTERVAL
+# define SELF_CHECK_INTERVAL  60
+#endif
+
+/**
+ * Whether daemond performs all lifecycle actions itself,
+ * and never runs daemon scripts, in which case every
+ * daemon must have an `exec` command in its descriptor
+ */
+#ifndef NATIVE_LIFECYCLE
+# define NATIVE_LIFECYCLE  0
+#endif
+
 
 #endif
 
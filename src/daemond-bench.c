@@ -0,0 +1,642 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include "config.h"
+#include "harness.h"
+#include "timer.h"
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+
+
+
+/**
+ * The number of milliseconds to wait for a service
+ * to report, before the benchmark is aborted
+ */
+#define REPORT_TIMEOUT  10000
+
+/**
+ * The number of nanoseconds to wait so that every service,
+ * and daemond itself, has lived long enough to be respawned
+ * immediately rather than be put in backoff
+ */
+#define OUTLIVE_MINIMUM_LIFETIME  (1100 * 1000000LL)
+
+/**
+ * The number of nanoseconds between each look
+ * at whether a killed daemond is gone
+ */
+#define DEATH_POLL_INTERVAL  (10 * 1000LL)
+
+/**
+ * The name of the template that the benchmarking services are instances of
+ */
+#define BENCH_TEMPLATE  "bench@"
+
+
+
+/**
+ * What a benchmarking service writes to its FIFO
+ * when it has started and when it is signalled
+ */
+struct report
+{
+  /**
+   * The process ID of the service
+   */
+  pid_t pid;
+  
+  /**
+   * The time, in nanoseconds on `CLOCK_MONOTONIC`, the report was made
+   */
+  long long time;
+};
+
+
+/**
+ * The options of the benchmark
+ */
+struct options
+{
+  /**
+   * The number of services to spawn
+   */
+  size_t services;
+  
+  /**
+   * The number of times each service is killed
+   */
+  size_t rounds;
+  
+  /**
+   * The number of control messages each sender sends
+   */
+  size_t messages;
+  
+  /**
+   * The highest number of concurrent senders
+   */
+  size_t concurrency;
+  
+  /**
+   * The number of times daemond is killed
+   */
+  size_t resurrections;
+};
+
+
+
+/**
+ * Command line arguments
+ */
+char** argv;
+
+/**
+ * The read end of each service's FIFO, indexed by instance minus one
+ */
+static int* fifos = NULL;
+
+/**
+ * The latest reported process ID of each service, indexed by instance minus one
+ */
+static pid_t* service_pids = NULL;
+
+/**
+ * The number of services with a FIFO
+ */
+static size_t service_count = 0;
+
+/**
+ * Set when a benchmarking service receives SIGHUP
+ */
+static volatile sig_atomic_t hangup = 0;
+
+
+
+/**
+ * Called when a benchmarking service receives SIGHUP
+ * 
+ * @param  signo  The caught signal
+ */
+static void hangup_handler(int signo)
+{
+  (void) signo;
+  hangup = 1;
+}
+
+
+/**
+ * The benchmarking service, it reports when it has been
+ * started, and again each time it is told to reload
+ * 
+ * @param   directory  The directory with the FIFOs of the services
+ * @return             Value for `main` to return
+ */
+static int service_procedure(const char* directory)
+{
+  const char* instance = getenv(ENV_DAEMON_INSTANCE_TAG);
+  char pathname[strlen(directory) + sizeof("/") + (instance ? strlen(instance) : 0)];
+  struct report report;
+  sigset_t set, unblocked;
+  int fd;
+  
+  if (instance == NULL)
+    return fprintf(stderr, "%s: %s is not set\n", *argv, ENV_DAEMON_INSTANCE_TAG), 1;
+  sprintf(pathname, "%s/%s", directory, instance);
+  
+  /* Block SIGHUP so that it cannot arrive between reports. */
+  sigemptyset(&set);
+  sigaddset(&set, SIGHUP);
+  if (sigprocmask(SIG_BLOCK, &set, &unblocked) < 0)
+    return perror(*argv), 1;
+  sigdelset(&unblocked, SIGHUP);
+  if (signal(SIGHUP, hangup_handler) == SIG_ERR)
+    return perror(*argv), 1;
+  
+  if (fd = open(pathname, O_WRONLY | O_CLOEXEC), fd < 0)
+    return perror(*argv), 1;
+  
+  report.pid = getpid();
+  for (;;)
+    {
+      report.time = harness_now();
+      if (harness_write(fd, &report, sizeof(report)) < 0)
+	return perror(*argv), 1;
+      while (!hangup)
+	sigsuspend(&unblocked);
+      hangup = 0;
+    }
+}
+
+
+/**
+ * Create the workspace, with a template descriptor
+ * for the benchmarking services and their FIFOs
+ * 
+ * @param   bindir  The directory with the binaries under benchmark
+ * @param   root    The directory to create the workspace in
+ * @return          Zero on success, -1 on error
+ */
+static int prepare_workspace(const char* bindir, const char* root)
+{
+  char pathname[sizeof(RUNDIR "/bench/") + 3 * sizeof(size_t)];
+  FILE* f;
+  size_t i;
+  
+  if (harness_prepare(bindir, root, "bench") < 0)
+    return -1;
+  
+  if (f = fopen(DAEMONDIR "/" BENCH_TEMPLATE DESCRIPTOR_SUFFIX, "w"), f == NULL)
+    return -1;
+  fprintf(f, "exec = %s/" PKGNAME "-bench --service %s/" RUNDIR "/bench\n",
+	  harness_workspace, harness_workspace);
+  if (fclose(f) < 0)
+    return -1;
+  
+  if (fifos = malloc(service_count * sizeof(int)), fifos == NULL)
+    return -1;
+  if (service_pids = calloc(service_count, sizeof(pid_t)), service_pids == NULL)
+    return -1;
+  for (i = 0; i < service_count; i++)
+    fifos[i] = -1;
+  
+  /* Open the FIFOs for reading and writing, so that neither we
+     nor the services block, and so that we never read end of file. */
+  for (i = 0; i < service_count; i++)
+    {
+      sprintf(pathname, RUNDIR "/bench/%zu", i + 1);
+      if (mkfifo(pathname, 0600) < 0)
+	return -1;
+      if (fifos[i] = open(pathname, O_RDWR | O_CLOEXEC), fifos[i] < 0)
+	return -1;
+    }
+  
+  return 0;
+}
+
+
+/**
+ * Send a control request for a benchmarking service to daemond
+ * 
+ * @param   verb      The verb of the request
+ * @param   instance  The instance of the service
+ * @return            Zero on success, -1 on error
+ */
+static int send_service_request(const char* verb, size_t instance)
+{
+  char name[sizeof(BENCH_TEMPLATE) + 3 * sizeof(size_t)];
+  sprintf(name, BENCH_TEMPLATE "%zu", instance);
+  return harness_send(verb, name);
+}
+
+
+/**
+ * Wait for a benchmarking service to report
+ * 
+ * @param   instance  The instance of the service
+ * @param   report    Output parameter for the report
+ * @return            Zero on success, -1 on error
+ */
+static int await_report(size_t instance, struct report* restrict report)
+{
+  struct pollfd pfd;
+  int r;
+  
+  pfd.fd = fifos[instance - 1];
+  pfd.events = POLLIN;
+  while (r = poll(&pfd, 1, REPORT_TIMEOUT), r < 0)
+    if (errno != EINTR)
+      return -1;
+  if (r == 0)
+    return errno = 0, fprintf(stderr, "%s: " BENCH_TEMPLATE "%zu did not report in time\n",
+			      *argv, instance), -1;
+  
+  if (harness_read(pfd.fd, report, sizeof(*report)) < 0)
+    return -1;
+  service_pids[instance - 1] = report->pid;
+  return 0;
+}
+
+
+/**
+ * Measure the time from a start request until the daemon runs
+ * 
+ * @param   samples  Output parameter for one sample per service
+ * @return           Zero on success, -1 on error
+ */
+static int bench_spawn(long long* restrict samples)
+{
+  struct report report;
+  long long start;
+  size_t i;
+  
+  for (i = 1; i <= service_count; i++)
+    {
+      start = harness_now();
+      if (send_service_request("start", i) < 0)
+	return -1;
+      if (await_report(i, &report) < 0)
+	return -1;
+      samples[i - 1] = report.time - start;
+    }
+  return 0;
+}
+
+
+/**
+ * Measure the time from a daemon dies until it has been respawned
+ * 
+ * @param   samples  Output parameter for one sample per service and round
+ * @param   rounds   The number of times to kill each service
+ * @return           Zero on success, -1 on error
+ */
+static int bench_reap(long long* restrict samples, size_t rounds)
+{
+  struct report report;
+  long long start;
+  size_t i, round;
+  
+  for (round = 0; round < rounds; round++)
+    {
+      harness_sleep(OUTLIVE_MINIMUM_LIFETIME);
+      for (i = 1; i <= service_count; i++)
+	{
+	  start = harness_now();
+	  if (kill(service_pids[i - 1], SIGKILL) < 0)
+	    return -1;
+	  if (await_report(i, &report) < 0)
+	    return -1;
+	  *samples++ = report.time - start;
+	}
+    }
+  return 0;
+}
+
+
+/**
+ * Send reload requests, one at a time, to a service, and measure
+ * the time until the service has received its SIGHUP from daemond
+ * 
+ * @param   instance  The instance of the service
+ * @param   fd        The file descriptor to write the samples to,
+ *                    followed by the time the sender finished
+ * @param   messages  The number of requests to send
+ * @return            Value for `_exit`
+ */
+static int control_sender(size_t instance, int fd, size_t messages)
+{
+  long long* samples = malloc((messages + 1) * sizeof(long long));
+  struct report report;
+  long long start;
+  size_t i;
+  
+  if (samples == NULL)
+    return perror(*argv), 1;
+  
+  for (i = 0; i < messages; i++)
+    {
+      start = harness_now();
+      if (send_service_request("reload", instance) < 0)
+	return perror(*argv), 1;
+      if (await_report(instance, &report) < 0)
+	return errno ? (perror(*argv), 1) : 1;
+      samples[i] = report.time - start;
+    }
+  samples[messages] = harness_now();
+  
+  if (harness_write(fd, samples, (messages + 1) * sizeof(long long)) < 0)
+    return perror(*argv), 1;
+  return 0;
+}
+
+
+/**
+ * Measure the round-trip time of control requests with
+ * a number of concurrent senders, each with its own service
+ * 
+ * @param   samples      Output parameter for one sample per request
+ * @param   concurrency  The number of concurrent senders
+ * @param   messages     The number of requests each sender sends
+ * @param   elapsed      Output parameter for the time, in nanoseconds,
+ *                       from the senders started until they finished
+ * @return               Zero on success, -1 on error
+ */
+static int bench_control(long long* restrict samples, size_t concurrency,
+			 size_t messages, long long* restrict elapsed)
+{
+  int gate[2], pipes[concurrency];
+  pid_t pids[concurrency];
+  long long start, finish, latest = 0;
+  size_t i, spawned;
+  int r = 0, status;
+  char c;
+  
+  if (pipe(gate) < 0)
+    return -1;
+  
+  for (spawned = 0; spawned < concurrency; spawned++)
+    {
+      int fds[2];
+      if (pipe(fds) < 0)
+	{
+	  r = -1;
+	  break;
+	}
+      if (pids[spawned] = fork(), pids[spawned] == -1)
+	{
+	  close(fds[0]), close(fds[1]);
+	  r = -1;
+	  break;
+	}
+      if (pids[spawned] == 0)
+	{
+	  /* Wait for every sender to be ready, so that forking is not measured. */
+	  close(gate[1]), close(fds[0]);
+	  while ((read(gate[0], &c, 1) < 0) && (errno == EINTR));
+	  _exit(control_sender(spawned + 1, fds[1], messages));
+	}
+      close(fds[1]);
+      pipes[spawned] = fds[0];
+    }
+  
+  start = harness_now();
+  close(gate[0]), close(gate[1]);
+  
+  for (i = 0; i < spawned; i++)
+    {
+      if ((r == 0) && (harness_read(pipes[i], samples + i * messages, messages * sizeof(long long)) < 0 ||
+		       harness_read(pipes[i], &finish, sizeof(finish)) < 0))
+	r = -1;
+      else if (r == 0)
+	latest = finish > latest ? finish : latest;
+      close(pipes[i]);
+    }
+  
+  for (i = 0; i < spawned; i++)
+    {
+      if (r < 0)
+	kill(pids[i], SIGKILL);
+      while ((waitpid(pids[i], &status, 0) < 0) && (errno == EINTR));
+    }
+  
+  if (r < 0)
+    return errno = errno == EPIPE ? 0 : errno, -1;
+  *elapsed = latest - start;
+  return 0;
+}
+
+
+/**
+ * Measure the time from daemond dies until the resurrected
+ * daemond has received a message sent after the death
+ * 
+ * @param   samples        Output parameter for one sample per resurrection
+ * @param   resurrections  The number of times to kill daemond
+ * @return                 Zero on success, -1 on error
+ */
+static int bench_resurrection(long long* restrict samples, size_t resurrections)
+{
+  long long start;
+  size_t i;
+  pid_t pid;
+  
+  for (i = 0; i < resurrections; i++)
+    {
+      /* daemond-resurrectd takes a break if daemond dies too fast. */
+      harness_sleep(OUTLIVE_MINIMUM_LIFETIME);
+      if (pid = harness_find_process("daemond"), pid <= 0)
+	return pid ? -1 : (errno = 0, fprintf(stderr, "%s: daemond is not running\n", *argv), -1);
+      
+      start = harness_now();
+      if (kill(pid, SIGKILL) < 0)
+	return -1;
+      /* A message sent while the dying daemond is still waiting
+	 for one could be handed to it, so wait until it is gone. */
+      while (kill(pid, 0) == 0)
+	harness_sleep(DEATH_POLL_INTERVAL);
+      if (harness_send("stop", "bench-probe") < 0)
+	return -1;
+      if (harness_await_drain(pid, REPORT_TIMEOUT * 1000000LL) < 0)
+	return -1;
+      samples[i] = harness_now() - start;
+    }
+  return 0;
+}
+
+
+/**
+ * Run the benchmark and print its result
+ * 
+ * @param   options  The options of the benchmark
+ * @return           Zero on success, -1 on error
+ */
+static int run_benchmark(const struct options* restrict options)
+{
+  size_t most = service_count * options->rounds;
+  long long* samples;
+  long long elapsed;
+  size_t concurrency, messages;
+  
+  if (options->concurrency * options->messages > most)
+    most = options->concurrency * options->messages;
+  if (options->resurrections > most)
+    most = options->resurrections;
+  if (samples = malloc(most * sizeof(long long)), samples == NULL)
+    return -1;
+  
+  if (harness_start_daemond() < 0)
+    goto fail;
+  
+  printf("{\n  \"rundir\": \"%s/" RUNDIR "\",\n  \"unit\": \"ns\",\n", harness_workspace);
+  
+  if (bench_spawn(samples) < 0)
+    goto fail;
+  printf("  \"spawn_to_ready\": { ");
+  harness_print_statistics(samples, service_count);
+  printf(" },\n");
+  
+  if (bench_reap(samples, options->rounds) < 0)
+    goto fail;
+  printf("  \"reap_to_restart\": { ");
+  harness_print_statistics(samples, service_count * options->rounds);
+  printf(" },\n");
+  
+  printf("  \"control_round_trip\": [");
+  for (concurrency = 1;; concurrency *= 2)
+    {
+      if (concurrency > options->concurrency)
+	concurrency = options->concurrency;
+      messages = concurrency * options->messages;
+      if (bench_control(samples, concurrency, options->messages, &elapsed) < 0)
+	goto fail;
+      printf("%s\n    { \"concurrency\": %zu, \"per_second\": %lli, ", concurrency > 1 ? "," : "",
+	     concurrency, (long long)messages * NANOSECONDS / (elapsed > 0 ? elapsed : 1));
+      harness_print_statistics(samples, messages);
+      printf(" }");
+      if (concurrency == options->concurrency)
+	break;
+    }
+  printf("\n  ],\n");
+  
+  if (bench_resurrection(samples, options->resurrections) < 0)
+    goto fail;
+  printf("  \"resurrection\": { ");
+  harness_print_statistics(samples, options->resurrections);
+  printf(" }\n}\n");
+  
+  free(samples);
+  return fflush(stdout);
+ 
+ fail:
+  free(samples);
+  fflush(stdout);
+  return -1;
+}
+
+
+
+/**
+ * Benchmark daemond in a workspace of its own
+ * 
+ * Usage: daemond-bench [OPTION]... BINDIR DIRECTORY
+ * 
+ * The workspace is created in DIRECTORY, which should be on
+ * a tmpfs, and the binaries under benchmark are in BINDIR, they
+ * must have been built with the run directory, configuration
+ * directory and library directory relative to the workspace
+ * 
+ * Options:
+ *   --services=N       Spawn N services (default 16)
+ *   --rounds=N         Kill each service N times (default 4)
+ *   --messages=N       Send N control requests per sender (default 500)
+ *   --concurrency=N    Use up to N concurrent senders (default 16)
+ *   --resurrections=N  Kill daemond N times (default 3)
+ *   --reexec           Make daemond re-execute itself at the end, so that
+ *                      a daemond built with -fprofile-generate writes its profile
+ * 
+ * @param   argc   The number of elements in `argv_`
+ * @param   argv_  Command line arguments
+ * @return         Zero on success, 1 on error, 2 on usage error
+ */
+int main(int argc, char** argv_)
+{
+  struct options options = { 16, 4, 500, 16, 3 };
+  const char* operands[2];
+  int i, n = 0, r = 0, reexec = 0;
+  
+  argv = argv_;
+  
+  if ((argc == 3) && !strcmp(argv[1], "--service"))
+    return service_procedure(argv[2]);
+  
+  for (i = 1; i < argc; i++)
+    {
+      if      ((r = harness_parse_option(argv[i], "--services=", &options.services)));
+      else if ((r = harness_parse_option(argv[i], "--rounds=", &options.rounds)));
+      else if ((r = harness_parse_option(argv[i], "--messages=", &options.messages)));
+      else if ((r = harness_parse_option(argv[i], "--concurrency=", &options.concurrency)));
+      else if ((r = harness_parse_option(argv[i], "--resurrections=", &options.resurrections)));
+      else if (!strcmp(argv[i], "--reexec"))
+	reexec = r = 1;
+      else if (n < 2)
+	{
+	  operands[n++] = argv[i];
+	  continue;
+	}
+      if (r <= 0)
+	break;
+    }
+  if (!options.services || !options.rounds || !options.messages ||
+      !options.concurrency || !options.resurrections)
+    r = -1;
+  if ((r < 0) || (i < argc) || (n < 2))
+    return fprintf(stderr, "%s: usage: %s [OPTION]... BINDIR DIRECTORY\n", *argv, *argv), 2;
+  
+  service_count = options.services;
+  if (options.concurrency > service_count)
+    options.concurrency = service_count;
+  
+  if (prepare_workspace(operands[0], operands[1]) < 0)
+    {
+      perror(*argv);
+      harness_teardown(0);
+      return 1;
+    }
+  
+  if ((run_benchmark(&options) < 0) || (reexec && (harness_reexec_daemond(REPORT_TIMEOUT * 1000000LL) < 0)))
+    {
+      if (errno)
+	perror(*argv);
+      harness_teardown(1);
+      return 1;
+    }
+  
+  harness_teardown(0);
+  return 0;
+}
+
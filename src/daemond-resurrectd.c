@@ -26,6 +26,8 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <time.h>
+#include <string.h>
+#include <fcntl.h>
 
 
 
@@ -44,8 +46,9 @@
  */
 #define etcrun(hook)							\
   if (fork() == 0)							\
+    sigprocmask(SIG_SETMASK, &wait_mask, NULL),				\
     execlp(SYSCONFDIR "/" PKGNAME ".d/" hook,				\
-	   SYSCONFDIR "/" PKGNAME ".d/" hook, NULL), exit(0)
+	   SYSCONFDIR "/" PKGNAME ".d/" hook, NULL), _exit(0)
 
 
 
@@ -59,6 +62,18 @@ static char** argv;
  */
 static pid_t child = -1;
 
+/**
+ * The lifeline of `daemond`, if it was passed to us
+ * with `--lifeline`, otherwise -1
+ */
+static int life = -1;
+
+/**
+ * The signal mask to use while waiting for signals,
+ * SIGCHLD, SIGUSR1 and SIGUSR2 are blocked otherwise
+ */
+static sigset_t wait_mask;
+
 /**
  * Whether the immortality protocol is enabled
  */
@@ -74,7 +89,7 @@ static volatile sig_atomic_t reexec = 0;
 /**
  * This function will be called in the parent
  * process when a signal is catched. It is only
- * here to make sure `pause` gets interrupted.
+ * here to make sure `sigsuspend` gets interrupted.
  * 
  * @param  signo  The caught signal
  */
@@ -106,6 +121,25 @@ static void anastatis_handle_signal(int signo)
  */
 static int initialise_daemon(void)
 {
+  sigset_t mask;
+  
+  /* Block the signals we wait for, so they cannot arrive before we wait. */
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigaddset(&mask, SIGUSR1);
+  sigaddset(&mask, SIGUSR2);
+  if (sigprocmask(SIG_BLOCK, &mask, &wait_mask) < 0)
+    return 1;
+  
+  /* Hold the lifeline so it is held even while `daemond` is being
+     resurrected, but do not let hooks inherit it. */
+  if (life >= 0)
+    if (fcntl(life, F_SETFD, FD_CLOEXEC) < 0)
+      return 1;
+  sigdelset(&wait_mask, SIGCHLD);
+  sigdelset(&wait_mask, SIGUSR1);
+  sigdelset(&wait_mask, SIGUSR2);
+  
   if ((signal(SIGCHLD,    parent_handle_signal) == SIG_ERR) ||
       (signal(SIGUSR1, anastatis_handle_signal) == SIG_ERR) ||
       (signal(SIGUSR2, anastatis_handle_signal) == SIG_ERR))
@@ -122,7 +156,13 @@ static int initialise_daemon(void)
  */
 static int child_procedure(void)
 {
-  execlp(LIBEXECDIR "/daemond", "daemond", NULL);
+  char life_str[3 * sizeof(int) + 1];
+  if (sigprocmask(SIG_SETMASK, &wait_mask, NULL) < 0)
+    return 1;
+  if (life < 0)
+    execlp(LIBEXECDIR "/daemond", "daemond", NULL);
+  else if (sprintf(life_str, "%i", life), fcntl(life, F_SETFD, 0) == 0)
+    execlp(LIBEXECDIR "/daemond", "daemond", "--lifeline", life_str, NULL);
   return 1;
 }
 
@@ -137,7 +177,7 @@ static int parent_procedure(void)
   int rc = 0;
   pid_t r;
   
-  pause();
+  sigsuspend(&wait_mask);
   
   r = waitpid(child, &rc, WNOHANG);
   if (r == -1)
@@ -162,12 +202,18 @@ static void respawn_handle_interruption(void)
   if (reexec)
     {
       char pid_str[3 * sizeof(pid_t) + 1];
+      char life_str[3 * sizeof(int) + 1];
       fprintf(stderr, "%s: reexecuting\n", *argv);
       if (!immortality)
 	fprintf(stderr, "%s: immortality protocol will be reenabled\n", *argv);
       sprintf(pid_str, "%ji", (intmax_t)child);
-      execlp(LIBEXECDIR "/daemond-resurrectd", "daemond-resurrectd", pid_str, NULL);
+      if (life < 0)
+	execlp(LIBEXECDIR "/daemond-resurrectd", "daemond-resurrectd", pid_str, NULL);
+      else if (sprintf(life_str, "%i", life), fcntl(life, F_SETFD, 0) == 0)
+	execlp(LIBEXECDIR "/daemond-resurrectd", "daemond-resurrectd", pid_str, "--lifeline", life_str, NULL);
       perror(*argv);
+      if (life >= 0)
+	fcntl(life, F_SETFD, FD_CLOEXEC);
     }
   else if (immortality_ && !immortality)
     {
@@ -267,7 +313,7 @@ static int respawn(void)
   
   for (;;)
     {
-      pause(); /* We are having problems with getting signals to interrupt `wait`. */
+      sigsuspend(&wait_mask); /* We are having problems with getting signals to interrupt `wait`. */
       pid = waitpid(-1, &status, WNOHANG);
       if ((pid == 0) || ((pid == -1) && (errno == EINTR)))
 	{
@@ -297,18 +343,20 @@ static int respawn(void)
  */
 int main(int argc, char** argv_)
 {
-  int r;
+  int i, r;
   
   argv = argv_;
+  for (i = 1; i < argc; i++)
+    if (!strcmp(argv[i], "--lifeline") && (i + 1 < argc))
+      life = atoi(argv[++i]);
+    else
+      child = (pid_t)atoll(argv[i]);
   
   if ((r = initialise_daemon()))
     return perror(*argv), r;
   
-  if (argc == 2)
-    {
-      child = (pid_t)atoll(argv[1]);
-      goto have_child;
-    }
+  if (child > 0)
+    goto have_child;
   
   if (child = fork(), child == -1)
     return perror(*argv), 1;
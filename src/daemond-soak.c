@@ -0,0 +1,926 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include "config.h"
+#include "harness.h"
+#include "timer.h"
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <limits.h>
+
+
+
+/**
+ * The name of the template that the synthetic services are instances of
+ */
+#define SOAK_TEMPLATE  "soak@"
+
+/**
+ * The pathname, relative to the workspace, of the FIFO
+ * that the synthetic services report to
+ */
+#define SOAK_FIFO  RUNDIR "/soak/reports"
+
+/**
+ * The number of nanoseconds to wait for all services
+ * to have started, before the soak is aborted
+ */
+#define STARTUP_TIMEOUT  (120 * NANOSECONDS)
+
+/**
+ * The number of nanoseconds a service must have lived before it is
+ * killed in a burst, so that it is respawned rather than put in backoff,
+ * with a margin for daemond noticing its readiness late under load
+ */
+#define OUTLIVE_MINIMUM_LIFETIME  (1500 * 1000000LL)
+
+/**
+ * The number of milliseconds to wait for reports before
+ * looking for missed reaps and whether it is time to burst
+ */
+#define TICK  100
+
+/**
+ * The size of the FIFO to ask for, so that a burst
+ * of reports does not block the services
+ */
+#define FIFO_SIZE  (1 << 20)
+
+/**
+ * The base 2 logarithm of the number of buckets per power
+ * of two in the histogram of restart latencies
+ */
+#define HISTOGRAM_PRECISION  5
+
+/**
+ * The number of buckets in the histogram of restart latencies,
+ * enough for microsecond resolution up to 2⁴⁰ microseconds
+ */
+#define HISTOGRAM_SIZE  ((40 - HISTOGRAM_PRECISION + 1) << HISTOGRAM_PRECISION)
+
+
+
+/**
+ * What a synthetic service reports
+ */
+enum report_kind
+  {
+    /**
+     * The service has started
+     */
+    REPORT_STARTED,
+    
+    /**
+     * The service is about to crash or exit
+     */
+    REPORT_DYING
+  };
+
+
+/**
+ * What a synthetic service writes to the FIFO
+ */
+struct report
+{
+  /**
+   * The instance of the service
+   */
+  int instance;
+  
+  /**
+   * What happened, a `enum report_kind`
+   */
+  int kind;
+  
+  /**
+   * The process ID of the service
+   */
+  pid_t pid;
+  
+  /**
+   * The time, in nanoseconds on `CLOCK_MONOTONIC`, the report was made
+   */
+  long long time;
+};
+
+
+/**
+ * What is known about a synthetic service
+ */
+struct instance
+{
+  /**
+   * The process ID of the service, 0 before it has started
+   */
+  pid_t pid;
+  
+  /**
+   * When the service last started
+   */
+  long long started;
+  
+  /**
+   * When the service died, 0 if it has been respawned since
+   */
+  long long died;
+  
+  /**
+   * Whether the death has been counted as a missed reap
+   */
+  int missed;
+};
+
+
+/**
+ * Resource usage of daemond
+ */
+struct supervisor
+{
+  /**
+   * The process ID of daemond
+   */
+  pid_t pid;
+  
+  /**
+   * The CPU time, in milliseconds, used by daemond
+   */
+  long long cpu_ms;
+  
+  /**
+   * The CPU time, in milliseconds, used by the children daemond
+   * has reaped, which are mostly the processes that start services
+   */
+  long long children_cpu_ms;
+  
+  /**
+   * The resident set size, in kilobytes
+   */
+  long long rss_kb;
+  
+  /**
+   * The number of open file descriptors
+   */
+  long long fds;
+  
+  /**
+   * The number of children that have died but not been reaped
+   */
+  long long zombies;
+};
+
+
+/**
+ * The options of the soak
+ */
+struct options
+{
+  /**
+   * The number of synthetic services
+   */
+  size_t services;
+  
+  /**
+   * The number of seconds to soak for
+   */
+  size_t duration;
+  
+  /**
+   * The mean number of milliseconds a service lives
+   */
+  size_t lifetime;
+  
+  /**
+   * The percentage of deaths that are crashes rather than exits
+   */
+  size_t crash;
+  
+  /**
+   * The number of services to kill at once in a burst, 0 for no bursts
+   */
+  size_t burst;
+  
+  /**
+   * The number of seconds between bursts
+   */
+  size_t burst_interval;
+  
+  /**
+   * The number of seconds between each sample of daemond's resource usage
+   */
+  size_t interval;
+  
+  /**
+   * The number of milliseconds a dead service may take
+   * to be respawned before it is counted as a missed reap
+   */
+  size_t reap_deadline;
+};
+
+
+
+/**
+ * Command line arguments
+ */
+char** argv;
+
+/**
+ * The synthetic services, indexed by instance minus one
+ */
+static struct instance* instances = NULL;
+
+/**
+ * The number of synthetic services
+ */
+static size_t instance_count = 0;
+
+/**
+ * The number of started services that have not yet reported
+ */
+static size_t unstarted = 0;
+
+/**
+ * The read end of the FIFO
+ */
+static int fifo = -1;
+
+/**
+ * The number of restarts with each latency, in microseconds
+ */
+static unsigned long long histogram[HISTOGRAM_SIZE];
+
+/**
+ * The number of restarts
+ */
+static unsigned long long restarts = 0;
+
+/**
+ * The sum, in nanoseconds, of all restart latencies
+ */
+static long long latency_sum = 0;
+
+/**
+ * The shortest restart latency, in nanoseconds
+ */
+static long long latency_min = LLONG_MAX;
+
+/**
+ * The longest restart latency, in nanoseconds
+ */
+static long long latency_max = 0;
+
+/**
+ * The number of deaths, crashes, exits and killings
+ */
+static unsigned long long deaths = 0;
+
+/**
+ * The number of deaths that were not followed by a respawn in time
+ */
+static unsigned long long missed_reaps = 0;
+
+
+
+/**
+ * The synthetic service, it reports when it has started, lives for
+ * a while, reports that it is dying, and crashes or exits with a
+ * failure, so that it is respawned
+ * 
+ * @param   pathname  The pathname of the FIFO
+ * @param   lifetime  The mean number of milliseconds to live, as a string
+ * @param   crash     The percentage of deaths that are crashes, as a string
+ * @return            Value for `main` to return
+ */
+static int service_procedure(const char* pathname, const char* lifetime, const char* crash)
+{
+  const char* instance = getenv(ENV_DAEMON_INSTANCE_TAG);
+  unsigned long mean = strtoul(lifetime, NULL, 10);
+  struct rlimit no_core = { 0, 0 };
+  struct report report;
+  long long life;
+  int fd;
+  
+  if (instance == NULL)
+    return fprintf(stderr, "%s: %s is not set\n", *argv, ENV_DAEMON_INSTANCE_TAG), 1;
+  if (fd = open(pathname, O_WRONLY | O_CLOEXEC), fd < 0)
+    return perror(*argv), 1;
+  
+  report.instance = atoi(instance);
+  report.kind = REPORT_STARTED;
+  report.pid = getpid();
+  report.time = harness_now();
+  if (harness_write(fd, &report, sizeof(report)) < 0)
+    return perror(*argv), 1;
+  
+  srand((unsigned)(report.pid) ^ (unsigned)(report.time));
+  life = (long long)(mean / 2 + (unsigned long)rand() % (mean + 1));
+  harness_sleep(life * 1000000LL);
+  
+  report.kind = REPORT_DYING;
+  report.time = harness_now();
+  if (harness_write(fd, &report, sizeof(report)) < 0)
+    return perror(*argv), 1;
+  
+  if (rand() % 100 < atoi(crash))
+    {
+      setrlimit(RLIMIT_CORE, &no_core);
+      raise(SIGSEGV);
+    }
+  return 1;
+}
+
+
+/**
+ * Create the workspace, with a template descriptor
+ * for the synthetic services and their FIFO
+ * 
+ * @param   bindir   The directory with the binaries under test
+ * @param   root     The directory to create the workspace in
+ * @param   options  The options of the soak
+ * @return           Zero on success, -1 on error
+ */
+static int prepare_workspace(const char* bindir, const char* root, const struct options* restrict options)
+{
+  FILE* f;
+  
+  if (harness_prepare(bindir, root, "soak") < 0)
+    return -1;
+  
+  if (f = fopen(DAEMONDIR "/" SOAK_TEMPLATE DESCRIPTOR_SUFFIX, "w"), f == NULL)
+    return -1;
+  fprintf(f, "activation = eager\n");
+  fprintf(f, "instances = %zu\n", options->services);
+  fprintf(f, "reload-signal = none\n");
+  fprintf(f, "update-signal = none\n");
+  fprintf(f, "exec = %s/" PKGNAME "-soak --service %s/" SOAK_FIFO " %zu %zu\n",
+	  harness_workspace, harness_workspace, options->lifetime, options->crash);
+  if (fclose(f) < 0)
+    return -1;
+  
+  if (instances = calloc(options->services, sizeof(*instances)), instances == NULL)
+    return -1;
+  instance_count = unstarted = options->services;
+  
+  /* Open the FIFO for reading and writing, so that
+     the services do not block and we never read end of file. */
+  if (mkfifo(SOAK_FIFO, 0600) < 0)
+    return -1;
+  if (fifo = open(SOAK_FIFO, O_RDWR | O_NONBLOCK | O_CLOEXEC), fifo < 0)
+    return -1;
+  fcntl(fifo, F_SETPIPE_SZ, FIFO_SIZE);
+  
+  return 0;
+}
+
+
+/**
+ * Get the histogram bucket for a restart latency
+ * 
+ * @param   us  The latency, in microseconds
+ * @return      The index of the bucket
+ */
+static size_t __attribute__((const)) histogram_bucket(unsigned long long us)
+{
+  int e;
+  if (us < (1 << HISTOGRAM_PRECISION))
+    return (size_t)us;
+  e = 63 - __builtin_clzll(us);
+  if (e >= 40)
+    return HISTOGRAM_SIZE - 1;
+  return ((size_t)(e - HISTOGRAM_PRECISION + 1) << HISTOGRAM_PRECISION) +
+    (size_t)((us >> (e - HISTOGRAM_PRECISION)) & ((1 << HISTOGRAM_PRECISION) - 1));
+}
+
+
+/**
+ * Get the latency in the middle of a histogram bucket
+ * 
+ * @param   bucket  The index of the bucket
+ * @return          The latency, in nanoseconds
+ */
+static long long __attribute__((const)) histogram_latency(size_t bucket)
+{
+  size_t e = bucket >> HISTOGRAM_PRECISION;
+  unsigned long long sub = bucket & ((1 << HISTOGRAM_PRECISION) - 1);
+  unsigned long long us;
+  if (e == 0)
+    return (long long)(bucket * 1000);
+  e += HISTOGRAM_PRECISION - 1;
+  us = ((1ULL << HISTOGRAM_PRECISION) + sub) << (e - HISTOGRAM_PRECISION);
+  us += (1ULL << (e - HISTOGRAM_PRECISION)) / 2;
+  return (long long)(us * 1000);
+}
+
+
+/**
+ * Get a percentile of the restart latencies
+ * 
+ * @param   permille  The percentile, in thousandths
+ * @return            The latency, in nanoseconds
+ */
+static long long __attribute__((pure)) latency_percentile(unsigned long long permille)
+{
+  unsigned long long rank = (restarts - 1) * permille / 1000, seen = 0;
+  size_t i;
+  for (i = 0; i < HISTOGRAM_SIZE; i++)
+    if (seen += histogram[i], seen > rank)
+      break;
+  if (i == HISTOGRAM_SIZE)
+    return latency_max;
+  return histogram_latency(i);
+}
+
+
+/**
+ * Record the latency of a restart
+ * 
+ * @param  latency  The time, in nanoseconds, from the service
+ *                  died until it had been respawned
+ */
+static void record_restart(long long latency)
+{
+  if (latency < 0)
+    latency = 0;
+  histogram[histogram_bucket((unsigned long long)latency / 1000)]++;
+  restarts++;
+  latency_sum += latency;
+  if (latency < latency_min)  latency_min = latency;
+  if (latency > latency_max)  latency_max = latency;
+}
+
+
+/**
+ * Read and handle all reports in the FIFO
+ * 
+ * @return  Zero on success, -1 on error
+ */
+static int read_reports(void)
+{
+  struct report reports[256];
+  struct instance* instance;
+  ssize_t got;
+  size_t i, n;
+  
+  for (;;)
+    {
+      if (got = read(fifo, reports, sizeof(reports)), got < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return errno == EAGAIN ? 0 : -1;
+	}
+      
+      /* Reports are written atomically, so only whole ones are read. */
+      n = (size_t)got / sizeof(*reports);
+      for (i = 0; i < n; i++)
+	{
+	  if ((reports[i].instance < 1) || ((size_t)(reports[i].instance) > instance_count))
+	    continue;
+	  instance = instances + (reports[i].instance - 1);
+	  
+	  if (reports[i].kind == REPORT_DYING)
+	    {
+	      if (instance->died == 0)
+		instance->died = reports[i].time, deaths++;
+	      continue;
+	    }
+	  
+	  if (instance->pid == 0)
+	    unstarted--;
+	  else if (instance->died)
+	    record_restart(reports[i].time - instance->died);
+	  instance->pid = reports[i].pid;
+	  instance->started = reports[i].time;
+	  instance->died = 0;
+	  instance->missed = 0;
+	}
+      
+      if ((size_t)got < sizeof(reports))
+	return 0;
+    }
+}
+
+
+/**
+ * Wait for reports, or until the next tick
+ * 
+ * @return  Zero on success, -1 on error
+ */
+static int await_reports(void)
+{
+  struct pollfd pfd;
+  pfd.fd = fifo;
+  pfd.events = POLLIN;
+  if ((poll(&pfd, 1, TICK) < 0) && (errno != EINTR))
+    return -1;
+  return read_reports();
+}
+
+
+/**
+ * Count the services that have not been respawned in time
+ * 
+ * @param  now       The current time
+ * @param  deadline  The number of nanoseconds a dead service may
+ *                   take to be respawned
+ */
+static void count_missed_reaps(long long now, long long deadline)
+{
+  size_t i;
+  for (i = 0; i < instance_count; i++)
+    if (instances[i].died && !instances[i].missed && (now - instances[i].died > deadline))
+      instances[i].missed = 1, missed_reaps++;
+}
+
+
+/**
+ * Kill a number of services at once
+ * 
+ * @param   count  The number of services to kill
+ * @return         The number of services that were killed
+ */
+static size_t burst(size_t count)
+{
+  size_t i, j, killed = 0;
+  long long now = harness_now();
+  
+  j = (size_t)rand() % instance_count;
+  for (i = 0; (i < instance_count) && (killed < count); i++, j = (j + 1) % instance_count)
+    {
+      if ((instances[j].pid <= 0) || instances[j].died)
+	continue;
+      if (now - instances[j].started < OUTLIVE_MINIMUM_LIFETIME)
+	continue;
+      if (kill(instances[j].pid, SIGKILL) == 0)
+	instances[j].died = now, deaths++, killed++;
+    }
+  
+  return killed;
+}
+
+
+/**
+ * Read the first line that starts with a specific prefix in a file
+ * 
+ * @param   pathname  The pathname of the file
+ * @param   prefix    The prefix of the line, empty for the first line
+ * @param   buf       Output parameter for the rest of the line
+ * @param   size      The size of `buf`
+ * @return            Zero on success, -1 on error or if not found
+ */
+static int read_line(const char* restrict pathname, const char* restrict prefix,
+		     char* restrict buf, size_t size)
+{
+  char line[1024];
+  size_t n = strlen(prefix);
+  int r = -1;
+  FILE* f;
+  
+  if (f = fopen(pathname, "r"), f == NULL)
+    return -1;
+  while (fgets(line, (int)sizeof(line), f))
+    if (!strncmp(line, prefix, n))
+      {
+	snprintf(buf, size, "%s", line + n);
+	r = 0;
+	break;
+      }
+  fclose(f);
+  return r;
+}
+
+
+/**
+ * Get the state and parent of a process
+ * 
+ * @param   pid    The process ID, as a string
+ * @param   state  Output parameter for the state of the process
+ * @param   ppid   Output parameter for the parent of the process
+ * @return         Zero on success, -1 on error
+ */
+static int process_state(const char* restrict pid, char* restrict state, pid_t* restrict ppid)
+{
+  char pathname[sizeof("/proc//stat") + NAME_MAX];
+  char buf[1024];
+  char* p;
+  int parent;
+  
+  sprintf(pathname, "/proc/%s/stat", pid);
+  if (read_line(pathname, "", buf, sizeof(buf)) < 0)
+    return -1;
+  /* The name of the process is in parentheses, and may contain anything. */
+  if (p = strrchr(buf, ')'), p == NULL)
+    return -1;
+  if (sscanf(p + 1, " %c %i", state, &parent) != 2)
+    return -1;
+  *ppid = (pid_t)parent;
+  return 0;
+}
+
+
+/**
+ * Measure the resource usage of daemond
+ * 
+ * @param   supervisor  The process ID of daemond in, and its resource usage out
+ * @return              Zero on success, -1 on error
+ */
+static int sample_supervisor(struct supervisor* restrict supervisor)
+{
+  char pathname[sizeof("/proc//status") + 3 * sizeof(pid_t)];
+  char buf[1024];
+  unsigned long utime, stime;
+  long cutime, cstime, ticks = sysconf(_SC_CLK_TCK);
+  struct dirent* entry;
+  char* p;
+  char state;
+  pid_t ppid;
+  DIR* dir;
+  
+  sprintf(pathname, "/proc/%ji/stat", (intmax_t)(supervisor->pid));
+  if (read_line(pathname, "", buf, sizeof(buf)) < 0)
+    return -1;
+  if (p = strrchr(buf, ')'), p == NULL)
+    return errno = 0, fprintf(stderr, "%s: could not parse %s\n", *argv, pathname), -1;
+  if (sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %li %li",
+	     &utime, &stime, &cutime, &cstime) != 4)
+    return errno = 0, fprintf(stderr, "%s: could not parse %s\n", *argv, pathname), -1;
+  supervisor->cpu_ms = (long long)(utime + stime) * 1000 / ticks;
+  supervisor->children_cpu_ms = (long long)(cutime + cstime) * 1000 / ticks;
+  
+  sprintf(pathname, "/proc/%ji/status", (intmax_t)(supervisor->pid));
+  if (read_line(pathname, "VmRSS:", buf, sizeof(buf)) < 0)
+    return -1;
+  supervisor->rss_kb = atoll(buf);
+  
+  sprintf(pathname, "/proc/%ji/fd", (intmax_t)(supervisor->pid));
+  if (dir = opendir(pathname), dir == NULL)
+    return -1;
+  supervisor->fds = 0;
+  while ((entry = readdir(dir)))
+    if (*(entry->d_name) != '.')
+      supervisor->fds++;
+  closedir(dir);
+  
+  if (dir = opendir("/proc"), dir == NULL)
+    return -1;
+  supervisor->zombies = 0;
+  while ((entry = readdir(dir)))
+    if ((*(entry->d_name) != '\0') && strchr("123456789", *(entry->d_name)))
+      if (process_state(entry->d_name, &state, &ppid) == 0)
+	if ((state == 'Z') && (ppid == supervisor->pid))
+	  supervisor->zombies++;
+  closedir(dir);
+  
+  return 0;
+}
+
+
+/**
+ * Find daemond, and count it if it has been resurrected
+ * 
+ * @param   pid            The last known process ID of daemond, updated
+ * @param   resurrections  The number of resurrections, updated
+ * @return                 Zero on success, -1 on error
+ */
+static int find_supervisor(pid_t* restrict pid, unsigned long long* restrict resurrections)
+{
+  pid_t found = harness_find_process("daemond");
+  if (found < 0)
+    return -1;
+  if (found == 0)
+    return errno = 0, fprintf(stderr, "%s: daemond is not running\n", *argv), -1;
+  if (*pid && (found != *pid))
+    ++*resurrections;
+  *pid = found;
+  return 0;
+}
+
+
+/**
+ * Run the soak, printing the timeline as it goes, and a summary at the end
+ * 
+ * @param   options  The options of the soak
+ * @return           Zero on success, -1 on error
+ */
+static int run_soak(const struct options* restrict options)
+{
+  struct supervisor first, last, current;
+  unsigned long long resurrections = 0, bursts = 0, burst_kills = 0, sampled_restarts;
+  long long zombies_max = 0, rss_max = 0, cpu;
+  long long begin, now, next_sample, next_burst, end;
+  long long deadline = (long long)(options->reap_deadline) * 1000000LL;
+  const char* separator = "";
+  
+  memset(&first, 0, sizeof(first));
+  if (harness_start_daemond() < 0)
+    return -1;
+  if (find_supervisor(&first.pid, &resurrections) < 0)
+    return -1;
+  
+  /* The services are activated eagerly, wait for all of them. */
+  end = harness_now() + STARTUP_TIMEOUT;
+  while (unstarted)
+    {
+      if (await_reports() < 0)
+	return -1;
+      if (harness_now() > end)
+	return errno = 0, fprintf(stderr, "%s: only %zu of %zu services started in time\n",
+				  *argv, instance_count - unstarted, instance_count), -1;
+    }
+  
+  if (sample_supervisor(&first) < 0)
+    return -1;
+  last = current = first;
+  rss_max = first.rss_kb;
+  zombies_max = first.zombies;
+  
+  printf("{\n  \"rundir\": \"%s/" RUNDIR "\",\n", harness_workspace);
+  printf("  \"services\": %zu,\n  \"duration\": %zu,\n", options->services, options->duration);
+  printf("  \"lifetime_ms\": %zu,\n  \"crash_percent\": %zu,\n", options->lifetime, options->crash);
+  printf("  \"burst\": %zu,\n  \"burst_interval\": %zu,\n", options->burst, options->burst_interval);
+  printf("  \"timeline\": [");
+  fflush(stdout);
+  
+  begin = harness_now();
+  sampled_restarts = restarts;
+  next_sample = begin + (long long)(options->interval) * NANOSECONDS;
+  next_burst = begin + (long long)(options->burst_interval) * NANOSECONDS;
+  end = begin + (long long)(options->duration) * NANOSECONDS;
+  
+  for (;;)
+    {
+      if (await_reports() < 0)
+	return -1;
+      now = harness_now();
+      count_missed_reaps(now, deadline);
+      
+      if ((now >= next_sample) || (now >= end))
+	{
+	  if (find_supervisor(&current.pid, &resurrections) < 0)
+	    return -1;
+	  if (sample_supervisor(&current) < 0)
+	    return -1;
+	  if (current.rss_kb > rss_max)        rss_max = current.rss_kb;
+	  if (current.zombies > zombies_max)  zombies_max = current.zombies;
+	  cpu = current.cpu_ms - last.cpu_ms;
+	  
+	  printf("%s\n    { \"elapsed\": %lli, \"restarts\": %llu, \"missed_reaps\": %llu, \"zombies\": %lli,"
+		 " \"rss_kb\": %lli, \"fds\": %lli, \"cpu_ms\": %lli, \"children_cpu_ms\": %lli }",
+		 separator, (now - begin) / NANOSECONDS, restarts - sampled_restarts, missed_reaps, current.zombies,
+		 current.rss_kb, current.fds, cpu, current.children_cpu_ms - last.children_cpu_ms);
+	  fflush(stdout);
+	  separator = ",";
+	  sampled_restarts = restarts;
+	  last = current;
+	  next_sample += (long long)(options->interval) * NANOSECONDS;
+	}
+      
+      if (options->burst && (now >= next_burst) && (now < end))
+	{
+	  burst_kills += burst(options->burst);
+	  bursts++;
+	  next_burst += (long long)(options->burst_interval) * NANOSECONDS;
+	}
+      
+      if (now >= end)
+	break;
+    }
+  
+  cpu = current.cpu_ms - first.cpu_ms;
+  printf("\n  ],\n  \"supervisor\": { \"cpu_ms\": %lli, \"children_cpu_ms\": %lli, \"cpu_permille\": %lli,",
+	 cpu, current.children_cpu_ms - first.children_cpu_ms, cpu * 1000000LL / ((now - begin) / 1000 + 1));
+  printf(" \"rss_kb_initial\": %lli, \"rss_kb_final\": %lli, \"rss_kb_max\": %lli, \"rss_kb_growth\": %lli,",
+	 first.rss_kb, current.rss_kb, rss_max, current.rss_kb - first.rss_kb);
+  printf(" \"fds_initial\": %lli, \"fds_final\": %lli, \"zombies_max\": %lli, \"zombies_final\": %lli,"
+	 " \"resurrections\": %llu },\n", first.fds, current.fds, zombies_max, current.zombies, resurrections);
+  printf("  \"deaths\": %llu,\n  \"restarts\": %llu,\n  \"bursts\": %llu,\n  \"burst_kills\": %llu,\n",
+	 deaths, restarts, bursts, burst_kills);
+  printf("  \"missed_reaps\": %llu,\n  \"restart_latency\": { \"unit\": \"ns\", \"samples\": %llu",
+	 missed_reaps, restarts);
+  if (restarts)
+    {
+      printf(", \"min\": %lli, \"mean\": %lli", latency_min, latency_sum / (long long)restarts);
+      printf(", \"p50\": %lli", latency_percentile(500));
+      printf(", \"p90\": %lli", latency_percentile(900));
+      printf(", \"p99\": %lli", latency_percentile(990));
+      printf(", \"p999\": %lli", latency_percentile(999));
+      printf(", \"max\": %lli", latency_max);
+    }
+  printf(" }\n}\n");
+  
+  return fflush(stdout);
+}
+
+
+
+/**
+ * Soak daemond with synthetic services that keep crashing
+ * 
+ * Usage: daemond-soak [OPTION]... BINDIR DIRECTORY
+ * 
+ * The workspace is created in DIRECTORY, which should be on
+ * a tmpfs, and the binaries under test are in BINDIR, they
+ * must have been built with the run directory, configuration
+ * directory and library directory relative to the workspace
+ * 
+ * Options:
+ *   --services=N        Run N synthetic services (default 1000)
+ *   --duration=S        Soak for S seconds (default 3600)
+ *   --lifetime=MS       Let services live MS milliseconds on average (default 5000)
+ *   --crash=P           Let P percent of deaths be crashes (default 50)
+ *   --burst=N           Kill N services at once in each burst (default 100)
+ *   --burst-interval=S  Burst every S seconds (default 60)
+ *   --interval=S        Sample daemond every S seconds (default 10)
+ *   --reap-deadline=MS  Count deaths not respawned within MS milliseconds
+ *                       as missed reaps (default 5000)
+ *   --reexec            Make daemond re-execute itself at the end, so that
+ *                       a daemond built with -fprofile-generate writes its profile
+ * 
+ * @param   argc   The number of elements in `argv_`
+ * @param   argv_  Command line arguments
+ * @return         Zero on success, 1 on error, 2 on usage error
+ */
+int main(int argc, char** argv_)
+{
+  struct options options = { 1000, 3600, 5000, 50, 100, 60, 10, 5000 };
+  const char* operands[2];
+  int i, n = 0, r = 0, reexec = 0;
+  
+  argv = argv_;
+  
+  if ((argc == 5) && !strcmp(argv[1], "--service"))
+    return service_procedure(argv[2], argv[3], argv[4]);
+  
+  for (i = 1; i < argc; i++)
+    {
+      if      ((r = harness_parse_option(argv[i], "--services=", &options.services)));
+      else if ((r = harness_parse_option(argv[i], "--duration=", &options.duration)));
+      else if ((r = harness_parse_option(argv[i], "--lifetime=", &options.lifetime)));
+      else if ((r = harness_parse_option(argv[i], "--crash=", &options.crash)));
+      else if ((r = harness_parse_option(argv[i], "--burst=", &options.burst)));
+      else if ((r = harness_parse_option(argv[i], "--burst-interval=", &options.burst_interval)));
+      else if ((r = harness_parse_option(argv[i], "--interval=", &options.interval)));
+      else if ((r = harness_parse_option(argv[i], "--reap-deadline=", &options.reap_deadline)));
+      else if (!strcmp(argv[i], "--reexec"))
+	reexec = r = 1;
+      else if (n < 2)
+	{
+	  operands[n++] = argv[i];
+	  continue;
+	}
+      if (r <= 0)
+	break;
+    }
+  if (!options.services || !options.duration || !options.lifetime || (options.crash > 100) ||
+      !options.burst_interval || !options.interval || !options.reap_deadline)
+    r = -1;
+  if ((r < 0) || (i < argc) || (n < 2))
+    return fprintf(stderr, "%s: usage: %s [OPTION]... BINDIR DIRECTORY\n", *argv, *argv), 2;
+  
+  srand((unsigned)getpid());
+  
+  if (prepare_workspace(operands[0], operands[1], &options) < 0)
+    {
+      perror(*argv);
+      harness_teardown(0);
+      return 1;
+    }
+  
+  if ((run_soak(&options) < 0) || (reexec && (harness_reexec_daemond(STARTUP_TIMEOUT) < 0)))
+    {
+      if (errno)
+	perror(*argv);
+      harness_teardown(1);
+      return 1;
+    }
+  
+  harness_teardown(0);
+  return 0;
+}
+
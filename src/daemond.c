@@ -17,6 +17,15 @@
  */
 #include "config.h"
 #include "daemonise.h"
+#include "service.h"
+#include "metrics.h"
+#include "cgroup.h"
+#include "timer.h"
+#include "watch.h"
+#include "rollout.h"
+#include "status.h"
+#include "event.h"
+#include "selfcheck.h"
 
 #include <stdint.h>
 #include <unistd.h>
@@ -28,6 +37,25 @@
 #include <sys/msg.h>
 #include <sys/file.h>
 #include <sys/prctl.h>
+#include <fcntl.h>
+
+
+
+/**
+ * A message in the server message queue
+ */
+struct mqueue_message
+{
+  /**
+   * The class of the request
+   */
+  long mtype;
+  
+  /**
+   * The request
+   */
+  char mtext[];
+};
 
 
 
@@ -48,9 +76,10 @@ static int mqueue_id;
 
 /**
  * The file which holds a lock to indicate
- * that the daemon is running
+ * that the daemon is running, -1 until opened
+ * unless inherited, with `--lifeline`
  */
-static int life;
+static int life = -1;
 
 /**
  * Whether the parent has died
@@ -67,6 +96,67 @@ static volatile sig_atomic_t immortality = 1;
  */
 static volatile sig_atomic_t reexec = 0;
 
+/**
+ * Whether daemond runs as init, PID 1, without
+ * `daemond-resurrectd` and the immortality protocol
+ */
+static int init = 0;
+
+/**
+ * Whether daemond, as init, has been asked to shut down
+ */
+static volatile sig_atomic_t terminate = 0;
+
+/**
+ * Whether a signal that should be handled
+ * by `handle_interruption` has been received
+ */
+static volatile sig_atomic_t interrupted = 0;
+
+/**
+ * Whether the mane loop is about to wait
+ * for, or is waiting for, a message
+ */
+static volatile sig_atomic_t receiving = 0;
+
+/**
+ * Whether SIGCHLD has been received since
+ * the last time a process was reaped
+ */
+static volatile sig_atomic_t sigchld_pending = 0;
+
+/**
+ * When SIGCHLD was first received after
+ * the last time a process was reaped
+ */
+static struct timespec sigchld_time;
+
+/**
+ * The message types of the request classes,
+ * in the order the classes are taken
+ */
+static const long request_types[REQUEST_CLASSES] =
+  {
+    REQUEST_URGENT, REQUEST_NORMAL, REQUEST_BULK
+  };
+
+/**
+ * The number of requests of each class, in the
+ * order of `request_types`, that are taken in
+ * a row while there are other requests waiting
+ */
+static const unsigned request_weights[REQUEST_CLASSES] =
+  {
+    REQUEST_URGENT_WEIGHT, REQUEST_NORMAL_WEIGHT, REQUEST_BULK_WEIGHT
+  };
+
+/**
+ * The number of requests of each class, in the order
+ * of `request_types`, that may still be taken before
+ * every class has had its turn
+ */
+static unsigned request_credits[REQUEST_CLASSES];
+
 
 
 /**
@@ -80,6 +170,55 @@ static void noop_sig_handler(int signo)
 }
 
 
+/**
+ * Wake up the mane loop if it is waiting for a message
+ * 
+ * A signal that arrives after the mane loop has checked for
+ * signals, but before it has started waiting for a message,
+ * does not interrupt the wait, so an empty message is sent
+ * to the message queue instead
+ */
+static void wake_up(void)
+{
+  struct { long mtype; } message = { REQUEST_WAKE_UP };
+  int saved_errno = errno;
+  if (receiving)
+    msgsnd(mqueue_id, &message, 0, IPC_NOWAIT);
+  errno = saved_errno;
+}
+
+
+/**
+ * Signal handler for signals that only
+ * need to wake up the mane loop
+ * 
+ * @param  signo  The caught signal
+ */
+static void wake_sig_handler(int signo)
+{
+  (void) signo;
+  wake_up();
+}
+
+
+/**
+ * Signal handler for SIGCHLD, records when
+ * there first was something to reap
+ * 
+ * @param  signo  The caught signal
+ */
+static void sigchld_handler(int signo)
+{
+  (void) signo;
+  if (!sigchld_pending)
+    {
+      timer_now(&sigchld_time);
+      sigchld_pending = 1;
+      wake_up();
+    }
+}
+
+
 /**
  * A general signal handler
  * 
@@ -90,6 +229,9 @@ static void sig_handler(int signo)
   if      (signo == SIGRTMIN)  pdeath = 1;
   else if (signo == SIGUSR1)   reexec = 1;
   else if (signo == SIGUSR2)   immortality = 0;
+  else                         terminate = 1;
+  interrupted = 1;
+  wake_up();
 }
 
 
@@ -146,9 +288,12 @@ static int initialise_daemon(void)
 {
   int r;
   
-  /* There is an unlikely race condition: during exec:s the program loses its
-     lock, another instance of daemond could be started during this period. */
-  life = open(RUNDIR "/" PKGNAME "/lifeline", O_CREAT | O_APPEND | O_RDWR | O_CLOEXEC, 0750);
+  /* The lock belongs to the open file description, so when it is inherited,
+     across a re-exec or a resurrection, it has been held all along. */
+  if (life < 0)
+    life = open(RUNDIR "/" PKGNAME "/lifeline", O_CREAT | O_APPEND | O_RDWR | O_CLOEXEC, 0750);
+  else if (fcntl(life, F_SETFD, FD_CLOEXEC) < 0)
+    return 1;
   if (life < 0)
     return 1;
   if (flock(life, LOCK_EX | LOCK_NB) < 0)
@@ -164,20 +309,45 @@ static int initialise_daemon(void)
   if ((signal(SIGRTMIN,     sig_handler) == SIG_ERR) ||
       (signal(SIGUSR1,      sig_handler) == SIG_ERR) ||
       (signal(SIGUSR2,      sig_handler) == SIG_ERR) ||
-      (signal(SIGCHLD, noop_sig_handler) == SIG_ERR) ||
+      (signal(SIGCHLD,  sigchld_handler) == SIG_ERR) ||
+      (signal(SIGALRM, wake_sig_handler) == SIG_ERR) ||
+      (signal(SIGIO,   wake_sig_handler) == SIG_ERR) ||
       (prctl(PR_SET_PDEATHSIG, SIGRTMIN) < 0)        ||
       (prctl(PR_SET_CHILD_SUBREAPER, 1) < 0))
     return 1;
   
+  /* As init, termination signals are ignored unless they are caught. */
+  if (init)
+    if ((signal(SIGTERM, sig_handler) == SIG_ERR) ||
+	(signal(SIGINT,  sig_handler) == SIG_ERR))
+      return 1;
+  
   if ((r = get_mqueue_key()))
     return r;
   if (mqueue_id = msgget(mqueue_key, 0750), mqueue_id < 0)
-    return r;
+    return 1;
+  
+  /* Use cgroups for services if we have been delegated a cgroup. */
+  cgroup_initialise();
   
   return 0;
 }
 
 
+/**
+ * Let the lifeline be inherited by the next program we exec
+ * 
+ * @param   life_str  Output buffer for the file descriptor as a string,
+ *                    should be at least `3 * sizeof(int) + 1` bytes
+ * @return            Zero on success, -1 on error
+ */
+static int pass_lifeline(char* life_str)
+{
+  sprintf(life_str, "%i", life);
+  return fcntl(life, F_SETFD, 0);
+}
+
+
 /**
  * Mane procedure for the child process after the fork
  * to resurrect `daemond-resurrectd`
@@ -186,9 +356,10 @@ static int initialise_daemon(void)
  */
 static int child_procedure(void)
 {
-  if (close(life) < 0)
-    perror(*argv);
-  execlp(LIBEXECDIR "/daemond-resurrectd", "daemond-resurrectd", NULL);
+  char life_str[3 * sizeof(int) + 1];
+  if (pass_lifeline(life_str) < 0)
+    return 1;
+  execlp(LIBEXECDIR "/daemond-resurrectd", "daemond-resurrectd", "--lifeline", life_str, NULL);
   return 1;
 }
 
@@ -228,14 +399,11 @@ static int parent_procedure(pid_t child)
  */
 static int resurrect_parent(void)
 {
+  int r, rc = -1;
   pid_t pid;
-  int r;
   
   fprintf(stderr, "%s: daemond-resurrectd died, respawning\n", *argv);
   
-  if (flock(life, LOCK_UN) < 0)
-    perror(*argv);
-  
   if ((signal(SIGCHLD, noop_sig_handler) == SIG_ERR) ||
       (pid = fork(), pid == -1))
     perror(*argv);
@@ -245,21 +413,19 @@ static int resurrect_parent(void)
       r = child_procedure();
       return perror(*argv), r;
     }
-  else
-    if (parent_procedure(pid))
-      {
-	if (errno != EINTR)
-	  perror(*argv);
-      }
-    else
-      return 0; /* XXX: I wish we could send our children to the new `daemond-resurrectd`
-		        and that `daemond-resurrectd` could forward them to the new
-			`daemond` it creates. */
+  else if (parent_procedure(pid) == 0)
+    rc = 0; /* XXX: I wish we could send our children to the new `daemond-resurrectd`
+	           and that `daemond-resurrectd` could forward them to the new
+		   `daemond` it creates. */
+  else if (errno != EINTR)
+    perror(*argv);
   
-  if (flock(life, LOCK_EX) < 0)
+  /* Services that died while SIGCHLD was not handled have not been reaped. */
+  if (signal(SIGCHLD, sigchld_handler) == SIG_ERR)
     perror(*argv);
+  sigchld_handler(SIGCHLD);
   
-  return -1;
+  return rc;
 }
 
 
@@ -271,23 +437,47 @@ static int resurrect_parent(void)
 static int handle_interruption(void)
 {
   static int immortality_ = 1;
+  static char shutdown_verb[] = "shutdown";
+  char* shutdown_arguments[] = { shutdown_verb, NULL };
+  char life_str[3 * sizeof(int) + 1];
   int r;
   
+  interrupted = 0;
+  
+  if (terminate)
+    {
+      terminate = 0;
+      if (r = service_control(shutdown_arguments), r >= 0)
+	return r;
+    }
+  
   if (reexec)
     {
+      reexec = 0;
+      /* Without the services, the new program would think they are stopped. */
+      if (service_hand_over() < 0)
+	{
+	  perror(*argv);
+	  fprintf(stderr, "%s: could not hand over services, not reexecuting\n", *argv);
+	  return -1;
+	}
       fprintf(stderr, "%s: reexecuting\n", *argv);
-      if (!immortality)
+      if (!immortality && !init)
 	fprintf(stderr, "%s: immortality protocol will be reenabled\n", *argv);
-      execlp(LIBEXECDIR "/daemond", "daemond", "--reexecing", NULL);
+      if (pass_lifeline(life_str) == 0)
+	execlp(LIBEXECDIR "/daemond", "daemond", "--reexecing", "--lifeline", life_str,
+	       init ? "--init" : NULL, NULL);
       perror(*argv);
+      fcntl(life, F_SETFD, FD_CLOEXEC);
+      service_take_back();
     }
-  else if (pdeath && immortality)
+  else if (pdeath && immortality && !init)
     {
       pdeath = 0;
       if (r = resurrect_parent(), r >= 0)
 	return r;
     }
-  else if (immortality_ && !immortality)
+  else if (immortality_ && !immortality && !init)
     {
       fprintf(stderr, "%s: disabling immortality protocol\n", *argv);
       immortality_ = 0;
@@ -300,27 +490,42 @@ static int handle_interruption(void)
 
 
 /**
- * Attempt to reap a child, if there are no zombies, handle interruption
+ * Reap zombie children, and handle interruption
+ * 
+ * Children that die at the same time may only
+ * generate one SIGCHLD, so all are reaped, but
+ * at most `REAP_BATCH` at a time, the rest are
+ * left for the next turn of the mane loop
  * 
  * @return  The return value for `main`, -1 if the called should not return
  */
 static int reap(void)
 {
-  int r, status;
-  pid_t pid;
+  struct timespec now, signalled = sigchld_time;
+  int status, pending = sigchld_pending;
+  size_t reaped = 0;
+  pid_t pid = 0;
   
-  if (pid = waitpid(-1, &status, WNOHANG), pid < 1)
+  sigchld_pending = 0;
+  while ((reaped++ < REAP_BATCH) && (pid = waitpid(-1, &status, WNOHANG), pid > 0))
     {
-      if ((errno != EINTR) && (errno != ECHILD))
-	return perror(*argv), 1;
-      else if ((errno == EINTR) || (pid == 0))
-	if (r = handle_interruption(), r >= 0)
-	  return r;
+      metrics.reaps++;
+      if (pending)
+	{
+	  timer_now(&now);
+	  histogram_observe(&metrics.reap_latency, timer_diff(&signalled, &now));
+	}
+      if (service_reaped(pid, status))
+	metrics.untracked_reaps++;
     }
-  else
-    printf("reaped %ji\n", (intmax_t)pid); /* TODO */
+  if ((pid < 0) && (errno != EINTR) && (errno != ECHILD))
+    return perror(*argv), 1;
   
-  return -1;
+  /* There may be more to reap, so that is done before waiting for a message. */
+  if (pid > 0)
+    sigchld_pending = 1;
+  
+  return handle_interruption();
 }
 
 
@@ -333,9 +538,11 @@ static int reap(void)
  */
 static int received_message(char* message, size_t length)
 {
-  char** arguments;
+  static char** arguments = NULL;
+  static size_t arguments_size = 0;
   size_t count = 0;
   size_t i, j;
+  void* new;
   
   if ((length == 0) || (message[length - 1] != '\0'))
     return fprintf(stderr, "%s: received invalid message\n", *argv), -1;
@@ -348,9 +555,14 @@ static int received_message(char* message, size_t length)
     if (message[i] == '\0')
       count++;
   
-  arguments = malloc((count + 1) * sizeof(char*));
-  if (arguments == NULL)
-    return perror(*argv), 1;
+  /* The list is kept, so that requests do not allocate memory once it is large enough. */
+  if (arguments_size < count + 1)
+    {
+      if (new = realloc(arguments, (count + 1) * sizeof(char*)), new == NULL)
+	return perror(*argv), 1;
+      arguments = new;
+      arguments_size = count + 1;
+    }
   
   for (i = j = 0; i < length; i++)
     if (message[i] == '\0')
@@ -361,9 +573,71 @@ static int received_message(char* message, size_t length)
   memmove(message, message + 1, length - 1);
   message[length - 1] = '\0';
   
-  /* TODO */
+  if (!strcmp(arguments[0], "rolling-restart") || !strcmp(arguments[0], "rolling-update"))
+    return rollout_request(arguments);
+  else if (!strcmp(arguments[0], "subscribe") || !strcmp(arguments[0], "unsubscribe"))
+    return event_request(arguments);
+  else if (!strcmp(arguments[0], "self-check"))
+    return selfcheck_request(arguments);
+  else
+    return service_control(arguments);
+}
+
+
+/**
+ * Receive the next control request
+ * 
+ * The classes are taken in the order of `request_types`, so urgent
+ * requests are taken first, but a class that has had as many requests
+ * taken as its weight waits until every other class has either had as
+ * many requests taken as its weight or has no requests waiting, so a
+ * flood of requests of one class cannot starve the other classes
+ * 
+ * @param   message  Output buffer for the message
+ * @param   size     The size of `message->mtext`
+ * @param   wait     Whether to wait for a message if there is none
+ * @return           The size of the message, zero if the main loop was
+ *                   woken up, -1 on error, with `errno` set to `ENOMSG`
+ *                   if there was no message and `wait` was zero
+ */
+static ssize_t receive_request(struct mqueue_message* restrict message, size_t size, int wait)
+{
+  int empty[REQUEST_CLASSES];
+  ssize_t r;
+  size_t i;
+  int pass;
   
-  return free(arguments), -1;
+ again:
+  memset(empty, 0, sizeof(empty));
+  
+  /* The second pass starts a new round, unless every class was found empty. */
+  for (pass = 0; pass < 2; pass++)
+    {
+      for (i = 0; i < REQUEST_CLASSES; i++)
+	{
+	  if (!request_credits[i] || empty[i])
+	    continue;
+	  if (r = msgrcv(mqueue_id, message, size, request_types[i], IPC_NOWAIT), r >= 0)
+	    return request_credits[i]--, r;
+	  if (errno != ENOMSG)
+	    return -1;
+	  empty[i] = 1;
+	}
+      for (i = 0; i < REQUEST_CLASSES; i++)
+	request_credits[i] = request_weights[i];
+    }
+  
+  if (!wait)
+    return errno = ENOMSG, -1;
+  
+  /* Wait for a request of any class, or to be woken up. A request does not
+     fit in an empty buffer, so it is left in the queue, and taken in turn
+     above, rather than by the order of the message types. */
+  if (msgrcv(mqueue_id, message, 0, -REQUEST_WAKE_UP, 0) == 0)
+    return 0;
+  if (errno == E2BIG)
+    goto again;
+  return -1;
 }
 
 
@@ -374,30 +648,63 @@ static int received_message(char* message, size_t length)
  */
 static int mane_loop(void)
 {
-  struct { long mtype; char* mtext; } mqueue_buf;
+  struct mqueue_message* mqueue_buf;
   struct msqid_ds mqueue_info;
+  struct timespec now, received;
   ssize_t msg_size;
   int r;
   
   if (msgctl(mqueue_id, IPC_STAT, &mqueue_info) < 0)
     return perror(*argv), 1;
   
-  mqueue_buf.mtype = 0;
-  mqueue_buf.mtext = malloc(mqueue_info.msg_qbytes * sizeof(char));
-  if (mqueue_buf.mtext == NULL)
+  mqueue_buf = malloc(sizeof(*mqueue_buf) + mqueue_info.msg_qbytes * sizeof(char));
+  if (mqueue_buf == NULL)
     return perror(*argv), 1;
+  mqueue_buf->mtype = 0;
   
   for (;;)
     {
-      msg_size = msgrcv(mqueue_id, &mqueue_buf, mqueue_info.msg_qbytes, 1, 0);
-      if ((msg_size < 0) && (errno != EINTR))
-	return perror(*argv), free(mqueue_buf.mtext), 1;
+      if (r = watch_dispatch(), r >= 0)
+	return free(mqueue_buf), r;
+      timer_now(&now);
+      service_tick(&now);
+      if (r = rollout_tick(&now), r >= 0)
+	return free(mqueue_buf), r;
+      if (metrics_tick(&now, mqueue_id) < 0)
+	perror(*argv);
+      event_flush(&now, mqueue_id);
+      selfcheck_tick(&now);
+      if (timer_arm() < 0)
+	return perror(*argv), free(mqueue_buf), 1;
+      status_update();
+      
+      /* As init, there is nothing left to do once everything has stopped. */
+      if (init && service_shutdown_completed())
+	return free(mqueue_buf), 0;
+      
+      /* Do not wait for a message if a child has died since we last reaped,
+	 but take one if there is one, so that messages are not held up by a
+	 storm of dying children. Signals that arrive before we start waiting
+	 wake us up with an empty message. */
+      receiving = 1;
+      msg_size = receive_request(mqueue_buf, mqueue_info.msg_qbytes, !(sigchld_pending || interrupted));
+      receiving = 0;
+      if ((msg_size < 0) && (errno != EINTR) && (errno != ENOMSG))
+	return perror(*argv), free(mqueue_buf), 1;
       else if (msg_size < 0)
 	r = reap();
+      else if (msg_size == 0)
+	r = -1;
       else
-	r = received_message(mqueue_buf.mtext, (size_t)msg_size / sizeof(char));
+	{
+	  timer_now(&received);
+	  r = received_message(mqueue_buf->mtext, (size_t)msg_size / sizeof(char));
+	  timer_now(&now);
+	  histogram_observe(&metrics.request_latency, timer_diff(&received, &now));
+	  metrics.requests++;
+	}
       if (r >= 0)
-	return free(mqueue_buf.mtext), r;
+	return free(mqueue_buf), r;
     }
 }
 
@@ -411,20 +718,41 @@ static int mane_loop(void)
  */
 int main(int argc, char** argv_)
 {
-  int r, reexeced = 0;
+  int i, r, reexeced = 0;
   
   argv = argv_;
-  if ((argc == 2) && !strcmp(argv[1], "--reexecing"))
-    reexeced = 1;
+  for (i = 1; i < argc; i++)
+    if (!strcmp(argv[i], "--reexecing"))
+      reexeced = 1;
+    else if (!strcmp(argv[i], "--init"))
+      init = 1;
+    else if (!strcmp(argv[i], "--lifeline") && (i + 1 < argc))
+      life = atoi(argv[++i]);
+  
+  /* As init, nothing that the services start may be left behind. */
+  service_signal_groups = init;
   
   if ((r = initialise_daemon()))
     return errno ? (perror(*argv), r) : r;
   
   /* Signal `daemond-resurrectd` that we are running. */
-  if (!reexeced)
+  if (!reexeced && !init)
     if (kill(getppid(), SIGCHLD) < 0)
       return perror(*argv), 1;
   
+  /* The services are published from the main loop. */
+  if (status_open() < 0)
+    perror(*argv);
+  
+  /* Watch for configuration changes before the configurations are read. */
+  if (watch_open() < 0)
+    perror(*argv);
+  
+  /* Services have survived the re-exec, and are taken over,
+     so only start eagerly activated services on a fresh start. */
+  if (service_register(!reexeced) < 0)
+    perror(*argv);
+  
   return mane_loop();
 }
 
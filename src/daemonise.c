@@ -15,8 +15,10 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#define _GNU_SOURCE
 #include "config.h"
 #include "daemonise.h"
+#include "environtab.h"
 
 #include <stdint.h>
 #include <dirent.h>
@@ -25,6 +27,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <signal.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <sys/file.h>
@@ -51,9 +54,12 @@ static void noop_sig_handler(int signo)
 
 
 /**
- * Close all file descriptor except stdin, stdout and stderr
+ * Close all file descriptor except stdin, stdout and stderr,
+ * and the inherited listening sockets that follow them
+ * 
+ * @param  kept  The number of listening sockets to keep
  */
-static void close_nonstd_fds(void)
+static void close_nonstd_fds(int kept)
 {
   DIR* dir;
   struct dirent* file;
@@ -65,7 +71,8 @@ static void close_nonstd_fds(void)
         {
           fd = atoi(file->d_name);
           if ((fd != STDIN_FILENO) && (fd != STDOUT_FILENO) && (fd != STDERR_FILENO))
-            close(fd);
+            if ((fd < STDERR_FILENO + 1) || (fd > STDERR_FILENO + kept))
+              close(fd);
         }
   closedir(dir);
 }
@@ -77,7 +84,7 @@ static void close_nonstd_fds(void)
  * @param   pathname  The PID file's pathname
  * @return            The PID stored in the file, -1 on error (-1 in waitpid means any PID)
  */
-static pid_t read_pid(const char* pathname)
+pid_t read_pid(const char* pathname)
 {
   char buf[3 * sizeof(pid_t) + 1];
   int fd;
@@ -89,41 +96,113 @@ static pid_t read_pid(const char* pathname)
   if (close(fd) < 0)
     perror(*argv);
   fd = -1;
+  if (got < 0)
+    return -1;
   buf[got] = 0;
   return (pid_t)atoi(buf);
 }
 
 
+/**
+ * Execute into the daemon script of a daemon, or into the daemon itself
+ * 
+ * @param  arguments   `NULL`-terminated list of command line arguments,
+ *                     the verb first, then the name of the daemon, followed
+ *                     by optional additional script-dependent arguments
+ * @param  command     `NULL`-terminated command line of the daemon,
+ *                     `NULL` to execute into the daemon script
+ * @param  envp        `NULL`-terminated list of environment variables
+ * @param  listen_pid  The value of `LISTEN_PID`, `NULL` if not passing sockets
+ */
+static void exec_daemon_base(char** arguments, char* const* command, char* const* envp, const char* listen_pid)
+{
+  char* daemon_name = arguments[1];
+  char* instance = strchr(daemon_name, '@');
+  size_t n = 0, count = 0;
+  
+  while (envp[count] != NULL)
+    count++;
+  
+  {
+    char name_entry[sizeof(ENV_DAEMON_NAME_TAG "=") + strlen(daemon_name)];
+    char instance_entry[sizeof(ENV_DAEMON_INSTANCE_TAG "=") + (instance ? strlen(instance) : 0)];
+    char pid_entry[sizeof(ENV_LISTEN_PID_TAG "=") + (listen_pid ? strlen(listen_pid) : 0)];
+    char* entries[3];
+    char* env[count + 4];
+    
+    /* Mark the process with the name of the daemon. */
+    sprintf(name_entry, ENV_DAEMON_NAME_TAG "=%s", daemon_name);
+    entries[n++] = name_entry;
+    
+    /* Tell an instance of a template which instance it is. */
+    if (instance != NULL)
+      {
+        sprintf(instance_entry, ENV_DAEMON_INSTANCE_TAG "=%s", instance + 1);
+        entries[n++] = instance_entry;
+      }
+    
+    /* Tell the daemon that the listening sockets are meant for it. */
+    if (listen_pid != NULL)
+      {
+        sprintf(pid_entry, ENV_LISTEN_PID_TAG "=%s", listen_pid);
+        entries[n++] = pid_entry;
+      }
+    
+    environtab_compose(env, envp, entries, n);
+    
+    if (command != NULL)
+      execvpe(*command, command, env);
+    else
+      {
+        arguments[1] = arguments[0];
+        arguments[0] = daemon_name;
+        execve(SYSCONFDIR "/" PKGNAME ".d/daemon-base", arguments, env);
+      }
+  }
+}
+
+
 /**
  * Daemonise the process and start a daemon
  * 
  * @param   arguments  `NULL`-terminated list of command line arguments,
  *                     the verb first, then the name of the daemon, followed
  *                     by optional additional script-dependent arguments
+ * @param   envp       `NULL`-terminated list of environment variables,
+ *                     `LISTEN_FDS` in it tells how many sockets to pass
+ * @param   command    `NULL`-terminated command line to execute into
+ *                     instead of the daemon script, `NULL` to use the
+ *                     daemon script; the daemon is considered ready
+ *                     as soon as it is executed
  * @return             The function call not return, it will
  *                     however exit the image with a return
  *                     as an unlikely fallback
  */
-int start_daemon(char** arguments)
+int start_daemon(char** arguments, char* const* envp, char* const* command)
 {
-#define return  exit
+#define return  _exit
 #define t(cond)  if (cond) goto fail
   
   char* daemon_name = arguments[1];
+  char* listen_fds = environtab_lookup(envp, ENV_LISTEN_FDS_TAG);
   char buf[3 * sizeof(pid_t) + 2];
   int i, r, fd = -1, saved_errno;
-  sigset_t set;
+  int gate[2];
+  struct timespec nowait = { 0, 0 };
+  sigset_t set, unblocked;
+  siginfo_t info;
   char* pid_pathname = NULL;
   size_t n;
-  pid_t pid, child;
+  pid_t pid, child, parent;
   
   /* Get pathname of PID file. */
   pid_pathname = malloc((strlen(RUNDIR "/.pid") + strlen(daemon_name) + 1) * sizeof(char));
   t (pid_pathname == NULL);
   sprintf(pid_pathname, RUNDIR "/%s.pid", daemon_name);
   
-  /* Close all file descriptors but stdin, stdout and stderr. */
-  close_nonstd_fds();
+  /* Close all file descriptors but stdin, stdout,
+     stderr and the sockets passed on from daemond. */
+  close_nonstd_fds(listen_fds ? atoi(listen_fds) : 0);
   
   /* Reset all signals to SIG_DFL. */
   for (i = 1; i < _NSIG; i++)
@@ -133,13 +212,19 @@ int start_daemon(char** arguments)
   sigfillset(&set);
   sigprocmask(SIG_UNBLOCK, &set, NULL);
   
-  /* Mark daemon with its name. */
-  t (setenv(ENV_DAEMON_NAME_TAG, daemon_name, 1) < 0);
-  
   /* Set to child subreaper and set SIGCHLD listening. */
   t (prctl(PR_SET_CHILD_SUBREAPER, 1) < 0);
   t (signal(SIGCHLD, noop_sig_handler) == SIG_ERR);
   
+  /* Block SIGCHLD so that it cannot be lost before we wait for it. */
+  sigemptyset(&unblocked);
+  sigemptyset(&set);
+  sigaddset(&set, SIGCHLD);
+  t (sigprocmask(SIG_BLOCK, &set, NULL) < 0);
+  
+  /* Create a pipe that the grandchild waits on until we have reaped the child. */
+  t (pipe(gate) < 0);
+  
   /* Fork */
   t ((pid = fork(), pid == -1));
   if (pid)
@@ -152,18 +237,28 @@ int start_daemon(char** arguments)
   prctl(PR_SET_CHILD_SUBREAPER, 0);
   
   /* Fork again, and exit first child synchronously. */
-  if (pid = fork(), pid > 0)
+  parent = getpid();
+  t ((pid = fork(), pid == -1));
+  if (pid)
     {
-      pause();
-      exit(1); /* Failure, if the grandchild dies first */
+      sigsuspend(&unblocked);
+      _exit(1); /* Failure, if the grandchild dies first */
     }
   t (signal(SIGCHLD, noop_sig_handler) == SIG_ERR);
   t (prctl(PR_SET_PDEATHSIG, SIGCHLD) < 0);
-  t (kill(getppid(), SIGCHLD) < 0);
-  pause();
+  t (kill(parent, SIGCHLD) < 0);
+  while (getppid() == parent)
+    sigsuspend(&unblocked);
+  
+  /* Wait until the child has been reaped, so that the SIGCHLD for its
+     death cannot be merged with the daemon's readiness notification. */
+  close(gate[1]);
+  while ((read(gate[0], buf, 1) < 0) && (errno == EINTR));
+  close(gate[0]);
   
   /* Reset some thinks. */
   signal(SIGCHLD, SIG_DFL);
+  sigprocmask(SIG_UNBLOCK, &set, NULL);
   
   /* Replace stdin and stdout, but not stderr, with /dev/null. */
   close(STDIN_FILENO);
@@ -198,9 +293,10 @@ int start_daemon(char** arguments)
     chdir("/");
   
   /* Execute into daemon. */
-  arguments[1] = arguments[0];
-  arguments[0] = daemon_name;
-  execvp(SYSCONFDIR "/" PKGNAME ".d/daemon-base", arguments);
+  sprintf(buf, "%ji", (intmax_t)getpid());
+  /* Without the daemon script, there is no start function to signal readiness. */
+  t ((command != NULL) && (kill(getppid(), SIGCHLD) < 0));
+  exec_daemon_base(arguments, command, envp, listen_fds ? buf : NULL);
   
  fail:
   perror(*argv);
@@ -210,7 +306,30 @@ int start_daemon(char** arguments)
   return (1);
   
  wait_for_completion:
-  pause(), pause(); /* Wait for child and grandchild. */
+  /* Reap the child and discard the SIGCHLD for its death, then let the
+     grandchild start the daemon. */
+  close(gate[0]);
+  while (waitpid(pid, NULL, 0) < 0)
+    t (errno != EINTR);
+  while (sigtimedwait(&set, &info, &nowait) > 0);
+  close(gate[1]);
+  
+  /* Wait for the grandchild to signal readiness, with kill(2), or die. */
+  for (;;)
+    {
+      while ((child = waitpid(-1, &r, WNOHANG)) > 0)
+        {
+          free(pid_pathname);
+          return (WIFEXITED(r) ? WEXITSTATUS(r) : WTERMSIG(r));
+        }
+      if (sigwaitinfo(&set, &info) < 0)
+        {
+          t (errno != EINTR);
+          continue;
+        }
+      if (info.si_code == SI_USER)
+        break;
+    }
   /* Exit like the grandchild. */
   child = read_pid(pid_pathname);
   pid = waitpid(child, &r, WNOHANG);
@@ -224,3 +343,39 @@ int start_daemon(char** arguments)
 #undef return
 }
 
+
+/**
+ * Run the daemon script of a daemon, for an action
+ * other than starting the daemon
+ * 
+ * @param   arguments  `NULL`-terminated list of command line arguments,
+ *                     the verb first, then the name of the daemon, followed
+ *                     by optional additional script-dependent arguments
+ * @param   envp       `NULL`-terminated list of environment variables
+ * @return             The function can not return, it will
+ *                     however exit the image with a return
+ *                     as an unlikely fallback
+ */
+int run_daemon_script(char** arguments, char* const* envp)
+{
+  sigset_t set;
+  int i;
+  
+  /* Close all file descriptors but stdin, stdout and stderr. */
+  close_nonstd_fds(0);
+  
+  /* Reset all signals to SIG_DFL. */
+  for (i = 1; i < _NSIG; i++)
+    signal(i, SIG_DFL);
+  
+  /* Reset signal mask. */
+  sigfillset(&set);
+  sigprocmask(SIG_UNBLOCK, &set, NULL);
+  
+  /* Execute into the daemon script. */
+  exec_daemon_base(arguments, NULL, envp, NULL);
+  
+  perror(*argv);
+  _exit(1);
+}
+
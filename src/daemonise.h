@@ -21,6 +21,8 @@
 
 #include "config.h"
 
+#include <sys/types.h>
+
 
 /**
  * Daemonise the process and start a daemon
@@ -28,11 +30,39 @@
  * @param   arguments  `NULL`-terminated list of command line arguments,
  *                     the verb first, then the name of the daemon, followed
  *                     by optional additional script-dependent arguments
+ * @param   envp       `NULL`-terminated list of environment variables,
+ *                     `LISTEN_FDS` in it tells how many sockets to pass
+ * @param   command    `NULL`-terminated command line to execute into
+ *                     instead of the daemon script, `NULL` to use the
+ *                     daemon script; the daemon is considered ready
+ *                     as soon as it is executed
  * @return             The function can not return, it will
  *                     however exit the image with a return
  *                     as an unlikely fallback
  */
-int start_daemon(char** arguments) __attribute__((noreturn));
+int start_daemon(char** arguments, char* const* envp, char* const* command) __attribute__((noreturn));
+
+/**
+ * Run the daemon script of a daemon, for an action
+ * other than starting the daemon
+ * 
+ * @param   arguments  `NULL`-terminated list of command line arguments,
+ *                     the verb first, then the name of the daemon, followed
+ *                     by optional additional script-dependent arguments
+ * @param   envp       `NULL`-terminated list of environment variables
+ * @return             The function can not return, it will
+ *                     however exit the image with a return
+ *                     as an unlikely fallback
+ */
+int run_daemon_script(char** arguments, char* const* envp) __attribute__((noreturn));
+
+/**
+ * Read the value in a PID file
+ * 
+ * @param   pathname  The PID file's pathname
+ * @return            The PID stored in the file, -1 on error (-1 in waitpid means any PID)
+ */
+pid_t read_pid(const char* pathname);
 
 
 #endif
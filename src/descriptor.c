@@ -0,0 +1,1643 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include "config.h"
+#include "descriptor.h"
+#include "cgroup.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stddef.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+
+
+
+/**
+ * The IO scheduling class shift in ioprio values
+ */
+#define IOPRIO_CLASS_SHIFT  13
+
+/**
+ * The realtime IO scheduling class
+ */
+#define IOPRIO_CLASS_RT  1
+
+/**
+ * The best-effort IO scheduling class
+ */
+#define IOPRIO_CLASS_BE  2
+
+/**
+ * The idle IO scheduling class
+ */
+#define IOPRIO_CLASS_IDLE  3
+
+/**
+ * `which` value for ioprio_set(2) for a single process
+ */
+#define IOPRIO_WHO_PROCESS  1
+
+/**
+ * Identifies a compiled descriptor cache, the last
+ * byte is the version of the file format
+ */
+#define CACHE_MAGIC  "dmndesc\x03"
+
+/**
+ * The alignment of the records in the compiled descriptor cache
+ */
+#define RECORD_ALIGN  __alignof__(struct descriptor_record)
+
+
+
+/**
+ * A parsed descriptor, as stored in the compiled descriptor cache,
+ * where it is followed by the variable-length members of the
+ * descriptor, padded to `RECORD_ALIGN`
+ */
+struct descriptor_record
+{
+  /**
+   * The name of the service
+   */
+  char name[NAME_MAX + 1];
+  
+  /**
+   * The inode number of the descriptor file
+   */
+  ino_t inode;
+  
+  /**
+   * The size of the descriptor file
+   */
+  off_t size;
+  
+  /**
+   * The modification time of the descriptor file
+   */
+  struct timespec mtime;
+  
+  /**
+   * The descriptor, `descriptor.data` is only
+   * set for records that have not been written
+   */
+  struct descriptor descriptor;
+};
+
+
+/**
+ * The header of the compiled descriptor cache,
+ * which is followed by `count` records
+ */
+struct descriptor_cache_header
+{
+  /**
+   * `CACHE_MAGIC`
+   */
+  char magic[8];
+  
+  /**
+   * `sizeof(struct descriptor_record)`, so that a cache
+   * written by a different build is not misread
+   */
+  size_t record_size;
+  
+  /**
+   * The number of records in the cache
+   */
+  size_t count;
+};
+
+
+
+/**
+ * Command line arguments
+ */
+extern char** argv;
+
+/**
+ * The names of the resource limits, as used
+ * in the keys "limit-<name>"
+ */
+static const struct
+{
+  const char* name;
+  int resource;
+} rlimit_names[] =
+  {
+    { "as",         RLIMIT_AS },
+    { "core",       RLIMIT_CORE },
+    { "cpu",        RLIMIT_CPU },
+    { "data",       RLIMIT_DATA },
+    { "fsize",      RLIMIT_FSIZE },
+    { "locks",      RLIMIT_LOCKS },
+    { "memlock",    RLIMIT_MEMLOCK },
+    { "msgqueue",   RLIMIT_MSGQUEUE },
+    { "nice",       RLIMIT_NICE },
+    { "nofile",     RLIMIT_NOFILE },
+    { "nproc",      RLIMIT_NPROC },
+    { "rss",        RLIMIT_RSS },
+    { "rtprio",     RLIMIT_RTPRIO },
+    { "rttime",     RLIMIT_RTTIME },
+    { "sigpending", RLIMIT_SIGPENDING },
+    { "stack",      RLIMIT_STACK },
+    { NULL, 0 }
+  };
+
+/**
+ * The names of the signals that may be used in the "<action>-signal" keys
+ */
+static const struct
+{
+  const char* name;
+  int signo;
+} signal_names[] =
+  {
+    { "HUP",   SIGHUP },
+    { "INT",   SIGINT },
+    { "QUIT",  SIGQUIT },
+    { "KILL",  SIGKILL },
+    { "USR1",  SIGUSR1 },
+    { "USR2",  SIGUSR2 },
+    { "ALRM",  SIGALRM },
+    { "TERM",  SIGTERM },
+    { "CONT",  SIGCONT },
+    { "STOP",  SIGSTOP },
+    { "TSTP",  SIGTSTP },
+    { "WINCH", SIGWINCH },
+    { "PWR",   SIGPWR },
+    { NULL, 0 }
+  };
+
+/**
+ * The mapped compiled descriptor cache, `NULL` if not mapped
+ */
+static struct descriptor_cache_header* cache = NULL;
+
+/**
+ * The size of `cache`
+ */
+static size_t cache_size = 0;
+
+/**
+ * Descriptors that have been parsed since `cache` was mapped
+ */
+static struct descriptor_record* parsed = NULL;
+
+/**
+ * The number of elements in `parsed`
+ */
+static size_t parsed_count = 0;
+
+
+
+/**
+ * Parse an integer
+ * 
+ * @param   value  The string to parse
+ * @param   min    The smallest allowed value
+ * @param   max    The largest allowed value
+ * @param   out    Output parameter for the value
+ * @return         Zero on success, -1 if the value is invalid
+ */
+static int parse_integer(const char* restrict value, long long min, long long max, int* restrict out)
+{
+  char* end;
+  long long v;
+  
+  errno = 0;
+  v = strtoll(value, &end, 10);
+  if (errno || !*value || *end || (v < min) || (v > max))
+    return -1;
+  *out = (int)v;
+  return 0;
+}
+
+
+/**
+ * Parse a size, optionally with a binary suffix (K, M, G or T)
+ * 
+ * @param   value  The string to parse, "max", "infinity" or
+ *                 "unlimited" for `DESCRIPTOR_MEMORY_UNLIMITED`
+ * @param   out    Output parameter for the size
+ * @return         Zero on success, -1 if the value is invalid
+ */
+static int parse_size(const char* restrict value, unsigned long long* restrict out)
+{
+  static const char suffixes[] = "KMGT";
+  const char* suffix;
+  char* end;
+  unsigned long long v;
+  size_t shifts;
+  
+  if (!strcmp(value, "max") || !strcmp(value, "infinity") || !strcmp(value, "unlimited"))
+    return *out = DESCRIPTOR_MEMORY_UNLIMITED, 0;
+  
+  if (!isdigit(*value))
+    return -1;
+  errno = 0;
+  v = strtoull(value, &end, 10);
+  if (errno)
+    return -1;
+  if (*end && (suffix = strchr(suffixes, toupper(*end))) && !end[1])
+    for (shifts = (size_t)(suffix - suffixes) + 1; shifts--;)
+      {
+	if (v > (DESCRIPTOR_MEMORY_UNLIMITED >> 10))
+	  return -1;
+	v <<= 10;
+      }
+  else if (*end)
+    return -1;
+  
+  return *out = v, 0;
+}
+
+
+/**
+ * Parse a list of CPUs, such as "0-3,8"
+ * 
+ * @param   value  The string to parse
+ * @param   cpus   Output parameter for the CPU mask
+ * @return         Zero on success, -1 if the value is invalid
+ */
+static int parse_cpus(const char* restrict value, unsigned long* restrict cpus)
+{
+  unsigned long first, last;
+  char* end;
+  
+  memset(cpus, 0, DESCRIPTOR_MAX_CPUS / 8);
+  for (;;)
+    {
+      if (!isdigit(*value))
+	return -1;
+      first = last = strtoul(value, &end, 10);
+      if (*end == '-')
+	{
+	  if (!isdigit(end[1]))
+	    return -1;
+	  last = strtoul(end + 1, &end, 10);
+	}
+      if ((first > last) || (last >= DESCRIPTOR_MAX_CPUS))
+	return -1;
+      for (; first <= last; first++)
+	cpus[first / DESCRIPTOR_CPU_BITS] |= 1UL << (first % DESCRIPTOR_CPU_BITS);
+      if (*end == '\0')
+	return 0;
+      if (*end != ',')
+	return -1;
+      value = end + 1;
+    }
+}
+
+
+/**
+ * Parse a scheduling policy
+ * 
+ * @param   value  The string to parse
+ * @param   out    Output parameter for the policy
+ * @return         Zero on success, -1 if the value is invalid
+ */
+static int parse_scheduler(const char* restrict value, int* restrict out)
+{
+  if      (!strcmp(value, "other"))  *out = SCHED_OTHER;
+  else if (!strcmp(value, "batch"))  *out = SCHED_BATCH;
+  else if (!strcmp(value, "idle"))   *out = SCHED_IDLE;
+  else if (!strcmp(value, "fifo"))   *out = SCHED_FIFO;
+  else if (!strcmp(value, "rr"))     *out = SCHED_RR;
+  else
+    return -1;
+  return 0;
+}
+
+
+/**
+ * Parse an IO priority, "idle", "best-effort[:<level>]"
+ * or "realtime[:<level>]", where the level is 0 to 7
+ * 
+ * @param   value  The string to parse
+ * @param   out    Output parameter for the ioprio value
+ * @return         Zero on success, -1 if the value is invalid
+ */
+static int parse_ioprio(const char* restrict value, int* restrict out)
+{
+  int class, level = 4;
+  const char* colon = strchr(value, ':');
+  size_t n = colon ? (size_t)(colon - value) : strlen(value);
+  
+  if      ((n == strlen("idle"))        && !strncmp(value, "idle", n))         class = IOPRIO_CLASS_IDLE;
+  else if ((n == strlen("best-effort")) && !strncmp(value, "best-effort", n))  class = IOPRIO_CLASS_BE;
+  else if ((n == strlen("realtime"))    && !strncmp(value, "realtime", n))     class = IOPRIO_CLASS_RT;
+  else
+    return -1;
+  
+  if (colon && ((class == IOPRIO_CLASS_IDLE) || parse_integer(colon + 1, 0, 7, &level)))
+    return -1;
+  if (class == IOPRIO_CLASS_IDLE)
+    level = 0;
+  
+  *out = (class << IOPRIO_CLASS_SHIFT) | level;
+  return 0;
+}
+
+
+/**
+ * Parse a resource limit, "<limit>" or "<soft>:<hard>"
+ * 
+ * @param   value  The string to parse, modified temporarily
+ * @param   out    Output parameter for the resource limit
+ * @return         Zero on success, -1 if the value is invalid
+ */
+static int parse_rlimit(char* restrict value, struct rlimit* restrict out)
+{
+  char* colon = strchr(value, ':');
+  unsigned long long soft, hard;
+  int r;
+  
+  if (colon != NULL)
+    *colon = '\0';
+  r = parse_size(value, &soft);
+  if (colon != NULL)
+    *colon = ':';
+  if (r < 0)
+    return -1;
+  if (colon == NULL)
+    hard = soft;
+  else if (parse_size(colon + 1, &hard) < 0)
+    return -1;
+  
+  out->rlim_cur = soft == DESCRIPTOR_MEMORY_UNLIMITED ? RLIM_INFINITY : (rlim_t)soft;
+  out->rlim_max = hard == DESCRIPTOR_MEMORY_UNLIMITED ? RLIM_INFINITY : (rlim_t)hard;
+  return out->rlim_cur > out->rlim_max ? -1 : 0;
+}
+
+
+/**
+ * Parse the address of a listening socket, "unix:<pathname>",
+ * "tcp:[<address>:]<port>" or "udp:[<address>:]<port>", where
+ * an IPv6 address is enclosed in brackets, and without an
+ * address the socket listens on all IPv4 addresses
+ * 
+ * @param   value  The string to parse
+ * @param   out    Output parameter for the socket
+ * @return         Zero on success, -1 if the value is invalid
+ */
+static int parse_listener(const char* restrict value, struct descriptor_listener* restrict out)
+{
+  struct sockaddr_un* un = &(out->address.un);
+  struct sockaddr_in* in4 = &(out->address.in4);
+  struct sockaddr_in6* in6 = &(out->address.in6);
+  char host[INET6_ADDRSTRLEN];
+  const char* port;
+  const char* end;
+  int portno, ipv6 = 0;
+  
+  memset(out, 0, sizeof(*out));
+  
+  if (strstr(value, "unix:") == value)
+    {
+      value += strlen("unix:");
+      if (!*value || (strlen(value) >= sizeof(un->sun_path)))
+	return -1;
+      out->type = SOCK_STREAM;
+      un->sun_family = AF_UNIX;
+      strcpy(un->sun_path, value);
+      out->length = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + strlen(value) + 1);
+      return 0;
+    }
+  
+  if      (strstr(value, "tcp:") == value)  out->type = SOCK_STREAM;
+  else if (strstr(value, "udp:") == value)  out->type = SOCK_DGRAM;
+  else
+    return -1;
+  value += strlen("tcp:");
+  
+  if (*value == '[')
+    {
+      if (end = strchr(++value, ']'), (end == NULL) || (end[1] != ':'))
+	return -1;
+      port = end + 2;
+      ipv6 = 1;
+    }
+  else if (end = strrchr(value, ':'), end != NULL)
+    port = end + 1;
+  else
+    end = port = value;
+  
+  if (parse_integer(port, 1, 65535, &portno) < 0)
+    return -1;
+  if ((size_t)(end - value) >= sizeof(host))
+    return -1;
+  memcpy(host, value, (size_t)(end - value) * sizeof(char));
+  host[end - value] = '\0';
+  
+  if (ipv6)
+    {
+      in6->sin6_family = AF_INET6;
+      in6->sin6_port = htons((uint16_t)portno);
+      out->length = sizeof(*in6);
+      return inet_pton(AF_INET6, host, &(in6->sin6_addr)) == 1 ? 0 : -1;
+    }
+  
+  in4->sin_family = AF_INET;
+  in4->sin_port = htons((uint16_t)portno);
+  out->length = sizeof(*in4);
+  if (end == value)
+    return in4->sin_addr.s_addr = htonl(INADDR_ANY), 0;
+  return inet_pton(AF_INET, host, &(in4->sin_addr)) == 1 ? 0 : -1;
+}
+
+
+/**
+ * Parse a boolean, "yes" or "no"
+ * 
+ * @param   value  The string to parse
+ * @param   out    Output parameter for the boolean
+ * @return         Zero on success, -1 if the value is invalid
+ */
+static int parse_boolean(const char* restrict value, int* restrict out)
+{
+  if      (!strcmp(value, "yes"))  *out = 1;
+  else if (!strcmp(value, "no"))   *out = 0;
+  else
+    return -1;
+  return 0;
+}
+
+
+/**
+ * Parse an activation mode, "manual", "eager" or "lazy"
+ * 
+ * @param   value  The string to parse
+ * @param   out    Output parameter for the activation mode
+ * @return         Zero on success, -1 if the value is invalid
+ */
+static int parse_activation(const char* restrict value, enum descriptor_activation* restrict out)
+{
+  if      (!strcmp(value, "manual"))  *out = DESCRIPTOR_ACTIVATION_MANUAL;
+  else if (!strcmp(value, "eager"))   *out = DESCRIPTOR_ACTIVATION_EAGER;
+  else if (!strcmp(value, "lazy"))    *out = DESCRIPTOR_ACTIVATION_LAZY;
+  else
+    return -1;
+  return 0;
+}
+
+
+/**
+ * Get the number of bytes used in a buffer of
+ * NUL-terminated strings, one directly after the other
+ * 
+ * @param   buffer  The buffer
+ * @param   count   The number of strings in `buffer`
+ * @return          The number of bytes used
+ */
+static __attribute__((pure)) size_t packed_length(const char* restrict buffer, size_t count)
+{
+  const char* p = buffer;
+  while (count--)
+    p += strlen(p) + 1;
+  return (size_t)(p - buffer);
+}
+
+
+/**
+ * Parse a whitespace separated list of services, and
+ * append it to the services a descriptor requires
+ * 
+ * @param   value       The string to parse
+ * @param   descriptor  The descriptor
+ * @return              Zero on success, -1 if the value is invalid
+ */
+static int parse_requires(const char* restrict value, struct descriptor* restrict descriptor)
+{
+  char* start = DESCRIPTOR_AT(descriptor, requires);
+  char* p = start;
+  size_t i, n;
+  
+  for (i = 0; i < descriptor->requires_count; i++)
+    p += strlen(p) + 1;
+  
+  for (;;)
+    {
+      while (isspace(*value))
+	value++;
+      if (!*value)
+	return 0;
+      for (n = 0; value[n] && !isspace(value[n]); n++);
+      if ((size_t)(p - start) + n + 1 > DESCRIPTOR_REQUIRES_SIZE)
+	return -1;
+      if (memchr(value, '/', n))
+	return -1;
+      memcpy(p, value, n * sizeof(char));
+      p[n] = '\0';
+      p += n + 1;
+      value += n;
+      descriptor->requires_count++;
+    }
+}
+
+
+/**
+ * Parse a `NAME=VALUE` or `NAME` environment change, and
+ * add it to a descriptor, replacing any earlier change
+ * of the same variable
+ * 
+ * @param   value       The string to parse
+ * @param   descriptor  The descriptor
+ * @return              Zero on success, -1 if the value is invalid
+ */
+static int parse_environment(const char* restrict value, struct descriptor* restrict descriptor)
+{
+  char* start = DESCRIPTOR_AT(descriptor, environment);
+  char* p = start;
+  size_t i, n, len = strcspn(value, "=");
+  
+  if ((len == 0) || (len != strcspn(value, "= \t")))
+    return -1;
+  
+  /* Remove an earlier change of the same variable. */
+  for (i = 0; i < descriptor->environment_count; i++, p += n + 1)
+    {
+      n = strlen(p);
+      if (strncmp(p, value, len) || ((p[len] != '=') && (p[len] != '\0')))
+	continue;
+      memmove(p, p + n + 1, (size_t)(start + DESCRIPTOR_ENVIRONMENT_SIZE - (p + n + 1)));
+      descriptor->environment_count--;
+      break;
+    }
+  
+  for (p = start, i = 0; i < descriptor->environment_count; i++)
+    p += strlen(p) + 1;
+  
+  n = strlen(value);
+  if (descriptor->environment_count == DESCRIPTOR_MAX_ENVIRONMENT)
+    return -1;
+  if ((size_t)(p - start) + n + 1 > DESCRIPTOR_ENVIRONMENT_SIZE)
+    return -1;
+  memcpy(p, value, (n + 1) * sizeof(char));
+  descriptor->environment_count++;
+  return 0;
+}
+
+
+/**
+ * Parse a signal, by name, with or without "SIG",
+ * by number, or "none" if the action is not supported
+ * 
+ * @param   value  The string to parse
+ * @param   out    Output parameter for the signal
+ * @return         Zero on success, -1 if the value is invalid
+ */
+static int parse_signal(const char* restrict value, int* restrict out)
+{
+  size_t i;
+  
+  if (!strcmp(value, "none"))
+    return *out = DESCRIPTOR_SIGNAL_NONE, 0;
+  if (isdigit(*value))
+    return parse_integer(value, 1, _NSIG - 1, out);
+  
+  if (strstr(value, "SIG") == value)
+    value += strlen("SIG");
+  for (i = 0; signal_names[i].name != NULL; i++)
+    if (!strcmp(value, signal_names[i].name))
+      return *out = signal_names[i].signo, 0;
+  return -1;
+}
+
+
+/**
+ * Parse a whitespace separated command line, without any quoting
+ * 
+ * @param   value   The string to parse
+ * @param   buffer  Output buffer for the arguments, each
+ *                  NUL-terminated, one directly after the other
+ * @param   size    The size of `buffer`
+ * @param   count   Output parameter for the number of arguments
+ * @return          Zero on success, -1 if the value is invalid
+ */
+static int parse_command(const char* restrict value, char* restrict buffer, size_t size, size_t* restrict count)
+{
+  char* p = buffer;
+  size_t n;
+  
+  for (*count = 0;; ++*count)
+    {
+      while (isspace(*value))
+	value++;
+      if (!*value)
+	break;
+      for (n = 0; value[n] && !isspace(value[n]); n++);
+      if (*count == DESCRIPTOR_MAX_EXEC)
+	return -1;
+      if ((size_t)(p - buffer) + n + 1 > size)
+	return -1;
+      memcpy(p, value, n * sizeof(char));
+      p[n] = '\0';
+      p += n + 1;
+      value += n;
+    }
+  
+  return *count ? 0 : -1;
+}
+
+
+/**
+ * Parse a health check, "none", "connect ADDRESS",
+ * "http ADDRESS [PATH]" or "exec COMMAND [ARGUMENT]...",
+ * where ADDRESS is on the same format as for `parse_listener`,
+ * but must be a stream socket, and defaults to the loopback
+ * address rather than to all addresses
+ * 
+ * @param   value       The string to parse
+ * @param   descriptor  The descriptor
+ * @return              Zero on success, -1 if the value is invalid
+ */
+static int parse_health(const char* restrict value, struct descriptor* restrict descriptor)
+{
+  struct descriptor_listener* address = &(descriptor->health_address);
+  char buffer[sizeof(address->address.un.sun_path) + sizeof("unix:")];
+  size_t n = strcspn(value, " \t");
+  
+  if (!strcmp(value, "none"))
+    return descriptor->health = DESCRIPTOR_HEALTH_NONE, 0;
+  if ((n == strlen("exec")) && !strncmp(value, "exec", n))
+    {
+      descriptor->health = DESCRIPTOR_HEALTH_EXEC;
+      return parse_command(value + n, DESCRIPTOR_AT(descriptor, health_exec), DESCRIPTOR_HEALTH_EXEC_SIZE,
+			   &(descriptor->health_exec_count));
+    }
+  
+  if ((n == strlen("connect")) && !strncmp(value, "connect", n))
+    descriptor->health = DESCRIPTOR_HEALTH_CONNECT;
+  else if ((n == strlen("http")) && !strncmp(value, "http", n))
+    descriptor->health = DESCRIPTOR_HEALTH_HTTP;
+  else
+    return -1;
+  
+  for (value += n; isspace(*value); value++);
+  if (n = strcspn(value, " \t"), (n == 0) || (n >= sizeof(buffer)))
+    return -1;
+  memcpy(buffer, value, n * sizeof(char));
+  buffer[n] = '\0';
+  if ((parse_listener(buffer, address) < 0) || (address->type != SOCK_STREAM))
+    return -1;
+  if ((address->address.any.sa_family == AF_INET) && (address->address.in4.sin_addr.s_addr == htonl(INADDR_ANY)))
+    address->address.in4.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  
+  for (value += n; isspace(*value); value++);
+  if (descriptor->health == DESCRIPTOR_HEALTH_CONNECT)
+    return *value ? -1 : 0;
+  if (!*value)
+    value = "/";
+  if ((*value != '/') || value[strcspn(value, " \t")] || (strlen(value) >= DESCRIPTOR_HEALTH_PATH_SIZE))
+    return -1;
+  strcpy(DESCRIPTOR_AT(descriptor, health_path), value);
+  return 0;
+}
+
+
+/**
+ * Set a value in a descriptor
+ * 
+ * @param   descriptor  The descriptor
+ * @param   key         The key
+ * @param   value       The value
+ * @return              Zero on success, -1 if the value is invalid,
+ *                      -2 if the key is unrecognised
+ */
+static int descriptor_set(struct descriptor* restrict descriptor, const char* restrict key, char* restrict value)
+{
+#define t(cond)  if (cond) return -1
+  
+  size_t i;
+  
+  if (!strcmp(key, "cpus"))
+    {
+      t (parse_cpus(value, descriptor->cpus));
+      descriptor->flags |= DESCRIPTOR_HAVE_CPUS;
+    }
+  else if (!strcmp(key, "nice"))
+    {
+      t (parse_integer(value, -20, 19, &(descriptor->nice)));
+      descriptor->flags |= DESCRIPTOR_HAVE_NICE;
+    }
+  else if (!strcmp(key, "scheduler"))
+    {
+      t (parse_scheduler(value, &(descriptor->scheduler)));
+      descriptor->flags |= DESCRIPTOR_HAVE_SCHEDULER;
+    }
+  else if (!strcmp(key, "priority"))
+    {
+      t (parse_integer(value, 0, 99, &(descriptor->priority)));
+      descriptor->flags |= DESCRIPTOR_HAVE_SCHEDULER;
+    }
+  else if (!strcmp(key, "ioprio"))
+    {
+      t (parse_ioprio(value, &(descriptor->ioprio)));
+      descriptor->flags |= DESCRIPTOR_HAVE_IOPRIO;
+    }
+  else if (!strcmp(key, "oom-score-adj"))
+    {
+      t (parse_integer(value, -1000, 1000, &(descriptor->oom_score_adj)));
+      descriptor->flags |= DESCRIPTOR_HAVE_OOM_SCORE_ADJ;
+    }
+  else if (!strcmp(key, "memory-max"))
+    {
+      t (parse_size(value, &(descriptor->memory_max)));
+      descriptor->flags |= DESCRIPTOR_HAVE_MEMORY_MAX;
+    }
+  else if (!strcmp(key, "memory-high"))
+    {
+      t (parse_size(value, &(descriptor->memory_high)));
+      descriptor->flags |= DESCRIPTOR_HAVE_MEMORY_HIGH;
+    }
+  else if (!strcmp(key, "listen"))
+    {
+      t (descriptor->listen_count == DESCRIPTOR_MAX_LISTEN);
+      t (parse_listener(value, DESCRIPTOR_LISTEN(descriptor) + descriptor->listen_count));
+      descriptor->listen_count++;
+    }
+  else if (!strcmp(key, "listen-start"))
+    {
+      t (parse_boolean(value, &(descriptor->listen_start)));
+    }
+  else if (!strcmp(key, "activation"))
+    {
+      t (parse_activation(value, &(descriptor->activation)));
+    }
+  else if (!strcmp(key, "idle-stop"))
+    {
+      t (parse_integer(value, 0, INT_MAX, &(descriptor->idle_stop)));
+    }
+  else if (!strcmp(key, "instances"))
+    {
+      t (parse_integer(value, 1, MAX_INSTANCES, &(descriptor->instances)));
+    }
+  else if (!strcmp(key, "requires"))
+    {
+      t (parse_requires(value, descriptor));
+    }
+  else if (!strcmp(key, "environment"))
+    {
+      t (parse_environment(value, descriptor));
+    }
+  else if (!strcmp(key, "exec"))
+    {
+      t (parse_command(value, DESCRIPTOR_AT(descriptor, exec), DESCRIPTOR_EXEC_SIZE, &(descriptor->exec_count)));
+    }
+  else if (!strcmp(key, "stop-signal"))
+    {
+      t (parse_signal(value, &(descriptor->stop_signal)));
+    }
+  else if (!strcmp(key, "kill-signal"))
+    {
+      t (parse_signal(value, &(descriptor->kill_signal)));
+    }
+  else if (!strcmp(key, "reload-signal"))
+    {
+      t (parse_signal(value, &(descriptor->reload_signal)));
+    }
+  else if (!strcmp(key, "update-signal"))
+    {
+      t (parse_signal(value, &(descriptor->update_signal)));
+    }
+  else if (!strcmp(key, "health-check"))
+    {
+      t (parse_health(value, descriptor));
+    }
+  else if (!strcmp(key, "health-interval"))
+    {
+      t (parse_integer(value, 1, INT_MAX, &(descriptor->health_interval)));
+    }
+  else if (!strcmp(key, "health-timeout"))
+    {
+      t (parse_integer(value, 1, INT_MAX, &(descriptor->health_timeout)));
+    }
+  else if (!strcmp(key, "health-retries"))
+    {
+      t (parse_integer(value, 1, INT_MAX, &(descriptor->health_retries)));
+    }
+  else if (strstr(key, "limit-") == key)
+    {
+      for (i = 0; rlimit_names[i].name != NULL; i++)
+	if (!strcmp(key + strlen("limit-"), rlimit_names[i].name))
+	  break;
+      if (rlimit_names[i].name == NULL)
+	return -2;
+      t (parse_rlimit(value, descriptor->rlimits + rlimit_names[i].resource));
+      descriptor->rlimits_set |= 1U << rlimit_names[i].resource;
+    }
+  else
+    return -2;
+  
+  return 0;
+  
+#undef t
+}
+
+
+/**
+ * Check whether a record in the compiled descriptor
+ * cache is for a descriptor file as it is now
+ * 
+ * @param   record  The record
+ * @param   name    The name of the service
+ * @param   attr    The current attributes of the descriptor file
+ * @return          Whether the record is up to date
+ */
+static __attribute__((pure)) int record_matches(const struct descriptor_record* restrict record,
+						const char* restrict name, const struct stat* restrict attr)
+{
+  return (record->inode == attr->st_ino) &&
+    (record->size == attr->st_size) &&
+    (record->mtime.tv_sec == attr->st_mtim.tv_sec) &&
+    (record->mtime.tv_nsec == attr->st_mtim.tv_nsec) &&
+    !strcmp(record->name, name);
+}
+
+
+/**
+ * Get the size of a record in the compiled descriptor
+ * cache, including the members of its descriptor that
+ * follow it, and its padding
+ * 
+ * @param   record  The record
+ * @return          The size of the record
+ */
+static __attribute__((pure)) size_t record_size(const struct descriptor_record* restrict record)
+{
+  size_t n = sizeof(*record) + record->descriptor.data_size;
+  return (n + RECORD_ALIGN - 1) / RECORD_ALIGN * RECORD_ALIGN;
+}
+
+
+/**
+ * Get the record after a record in the compiled descriptor cache
+ * 
+ * @param   record  The record
+ * @return          The next record
+ */
+static __attribute__((pure)) const struct descriptor_record* record_next(const struct descriptor_record* restrict record)
+{
+  return (const void*)((const char*)record + record_size(record));
+}
+
+
+/**
+ * Copy a descriptor whose variable-length
+ * members are not necessarily in the descriptor
+ * 
+ * @param   copy        Output parameter for the copy
+ * @param   descriptor  The descriptor to copy
+ * @param   data        The variable-length members of `descriptor`
+ * @return              Zero on success, -1 on error
+ */
+static int copy_descriptor(struct descriptor* restrict copy, const struct descriptor* restrict descriptor,
+			   const char* restrict data)
+{
+  *copy = *descriptor;
+  if (copy->data_size == 0)
+    return copy->data = NULL, 0;
+  if (copy->data = malloc(copy->data_size * sizeof(char)), copy->data == NULL)
+    return -1;
+  memcpy(copy->data, data, copy->data_size * sizeof(char));
+  return 0;
+}
+
+
+/**
+ * Look up a descriptor in the compiled descriptor cache
+ * 
+ * @param   name        The name of the service
+ * @param   attr        The current attributes of the descriptor file
+ * @param   descriptor  Output parameter for the descriptor
+ * @return              1 if the descriptor was found, 0 if
+ *                      it was not found, -1 on error
+ */
+static int cache_lookup(const char* restrict name, const struct stat* restrict attr,
+			struct descriptor* restrict descriptor)
+{
+  const struct descriptor_record* record;
+  size_t i;
+  
+  for (i = parsed_count; i--;)
+    if (record_matches(parsed + i, name, attr))
+      return descriptor_copy(descriptor, &(parsed[i].descriptor)) < 0 ? -1 : 1;
+  
+  if (cache == NULL)
+    return 0;
+  record = (const void*)(cache + 1);
+  for (i = 0; i < cache->count; i++, record = record_next(record))
+    if (record_matches(record, name, attr))
+      return copy_descriptor(descriptor, &(record->descriptor), (const void*)(record + 1)) < 0 ? -1 : 1;
+  
+  return 0;
+}
+
+
+/**
+ * Remember a parsed descriptor, so that it can be
+ * written to the compiled descriptor cache
+ * 
+ * @param   name        The name of the service
+ * @param   attr        The attributes of the descriptor file
+ * @param   descriptor  The descriptor
+ * @return              Zero on success, -1 on error
+ */
+static int cache_add(const char* restrict name, const struct stat* restrict attr,
+		     const struct descriptor* restrict descriptor)
+{
+  struct descriptor_record* new;
+  struct descriptor copy;
+  size_t i;
+  
+  if (strlen(name) > NAME_MAX)
+    return 0;
+  if (descriptor_copy(&copy, descriptor) < 0)
+    return -1;
+  
+  for (i = 0; i < parsed_count; i++)
+    if (!strcmp(parsed[i].name, name))
+      break;
+  if (i == parsed_count)
+    {
+      if (new = realloc(parsed, (parsed_count + 1) * sizeof(*parsed)), new == NULL)
+	return descriptor_destroy(&copy), -1;
+      parsed = new;
+      parsed_count++;
+    }
+  else
+    descriptor_destroy(&(parsed[i].descriptor));
+  
+  memset(parsed + i, 0, sizeof(*parsed));
+  strcpy(parsed[i].name, name);
+  parsed[i].inode = attr->st_ino;
+  parsed[i].size = attr->st_size;
+  parsed[i].mtime = attr->st_mtim;
+  parsed[i].descriptor = copy;
+  return 0;
+}
+
+
+/**
+ * Prepare a descriptor to be read, with room for
+ * each variable-length member, see `DESCRIPTOR_DATA_SIZE`
+ * 
+ * @param   descriptor  The descriptor, where nothing is set
+ * @return              Zero on success, -1 on error
+ */
+static int descriptor_draft(struct descriptor* restrict descriptor)
+{
+  size_t n = DESCRIPTOR_MAX_LISTEN * sizeof(struct descriptor_listener);
+  
+  if (descriptor->data = calloc(DESCRIPTOR_DATA_SIZE, sizeof(char)), descriptor->data == NULL)
+    return -1;
+  descriptor->requires    = n, n += DESCRIPTOR_REQUIRES_SIZE;
+  descriptor->environment = n, n += DESCRIPTOR_ENVIRONMENT_SIZE;
+  descriptor->exec        = n, n += DESCRIPTOR_EXEC_SIZE;
+  descriptor->health_path = n, n += DESCRIPTOR_HEALTH_PATH_SIZE;
+  descriptor->health_exec = n, n += DESCRIPTOR_HEALTH_EXEC_SIZE;
+  descriptor->data_size   = n;
+  return 0;
+}
+
+
+/**
+ * Move the variable-length members of a descriptor that has
+ * been read together, and release the room they do not use
+ * 
+ * @param  descriptor  The descriptor
+ */
+static void descriptor_compact(struct descriptor* restrict descriptor)
+{
+  char* data = descriptor->data;
+  size_t len, n = descriptor->listen_count * sizeof(struct descriptor_listener);
+  
+  /* The members are in the same order as in `descriptor_draft`, so nothing is overwritten. */
+#define move(member, length)\
+  (len = (length), memmove(data + n, data + descriptor->member, len), descriptor->member = n, n += len)
+  
+  move(requires,    packed_length(data + descriptor->requires, descriptor->requires_count));
+  move(environment, packed_length(data + descriptor->environment, descriptor->environment_count));
+  move(exec,        packed_length(data + descriptor->exec, descriptor->exec_count));
+  move(health_path, strlen(data + descriptor->health_path) + 1);
+  move(health_exec, packed_length(data + descriptor->health_exec, descriptor->health_exec_count));
+  
+#undef move
+  
+  descriptor->data_size = n;
+  if (data = realloc(data, n * sizeof(char)), data != NULL)
+    descriptor->data = data;
+}
+
+
+/**
+ * Read the descriptor of a service
+ * 
+ * An instance of a template, NAME@INSTANCE, that does not have
+ * a descriptor of its own, uses the descriptor of NAME@
+ * 
+ * @param   name        The name of the service
+ * @param   descriptor  Output parameter for the descriptor, a service
+ *                      without a descriptor file gets a descriptor
+ *                      where nothing is set, it must be released
+ *                      with `descriptor_destroy` on success
+ * @return              Zero on success, -1 on error, `errno` is
+ *                      zero if the descriptor file is malformed,
+ *                      in which case an error has been printed
+ */
+int descriptor_load(const char* restrict name, struct descriptor* restrict descriptor)
+{
+  char file_name[strlen(name) + 1];
+  const char* at = strchr(name, '@');
+  char line[4096];
+  char* pathname;
+  char* key;
+  char* value;
+  char* end;
+  size_t lineno = 0;
+  int r = 0, saved_errno;
+  struct stat attr;
+  FILE* f;
+  
+  memset(descriptor, 0, sizeof(*descriptor));
+  
+  pathname = malloc((strlen(DAEMONDIR "/" DESCRIPTOR_SUFFIX) + strlen(name) + 1) * sizeof(char));
+  if (pathname == NULL)
+    return -1;
+  sprintf(pathname, DAEMONDIR "/%s" DESCRIPTOR_SUFFIX, name);
+  strcpy(file_name, name);
+  
+  /* An instance, NAME@INSTANCE, without a descriptor of its own uses the template, NAME@. */
+  f = fopen(pathname, "re");
+  if ((f == NULL) && (errno == ENOENT) && (at != NULL) && at[1])
+    {
+      file_name[at - name + 1] = '\0';
+      sprintf(pathname, DAEMONDIR "/%s" DESCRIPTOR_SUFFIX, file_name);
+      f = fopen(pathname, "re");
+    }
+  if (f == NULL)
+    {
+      saved_errno = errno;
+      free(pathname);
+      return errno = saved_errno, saved_errno == ENOENT ? 0 : -1;
+    }
+  
+  /* Do not parse the file again if it has not been modified. */
+  if (fstat(fileno(f), &attr) < 0)
+    {
+      saved_errno = errno;
+      fclose(f);
+      free(pathname);
+      return errno = saved_errno, -1;
+    }
+  if (r = cache_lookup(file_name, &attr, descriptor), r != 0)
+    {
+      saved_errno = errno;
+      fclose(f);
+      free(pathname);
+      return errno = saved_errno, r < 0 ? -1 : 0;
+    }
+  
+  if (descriptor_draft(descriptor) < 0)
+    {
+      saved_errno = errno;
+      fclose(f);
+      free(pathname);
+      return errno = saved_errno, -1;
+    }
+  
+  while (fgets(line, (int)sizeof(line), f) != NULL)
+    {
+      lineno++;
+      if (end = strchr(line, '\n'), end == NULL)
+	{
+	  if (!feof(f))
+	    {
+	      fprintf(stderr, "%s: %s:%zu: line is too long\n", *argv, pathname, lineno);
+	      goto invalid;
+	    }
+	  end = line + strlen(line);
+	}
+      
+      /* Trim the line, and skip empty lines and comments. */
+      for (key = line; isspace(*key); key++);
+      while ((end > key) && isspace(end[-1]))
+	end--;
+      *end = '\0';
+      if ((*key == '\0') || (*key == '#'))
+	continue;
+      
+      /* Split the line into key and value. */
+      if (value = strchr(key, '='), value == NULL)
+	{
+	  fprintf(stderr, "%s: %s:%zu: expected `<key> = <value>`\n", *argv, pathname, lineno);
+	  goto invalid;
+	}
+      for (end = value; (end > key) && isspace(end[-1]); end--);
+      *end = '\0';
+      for (value++; isspace(*value); value++);
+      
+      if (r = descriptor_set(descriptor, key, value), r == -1)
+	{
+	  fprintf(stderr, "%s: %s:%zu: invalid value for %s\n", *argv, pathname, lineno, key);
+	  goto invalid;
+	}
+      else if (r == -2)
+	{
+	  fprintf(stderr, "%s: %s:%zu: unrecognised key %s\n", *argv, pathname, lineno, key);
+	  goto invalid;
+	}
+    }
+  
+  r = ferror(f) ? -1 : 0;
+  saved_errno = errno;
+  
+  /* Every instance would bind the same sockets, and all but one would fail. */
+  if ((r == 0) && descriptor->listen_count && (file_name[strlen(file_name) - 1] == '@'))
+    {
+      fprintf(stderr, "%s: %s: listen cannot be used in a template\n", *argv, pathname);
+      goto invalid;
+    }
+  
+  fclose(f);
+  free(pathname);
+  
+  /* Real-time policies require a priority. */
+  if ((descriptor->scheduler == SCHED_FIFO) || (descriptor->scheduler == SCHED_RR))
+    if (descriptor->priority == 0)
+      descriptor->priority = 1;
+  if ((descriptor->scheduler != SCHED_FIFO) && (descriptor->scheduler != SCHED_RR))
+    descriptor->priority = 0;
+  
+  if (descriptor->instances == 0)
+    descriptor->instances = 1;
+  
+  if (r < 0)
+    return descriptor_destroy(descriptor), errno = saved_errno, -1;
+  descriptor_compact(descriptor);
+  if (cache_add(file_name, &attr, descriptor) < 0)
+    perror(*argv);
+  
+  return errno = saved_errno, 0;
+  
+ invalid:
+  fclose(f);
+  free(pathname);
+  descriptor_destroy(descriptor);
+  return errno = 0, -1;
+}
+
+
+/**
+ * Copy a descriptor
+ * 
+ * @param   copy        Output parameter for the copy, which must be
+ *                      released with `descriptor_destroy`
+ * @param   descriptor  The descriptor to copy
+ * @return              Zero on success, -1 on error
+ */
+int descriptor_copy(struct descriptor* restrict copy, const struct descriptor* restrict descriptor)
+{
+  return copy_descriptor(copy, descriptor, descriptor->data);
+}
+
+
+/**
+ * Release the memory of a descriptor, but not
+ * the `struct descriptor` itself
+ * 
+ * @param  descriptor  The descriptor, may be a descriptor whose
+ *                     memory has already been released
+ */
+void descriptor_destroy(struct descriptor* restrict descriptor)
+{
+  free(descriptor->data), descriptor->data = NULL;
+  descriptor->data_size = 0;
+  descriptor->listen_count = 0;
+  descriptor->requires_count = 0;
+  descriptor->environment_count = 0;
+  descriptor->exec_count = 0;
+  descriptor->health_exec_count = 0;
+}
+
+
+/**
+ * Apply the scheduling attributes and resource limits of
+ * a service to the calling process, to be called between
+ * fork and exec
+ * 
+ * @param   descriptor  The descriptor of the service
+ * @return              Zero on success, -1 on error
+ */
+int descriptor_apply(const struct descriptor* restrict descriptor)
+{
+  struct sched_param param;
+  char buf[3 * sizeof(int) + 2];
+  cpu_set_t cpus;
+  size_t i, n;
+  int fd;
+  
+  for (i = 0; i < RLIM_NLIMITS; i++)
+    if (descriptor->rlimits_set & (1U << i))
+      if (setrlimit((int)i, descriptor->rlimits + i) < 0)
+	return -1;
+  
+  if (descriptor->flags & DESCRIPTOR_HAVE_SCHEDULER)
+    {
+      param.sched_priority = descriptor->priority;
+      if (sched_setscheduler(0, descriptor->scheduler, &param) < 0)
+	return -1;
+    }
+  
+  if (descriptor->flags & DESCRIPTOR_HAVE_NICE)
+    if (setpriority(PRIO_PROCESS, 0, descriptor->nice) < 0)
+      return -1;
+  
+  if (descriptor->flags & DESCRIPTOR_HAVE_CPUS)
+    {
+      CPU_ZERO(&cpus);
+      for (i = 0; i < DESCRIPTOR_MAX_CPUS; i++)
+	if (descriptor->cpus[i / DESCRIPTOR_CPU_BITS] & (1UL << (i % DESCRIPTOR_CPU_BITS)))
+	  CPU_SET(i, &cpus);
+      if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0)
+	return -1;
+    }
+  
+  if (descriptor->flags & DESCRIPTOR_HAVE_IOPRIO)
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, descriptor->ioprio) < 0)
+      return -1;
+  
+  if (descriptor->flags & DESCRIPTOR_HAVE_OOM_SCORE_ADJ)
+    {
+      if (fd = open(SELF_OOM_SCORE_ADJ, O_WRONLY | O_CLOEXEC), fd < 0)
+	return -1;
+      sprintf(buf, "%i\n", descriptor->oom_score_adj);
+      n = strlen(buf);
+      if (write(fd, buf, n) < (ssize_t)n)
+	return close(fd), -1;
+      if (close(fd) < 0)
+	return -1;
+    }
+  
+  return 0;
+}
+
+
+/**
+ * Apply the cgroup limits of a service, to be called
+ * after the cgroup of the service has been created
+ * 
+ * @param   name        The name of the service
+ * @param   descriptor  The descriptor of the service
+ * @return              Zero on success, -1 on error
+ */
+int descriptor_apply_cgroup(const char* restrict name, const struct descriptor* restrict descriptor)
+{
+  char buf[3 * sizeof(unsigned long long) + 2];
+  
+  if (descriptor->flags & DESCRIPTOR_HAVE_MEMORY_MAX)
+    {
+      if (descriptor->memory_max == DESCRIPTOR_MEMORY_UNLIMITED)
+	strcpy(buf, "max");
+      else
+	sprintf(buf, "%llu", descriptor->memory_max);
+      if (cgroup_write(name, "memory.max", buf) < 0)
+	return -1;
+    }
+  
+  if (descriptor->flags & DESCRIPTOR_HAVE_MEMORY_HIGH)
+    {
+      if (descriptor->memory_high == DESCRIPTOR_MEMORY_UNLIMITED)
+	strcpy(buf, "max");
+      else
+	sprintf(buf, "%llu", descriptor->memory_high);
+      if (cgroup_write(name, "memory.high", buf) < 0)
+	return -1;
+    }
+  
+  return 0;
+}
+
+
+/**
+ * Check whether a service requires another service
+ * 
+ * @param   descriptor  The descriptor of the service
+ * @param   name        The name of the other service
+ * @return              Whether the service requires the other service
+ */
+int descriptor_requires(const struct descriptor* restrict descriptor, const char* restrict name)
+{
+  const char* p = DESCRIPTOR_AT(descriptor, requires);
+  size_t i;
+  for (i = 0; i < descriptor->requires_count; i++, p += strlen(p) + 1)
+    if (!strcmp(p, name))
+      return 1;
+  return 0;
+}
+
+
+/**
+ * Check whether two descriptors of a service differ in what is
+ * applied when the service is spawned, so that the service must
+ * be restarted for the new descriptor to take effect
+ * 
+ * Memory limits are not included, they can be applied
+ * to the cgroup of a running service
+ * 
+ * @param   a  One of the descriptors
+ * @param   b  The other descriptor
+ * @return     Whether the service must be restarted
+ */
+int descriptor_spawn_differs(const struct descriptor* restrict a, const struct descriptor* restrict b)
+{
+  unsigned int mask = ~(unsigned int)(DESCRIPTOR_HAVE_MEMORY_MAX | DESCRIPTOR_HAVE_MEMORY_HIGH);
+  const struct descriptor_listener* x;
+  const struct descriptor_listener* y;
+  size_t i, n;
+  
+  if (((a->flags & mask) != (b->flags & mask)) || (a->rlimits_set != b->rlimits_set))
+    return 1;
+  if ((a->flags & DESCRIPTOR_HAVE_CPUS) && memcmp(a->cpus, b->cpus, sizeof(a->cpus)))
+    return 1;
+  if ((a->nice != b->nice) || (a->scheduler != b->scheduler) || (a->priority != b->priority))
+    return 1;
+  if ((a->ioprio != b->ioprio) || (a->oom_score_adj != b->oom_score_adj))
+    return 1;
+  for (i = 0; i < RLIM_NLIMITS; i++)
+    if (a->rlimits_set & (1U << i))
+      if ((a->rlimits[i].rlim_cur != b->rlimits[i].rlim_cur) || (a->rlimits[i].rlim_max != b->rlimits[i].rlim_max))
+	return 1;
+  
+  /* The service has inherited its sockets. */
+  if (a->listen_count != b->listen_count)
+    return 1;
+  for (i = 0; i < a->listen_count; i++)
+    {
+      x = DESCRIPTOR_LISTEN(a) + i, y = DESCRIPTOR_LISTEN(b) + i;
+      if ((x->type != y->type) || (x->length != y->length) || memcmp(&(x->address), &(y->address), (size_t)(x->length)))
+	return 1;
+    }
+  
+  if (a->environment_count != b->environment_count)
+    return 1;
+  n = packed_length(DESCRIPTOR_AT(a, environment), a->environment_count);
+  if ((n != packed_length(DESCRIPTOR_AT(b, environment), b->environment_count)) ||
+      memcmp(DESCRIPTOR_AT(a, environment), DESCRIPTOR_AT(b, environment), n))
+    return 1;
+  
+  if (a->exec_count != b->exec_count)
+    return 1;
+  n = packed_length(DESCRIPTOR_AT(a, exec), a->exec_count);
+  return (n != packed_length(DESCRIPTOR_AT(b, exec), b->exec_count)) ||
+    memcmp(DESCRIPTOR_AT(a, exec), DESCRIPTOR_AT(b, exec), n);
+}
+
+
+/**
+ * Get the changes a service makes to its environment,
+ * as entries for `environtab_compose`
+ * 
+ * @param   descriptor  The descriptor of the service
+ * @param   entries     Output array, must have room for
+ *                      `DESCRIPTOR_MAX_ENVIRONMENT` elements,
+ *                      the elements point into `descriptor`
+ * @return              The number of elements stored in `entries`
+ */
+size_t descriptor_environment(struct descriptor* restrict descriptor, char** restrict entries)
+{
+  char* p = DESCRIPTOR_AT(descriptor, environment);
+  size_t i;
+  for (i = 0; i < descriptor->environment_count; i++, p += strlen(p) + 1)
+    entries[i] = p;
+  return i;
+}
+
+
+/**
+ * Get the command line that starts a service
+ * 
+ * @param   descriptor  The descriptor of the service
+ * @param   command     Output array, must have room for
+ *                      `DESCRIPTOR_MAX_EXEC + 1` elements, the
+ *                      elements point into `descriptor`, and
+ *                      the list is `NULL`-terminated
+ * @return              The number of arguments, zero if the service
+ *                      is started by its daemon script
+ */
+size_t descriptor_command(struct descriptor* restrict descriptor, char** restrict command)
+{
+  char* p = DESCRIPTOR_AT(descriptor, exec);
+  size_t i;
+  for (i = 0; i < descriptor->exec_count; i++, p += strlen(p) + 1)
+    command[i] = p;
+  command[i] = NULL;
+  return i;
+}
+
+
+/**
+ * Get the command line that checks the health of a service
+ * 
+ * @param   descriptor  The descriptor of the service
+ * @param   command     Output array, must have room for
+ *                      `DESCRIPTOR_MAX_EXEC + 1` elements, the
+ *                      elements point into `descriptor`, and
+ *                      the list is `NULL`-terminated
+ * @return              The number of arguments, zero if the health
+ *                      of the service is not checked by a command
+ */
+size_t descriptor_health_command(struct descriptor* restrict descriptor, char** restrict command)
+{
+  char* p = DESCRIPTOR_AT(descriptor, health_exec);
+  size_t i, n = descriptor->health == DESCRIPTOR_HEALTH_EXEC ? descriptor->health_exec_count : 0;
+  for (i = 0; i < n; i++, p += strlen(p) + 1)
+    command[i] = p;
+  command[i] = NULL;
+  return i;
+}
+
+
+/**
+ * Map the compiled descriptor cache, so that descriptors
+ * that have not been modified are not parsed again
+ * 
+ * @return  Zero on success, -1 on error, a missing or
+ *          outdated cache is not an error
+ */
+int descriptor_cache_open(void)
+{
+  const struct descriptor_record* record;
+  struct descriptor_cache_header* header;
+  struct stat attr;
+  void* address;
+  int fd, saved_errno;
+  size_t i, size, left;
+  
+  if (cache != NULL)
+    munmap(cache, cache_size), cache = NULL;
+  
+  if (fd = open(DESCRIPTOR_CACHE, O_RDONLY | O_CLOEXEC), fd < 0)
+    return errno == ENOENT ? 0 : -1;
+  if (fstat(fd, &attr) < 0)
+    goto fail;
+  size = (size_t)(attr.st_size);
+  if (size < sizeof(*header))
+    return close(fd), 0;
+  address = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (address == MAP_FAILED)
+    goto fail;
+  close(fd);
+  
+  /* Ignore caches written by another version of daemond. */
+  header = address;
+  if (memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) ||
+      (header->record_size != sizeof(struct descriptor_record)))
+    return munmap(address, size), 0;
+  
+  /* The records are of different sizes, make sure they are all there. */
+  record = (const void*)(header + 1);
+  left = size - sizeof(*header);
+  for (i = 0; i < header->count; i++, record = record_next(record))
+    {
+      if ((left < sizeof(*record)) || (record->descriptor.data_size > left - sizeof(*record)))
+	return munmap(address, size), 0;
+      if (record_size(record) > left)
+	return munmap(address, size), 0;
+      left -= record_size(record);
+    }
+  if (left)
+    return munmap(address, size), 0;
+  
+  cache = header;
+  cache_size = size;
+  return 0;
+  
+ fail:
+  saved_errno = errno;
+  close(fd);
+  return errno = saved_errno, -1;
+}
+
+
+/**
+ * Check whether a record in the mapped compiled descriptor cache
+ * should be kept when the cache is written
+ * 
+ * @param   record  The record
+ * @return          Whether the record has not been superseded
+ *                  and its descriptor file has not been modified
+ */
+static int record_kept(const struct descriptor_record* restrict record)
+{
+  char pathname[sizeof(DAEMONDIR "/" DESCRIPTOR_SUFFIX) + NAME_MAX];
+  struct stat attr;
+  size_t i;
+  
+  for (i = 0; i < parsed_count; i++)
+    if (!strcmp(record->name, parsed[i].name))
+      return 0;
+  
+  sprintf(pathname, DAEMONDIR "/%s" DESCRIPTOR_SUFFIX, record->name);
+  return (stat(pathname, &attr) == 0) && record_matches(record, record->name, &attr);
+}
+
+
+/**
+ * Write descriptors that have been parsed since the compiled
+ * descriptor cache was mapped to the cache, if any
+ * 
+ * @return  Zero on success, -1 on error
+ */
+int descriptor_cache_save(void)
+{
+  static const char padding[RECORD_ALIGN];
+  const struct descriptor_record* first = cache ? (const void*)(cache + 1) : NULL;
+  const struct descriptor_record* record;
+  size_t i, n, old_count = cache ? cache->count : 0;
+  struct descriptor_cache_header header;
+  struct descriptor_record copy;
+  char kept[old_count + 1];
+  int saved_errno;
+  FILE* f;
+  
+  if (parsed_count == 0)
+    return 0;
+  
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+  header.record_size = sizeof(struct descriptor_record);
+  header.count = parsed_count;
+  for (i = 0, record = first; i < old_count; i++, record = record_next(record))
+    if ((kept[i] = (char)record_kept(record)))
+      header.count++;
+  
+  /* Write a new cache and replace the old one atomically. */
+  if (f = fopen(DESCRIPTOR_CACHE "~", "we"), f == NULL)
+    return -1;
+  if (fwrite(&header, sizeof(header), 1, f) != 1)
+    goto fail;
+  for (i = 0, record = first; i < old_count; i++, record = record_next(record))
+    if (kept[i] && (fwrite(record, record_size(record), 1, f) != 1))
+      goto fail;
+  for (i = 0; i < parsed_count; i++)
+    {
+      copy = parsed[i];
+      copy.descriptor.data = NULL;
+      n = record_size(&copy) - sizeof(copy) - copy.descriptor.data_size;
+      if (fwrite(&copy, sizeof(copy), 1, f) != 1)
+	goto fail;
+      if (fwrite(parsed[i].descriptor.data, sizeof(char), copy.descriptor.data_size, f) != copy.descriptor.data_size)
+	goto fail;
+      if (fwrite(padding, sizeof(char), n, f) != n)
+	goto fail;
+    }
+  if (fclose(f) != 0)
+    {
+      f = NULL;
+      goto fail;
+    }
+  f = NULL;
+  if (rename(DESCRIPTOR_CACHE "~", DESCRIPTOR_CACHE) < 0)
+    goto fail;
+  
+  for (i = 0; i < parsed_count; i++)
+    descriptor_destroy(&(parsed[i].descriptor));
+  free(parsed), parsed = NULL, parsed_count = 0;
+  return descriptor_cache_open();
+  
+ fail:
+  saved_errno = errno;
+  if (f != NULL)
+    fclose(f);
+  unlink(DESCRIPTOR_CACHE "~");
+  return errno = saved_errno, -1;
+}
+
@@ -0,0 +1,607 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef DAEMOND_DESCRIPTOR_H
+#define DAEMOND_DESCRIPTOR_H
+
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+
+
+/**
+ * The highest CPU number, plus one, that can be used in `cpus`
+ */
+#define DESCRIPTOR_MAX_CPUS  1024
+
+/**
+ * The number of bits in an element of `struct descriptor.cpus`
+ */
+#define DESCRIPTOR_CPU_BITS  (8 * sizeof(unsigned long))
+
+
+/**
+ * The maximum number of listening sockets a service may have
+ */
+#define DESCRIPTOR_MAX_LISTEN  16
+
+
+/**
+ * The size of `struct descriptor.requires`
+ */
+#define DESCRIPTOR_REQUIRES_SIZE  1024
+
+/**
+ * The size of `struct descriptor.environment`
+ */
+#define DESCRIPTOR_ENVIRONMENT_SIZE  1024
+
+/**
+ * The maximum number of environment variables
+ * a service's descriptor may set or unset
+ */
+#define DESCRIPTOR_MAX_ENVIRONMENT  32
+
+/**
+ * The size of `struct descriptor.exec`
+ */
+#define DESCRIPTOR_EXEC_SIZE  1024
+
+/**
+ * The maximum number of arguments in `struct descriptor.exec`
+ */
+#define DESCRIPTOR_MAX_EXEC  32
+
+/**
+ * The size of `struct descriptor.health_exec`
+ */
+#define DESCRIPTOR_HEALTH_EXEC_SIZE  1024
+
+/**
+ * The size of `struct descriptor.health_path`
+ */
+#define DESCRIPTOR_HEALTH_PATH_SIZE  256
+
+/**
+ * The size of `struct descriptor.data` while the descriptor is
+ * read, the room for each variable-length member, one after
+ * the other, beginning with the sockets
+ */
+#define DESCRIPTOR_DATA_SIZE								\
+  (DESCRIPTOR_MAX_LISTEN * sizeof(struct descriptor_listener) +				\
+   DESCRIPTOR_REQUIRES_SIZE + DESCRIPTOR_ENVIRONMENT_SIZE + DESCRIPTOR_EXEC_SIZE +	\
+   DESCRIPTOR_HEALTH_PATH_SIZE + DESCRIPTOR_HEALTH_EXEC_SIZE)
+
+/**
+ * Get a variable-length member of a descriptor
+ * 
+ * @param   descriptor  The descriptor
+ * @param   member      The offset member, `requires`, `environment`,
+ *                      `exec`, `health_path` or `health_exec`
+ * @return              The member, as a `char*`
+ */
+#define DESCRIPTOR_AT(descriptor, member)  ((descriptor)->data + (descriptor)->member)
+
+/**
+ * Get the sockets of a descriptor
+ * 
+ * @param   descriptor  The descriptor
+ * @return              The sockets, as a `struct descriptor_listener*`
+ */
+#define DESCRIPTOR_LISTEN(descriptor)  ((struct descriptor_listener*)(void*)((descriptor)->data))
+
+/**
+ * Value of the signal members of `struct descriptor`
+ * when the action is not supported
+ */
+#define DESCRIPTOR_SIGNAL_NONE  (-1)
+
+
+/**
+ * `struct descriptor.cpus` is set
+ */
+#define DESCRIPTOR_HAVE_CPUS  0x0001
+
+/**
+ * `struct descriptor.nice` is set
+ */
+#define DESCRIPTOR_HAVE_NICE  0x0002
+
+/**
+ * `struct descriptor.scheduler` and `struct descriptor.priority` are set
+ */
+#define DESCRIPTOR_HAVE_SCHEDULER  0x0004
+
+/**
+ * `struct descriptor.ioprio` is set
+ */
+#define DESCRIPTOR_HAVE_IOPRIO  0x0008
+
+/**
+ * `struct descriptor.oom_score_adj` is set
+ */
+#define DESCRIPTOR_HAVE_OOM_SCORE_ADJ  0x0010
+
+/**
+ * `struct descriptor.memory_max` is set
+ */
+#define DESCRIPTOR_HAVE_MEMORY_MAX  0x0020
+
+/**
+ * `struct descriptor.memory_high` is set
+ */
+#define DESCRIPTOR_HAVE_MEMORY_HIGH  0x0040
+
+
+/**
+ * Value of `struct descriptor.memory_max` and
+ * `struct descriptor.memory_high` for no limit
+ */
+#define DESCRIPTOR_MEMORY_UNLIMITED  (~0ULL)
+
+
+
+/**
+ * When a service is started
+ */
+enum descriptor_activation
+  {
+    /**
+     * The service is started when requested
+     */
+    DESCRIPTOR_ACTIVATION_MANUAL,
+    
+    /**
+     * The service is started when daemond starts
+     */
+    DESCRIPTOR_ACTIVATION_EAGER,
+    
+    /**
+     * The service is registered when daemond starts, and
+     * started on the first connection to its sockets, the
+     * first control request or when a service requires it
+     */
+    DESCRIPTOR_ACTIVATION_LAZY
+  };
+
+
+/**
+ * How the health of a service is checked
+ */
+enum descriptor_health
+  {
+    /**
+     * The health of the service is not checked
+     */
+    DESCRIPTOR_HEALTH_NONE,
+    
+    /**
+     * The service is healthy if a connection
+     * can be made to one of its sockets
+     */
+    DESCRIPTOR_HEALTH_CONNECT,
+    
+    /**
+     * The service is healthy if it answers
+     * an HTTP GET request with a 2xx or 3xx status
+     */
+    DESCRIPTOR_HEALTH_HTTP,
+    
+    /**
+     * The service is healthy if a command exits with value 0
+     */
+    DESCRIPTOR_HEALTH_EXEC
+  };
+
+
+/**
+ * A socket daemond listens on for a service
+ */
+struct descriptor_listener
+{
+  /**
+   * The socket type, `SOCK_STREAM` or `SOCK_DGRAM`
+   */
+  int type;
+  
+  /**
+   * The length of `address`
+   */
+  socklen_t length;
+  
+  /**
+   * The address to bind the socket to
+   */
+  union
+  {
+    /**
+     * The address, for any address family
+     */
+    struct sockaddr any;
+    
+    /**
+     * The address, for `AF_UNIX`
+     */
+    struct sockaddr_un un;
+    
+    /**
+     * The address, for `AF_INET`
+     */
+    struct sockaddr_in in4;
+    
+    /**
+     * The address, for `AF_INET6`
+     */
+    struct sockaddr_in6 in6;
+  } address;
+};
+
+
+/**
+ * The declarative part of a service, read from
+ * DAEMONDIR/<name>.conf, which is applied between
+ * fork and exec when the service is spawned
+ */
+struct descriptor
+{
+  /**
+   * Bitwise-OR of the `DESCRIPTOR_HAVE_*` that are set
+   */
+  unsigned int flags;
+  
+  /**
+   * Bitmask of the resources in `rlimits` that are set
+   */
+  unsigned int rlimits_set;
+  
+  /**
+   * The CPUs the service may run on
+   */
+  unsigned long cpus[DESCRIPTOR_MAX_CPUS / DESCRIPTOR_CPU_BITS];
+  
+  /**
+   * The nice value of the service
+   */
+  int nice;
+  
+  /**
+   * The scheduling policy of the service
+   */
+  int scheduler;
+  
+  /**
+   * The static scheduling priority of the service
+   */
+  int priority;
+  
+  /**
+   * The IO priority of the service, as given to ioprio_set(2)
+   */
+  int ioprio;
+  
+  /**
+   * The OOM score adjustment of the service
+   */
+  int oom_score_adj;
+  
+  /**
+   * The hard memory limit of the service's cgroup, in bytes
+   */
+  unsigned long long memory_max;
+  
+  /**
+   * The memory throttling limit of the service's cgroup, in bytes
+   */
+  unsigned long long memory_high;
+  
+  /**
+   * The resource limits of the service, indexed by resource
+   */
+  struct rlimit rlimits[RLIM_NLIMITS];
+  
+  /**
+   * Whether the service shall not be started until
+   * a connection is made to one of its sockets
+   */
+  int listen_start;
+  
+  /**
+   * The number of sockets daemond listens on for the
+   * service, they are first in `data`, see `DESCRIPTOR_LISTEN`
+   */
+  size_t listen_count;
+  
+  /**
+   * When the service is started
+   */
+  enum descriptor_activation activation;
+  
+  /**
+   * The number of seconds the service may be idle before it
+   * is stopped, zero if the service is not stopped when idle
+   */
+  int idle_stop;
+  
+  /**
+   * The number of instances of a template that
+   * are registered when daemond starts
+   */
+  int instances;
+  
+  /**
+   * The number of names in `requires`
+   */
+  size_t requires_count;
+  
+  /**
+   * The offset in `data` of the names of the services that
+   * must be running before the service is started, each
+   * NUL-terminated, one directly after the other
+   */
+  size_t requires;
+  
+  /**
+   * The number of entries in `environment`
+   */
+  size_t environment_count;
+  
+  /**
+   * The offset in `data` of the changes to the environment of
+   * the service, on top of the environtab, each NUL-terminated,
+   * one directly after the other, `NAME=VALUE` sets a variable
+   * and `NAME` removes it
+   */
+  size_t environment;
+  
+  /**
+   * The signal that stops the service, zero for the
+   * default, `DESCRIPTOR_SIGNAL_NONE` if not supported
+   */
+  int stop_signal;
+  
+  /**
+   * The signal that force stops the service, zero for the
+   * default, `DESCRIPTOR_SIGNAL_NONE` if not supported
+   */
+  int kill_signal;
+  
+  /**
+   * The signal that makes the service reload its configurations,
+   * zero for the default, `DESCRIPTOR_SIGNAL_NONE` if not supported
+   */
+  int reload_signal;
+  
+  /**
+   * The signal that makes the service re-exec to update itself, zero
+   * for the default, `DESCRIPTOR_SIGNAL_NONE` if not supported
+   */
+  int update_signal;
+  
+  /**
+   * The number of arguments in `exec`, zero if the
+   * service is started by its daemon script
+   */
+  size_t exec_count;
+  
+  /**
+   * The offset in `data` of the command line that starts the
+   * service, each argument NUL-terminated, one directly after
+   * the other
+   */
+  size_t exec;
+  
+  /**
+   * How the health of the service is checked
+   */
+  enum descriptor_health health;
+  
+  /**
+   * The socket that is connected to, for
+   * `DESCRIPTOR_HEALTH_CONNECT` and `DESCRIPTOR_HEALTH_HTTP`
+   */
+  struct descriptor_listener health_address;
+  
+  /**
+   * The offset in `data` of the path that is
+   * requested, for `DESCRIPTOR_HEALTH_HTTP`
+   */
+  size_t health_path;
+  
+  /**
+   * The number of arguments in `health_exec`
+   */
+  size_t health_exec_count;
+  
+  /**
+   * The offset in `data` of the command line that is run,
+   * for `DESCRIPTOR_HEALTH_EXEC`, each argument NUL-terminated,
+   * one directly after the other
+   */
+  size_t health_exec;
+  
+  /**
+   * The number of seconds between health checks, zero for the default
+   */
+  int health_interval;
+  
+  /**
+   * The number of seconds a health check may
+   * take before it fails, zero for the default
+   */
+  int health_timeout;
+  
+  /**
+   * The number of health checks in a row the service
+   * may fail before it is restarted, zero for the default
+   */
+  int health_retries;
+  
+  /**
+   * The number of bytes in `data`
+   */
+  size_t data_size;
+  
+  /**
+   * The variable-length members, kept out of line so that
+   * a service only uses as much memory as its descriptor
+   * needs, `NULL` if there are none, owned by the descriptor
+   */
+  char* data;
+};
+
+
+
+/**
+ * Read the descriptor of a service
+ * 
+ * An instance of a template, NAME@INSTANCE, that does not have
+ * a descriptor of its own, uses the descriptor of NAME@
+ * 
+ * @param   name        The name of the service
+ * @param   descriptor  Output parameter for the descriptor, a service
+ *                      without a descriptor file gets a descriptor
+ *                      where nothing is set, it must be released
+ *                      with `descriptor_destroy` on success
+ * @return              Zero on success, -1 on error, `errno` is
+ *                      zero if the descriptor file is malformed,
+ *                      in which case an error has been printed
+ */
+int descriptor_load(const char* restrict name, struct descriptor* restrict descriptor);
+
+/**
+ * Copy a descriptor
+ * 
+ * @param   copy        Output parameter for the copy, which must be
+ *                      released with `descriptor_destroy`
+ * @param   descriptor  The descriptor to copy
+ * @return              Zero on success, -1 on error
+ */
+int descriptor_copy(struct descriptor* restrict copy, const struct descriptor* restrict descriptor);
+
+/**
+ * Release the memory of a descriptor, but not
+ * the `struct descriptor` itself
+ * 
+ * @param  descriptor  The descriptor, may be a descriptor whose
+ *                     memory has already been released
+ */
+void descriptor_destroy(struct descriptor* restrict descriptor);
+
+/**
+ * Apply the scheduling attributes and resource limits of
+ * a service to the calling process, to be called between
+ * fork and exec
+ * 
+ * @param   descriptor  The descriptor of the service
+ * @return              Zero on success, -1 on error
+ */
+int descriptor_apply(const struct descriptor* restrict descriptor);
+
+/**
+ * Apply the cgroup limits of a service, to be called
+ * after the cgroup of the service has been created
+ * 
+ * @param   name        The name of the service
+ * @param   descriptor  The descriptor of the service
+ * @return              Zero on success, -1 on error
+ */
+int descriptor_apply_cgroup(const char* restrict name, const struct descriptor* restrict descriptor);
+
+/**
+ * Check whether a service requires another service
+ * 
+ * @param   descriptor  The descriptor of the service
+ * @param   name        The name of the other service
+ * @return              Whether the service requires the other service
+ */
+int descriptor_requires(const struct descriptor* restrict descriptor, const char* restrict name) __attribute__((pure));
+
+/**
+ * Check whether two descriptors of a service differ in what is
+ * applied when the service is spawned, so that the service must
+ * be restarted for the new descriptor to take effect
+ * 
+ * Memory limits are not included, they can be applied
+ * to the cgroup of a running service
+ * 
+ * @param   a  One of the descriptors
+ * @param   b  The other descriptor
+ * @return     Whether the service must be restarted
+ */
+int descriptor_spawn_differs(const struct descriptor* restrict a, const struct descriptor* restrict b) __attribute__((pure));
+
+/**
+ * Get the changes a service makes to its environment,
+ * as entries for `environtab_compose`
+ * 
+ * @param   descriptor  The descriptor of the service
+ * @param   entries     Output array, must have room for
+ *                      `DESCRIPTOR_MAX_ENVIRONMENT` elements,
+ *                      the elements point into `descriptor`
+ * @return              The number of elements stored in `entries`
+ */
+size_t descriptor_environment(struct descriptor* restrict descriptor, char** restrict entries);
+
+/**
+ * Get the command line that starts a service
+ * 
+ * @param   descriptor  The descriptor of the service
+ * @param   command     Output array, must have room for
+ *                      `DESCRIPTOR_MAX_EXEC + 1` elements, the
+ *                      elements point into `descriptor`, and
+ *                      the list is `NULL`-terminated
+ * @return              The number of arguments, zero if the service
+ *                      is started by its daemon script
+ */
+size_t descriptor_command(struct descriptor* restrict descriptor, char** restrict command);
+
+/**
+ * Get the command line that checks the health of a service
+ * 
+ * @param   descriptor  The descriptor of the service
+ * @param   command     Output array, must have room for
+ *                      `DESCRIPTOR_MAX_EXEC + 1` elements, the
+ *                      elements point into `descriptor`, and
+ *                      the list is `NULL`-terminated
+ * @return              The number of arguments, zero if the health
+ *                      of the service is not checked by a command
+ */
+size_t descriptor_health_command(struct descriptor* restrict descriptor, char** restrict command);
+
+/**
+ * Map the compiled descriptor cache, so that descriptors
+ * that have not been modified are not parsed again
+ * 
+ * @return  Zero on success, -1 on error, a missing or
+ *          outdated cache is not an error
+ */
+int descriptor_cache_open(void);
+
+/**
+ * Write descriptors that have been parsed since the compiled
+ * descriptor cache was mapped to the cache, if any
+ * 
+ * @return  Zero on success, -1 on error
+ */
+int descriptor_cache_save(void);
+
+
+#endif
+
@@ -0,0 +1,326 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "config.h"
+#include "environtab.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+
+
+/**
+ * The environment of the process
+ */
+extern char** environ;
+
+/**
+ * The environtab used if there is no environtab file
+ */
+static const char default_environtab[] = "PATH\n";
+
+
+
+/**
+ * Get the length of the name of an environment variable
+ * 
+ * @param   entry  The environment variable, `NAME=VALUE` or `NAME`
+ * @return         The length of the name
+ */
+static __attribute__((pure)) size_t name_length(const char* restrict entry)
+{
+  return strcspn(entry, "=");
+}
+
+
+/**
+ * Find an environment variable in an environment
+ * 
+ * @param   envp  `NULL`-terminated list of environment variables
+ * @param   name  The name of the environment variable, not necessarily NUL-terminated
+ * @param   len   The length of `name`
+ * @return        The index of the environment variable, the
+ *                index of the terminating `NULL` if not found
+ */
+static __attribute__((pure)) size_t find_entry(char* const* restrict envp, const char* restrict name, size_t len)
+{
+  size_t i;
+  for (i = 0; envp[i] != NULL; i++)
+    if (!strncmp(envp[i], name, len) && (envp[i][len] == '='))
+      break;
+  return i;
+}
+
+
+/**
+ * Read a file into a buffer
+ * 
+ * @param   fd    The file descriptor of the file
+ * @param   buf   The buffer
+ * @param   size  The size of the buffer
+ * @return        The number of read bytes, -1 on error
+ */
+static ssize_t read_fully(int fd, char* restrict buf, size_t size)
+{
+  size_t ptr = 0;
+  ssize_t got;
+  while (ptr < size)
+    {
+      if (got = read(fd, buf + ptr, size - ptr), got < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return -1;
+	}
+      if (got == 0)
+	break;
+      ptr += (size_t)got;
+    }
+  return (ssize_t)ptr;
+}
+
+
+/**
+ * Compile an environtab into an environment
+ * 
+ * Lines on the format `NAME=VALUE` set `NAME` to `VALUE`, lines
+ * on the format `NAME` keep `NAME` from the environment of the
+ * calling process, and later lines override earlier lines.
+ * If the file does not exist, only `PATH` is kept.
+ * 
+ * @param   pathname  The pathname of the environtab
+ * @param   tab       Output parameter for the compiled environtab
+ * @return            Zero on success, -1 on error
+ */
+int environtab_compile(const char* restrict pathname, struct environtab* restrict tab)
+{
+  char* const empty[] = { NULL };
+  char* const* inherit = environ == NULL ? empty : environ;
+  size_t i, j, n = 0, len, cap, size, inherit_size = 0;
+  char** envp = NULL;
+  char* text;
+  char* tail;
+  char* line;
+  char* end;
+  struct stat attr;
+  ssize_t got;
+  int fd, saved_errno;
+  
+  memset(tab, 0, sizeof(*tab));
+  
+  if (fd = open(pathname, O_RDONLY | O_CLOEXEC), fd >= 0)
+    {
+      if (fstat(fd, &attr) < 0)
+	goto fail;
+      tab->exists = 1;
+      tab->inode = attr.st_ino;
+      tab->size = attr.st_size;
+      tab->mtime = attr.st_mtim;
+      size = (size_t)(attr.st_size);
+    }
+  else if (errno == ENOENT)
+    size = sizeof(default_environtab) / sizeof(char) - 1;
+  else
+    return -1;
+  
+  /* Everything goes into one allocation: the pointer array, the
+     file's text, and copies of inherited variables. Each inherited
+     variable is copied at most once, and each line is at least two
+     bytes, except possibly the last, which bounds the array. */
+  for (i = 0; inherit[i] != NULL; i++)
+    inherit_size += strlen(inherit[i]) + 1;
+  cap = size / 2 + 2;
+  envp = malloc(cap * sizeof(char*) + (size + 1 + inherit_size) * sizeof(char));
+  if (envp == NULL)
+    goto fail;
+  text = (char*)(envp + cap);
+  
+  if (fd < 0)
+    memcpy(text, default_environtab, size * sizeof(char));
+  else
+    {
+      if (got = read_fully(fd, text, size), got < 0)
+	goto fail;
+      size = (size_t)got;
+      close(fd), fd = -1;
+    }
+  text[size] = '\0';
+  tail = text + size + 1;
+  envp[0] = NULL;
+  
+  /* Parse the file in place, in a single pass. */
+  for (line = text; line < text + size; line = end + 1)
+    {
+      end = memchr(line, '\n', (size_t)(text + size - line));
+      if (end == NULL)
+	end = text + size;
+      *end = '\0';
+      if (len = name_length(line), len == 0)
+	continue;
+      
+      i = find_entry(envp, line, len);
+      if (line[len] == '=')
+	envp[i] = line;
+      else if ((i < n) && (envp[i] >= text + size + 1))
+	continue; /* Already inherited. */
+      else if (j = find_entry(inherit, line, len), inherit[j] != NULL)
+	{
+	  envp[i] = strcpy(tail, inherit[j]);
+	  tail += strlen(tail) + 1;
+	}
+      else
+	{
+	  /* Not inherited, so an earlier assignment is overridden by its absence. */
+	  if (i < n)
+	    memmove(envp + i, envp + i + 1, (n-- - i) * sizeof(char*));
+	  continue;
+	}
+      if (i == n)
+	envp[++n] = NULL;
+    }
+  
+  tab->envp = envp;
+  tab->count = n;
+  return 0;
+  
+ fail:
+  saved_errno = errno;
+  if (fd >= 0)
+    close(fd);
+  free(envp);
+  memset(tab, 0, sizeof(*tab));
+  return errno = saved_errno, -1;
+}
+
+
+/**
+ * Recompile an environtab if the file has been modified
+ * since it was compiled, or if it has not been compiled
+ * 
+ * @param   pathname  The pathname of the environtab
+ * @param   tab       The compiled environtab, it is left
+ *                    unmodified on error
+ * @return            Zero on success, -1 on error
+ */
+int environtab_refresh(const char* restrict pathname, struct environtab* restrict tab)
+{
+  struct environtab new_tab;
+  struct stat attr;
+  
+  if (tab->envp != NULL)
+    {
+      if (stat(pathname, &attr) < 0)
+	{
+	  if (errno != ENOENT)
+	    return -1;
+	  if (!(tab->exists))
+	    return 0;
+	}
+      else if (tab->exists &&
+	       (tab->inode == attr.st_ino) &&
+	       (tab->size == attr.st_size) &&
+	       (tab->mtime.tv_sec == attr.st_mtim.tv_sec) &&
+	       (tab->mtime.tv_nsec == attr.st_mtim.tv_nsec))
+	return 0;
+    }
+  
+  if (environtab_compile(pathname, &new_tab) < 0)
+    return -1;
+  environtab_destroy(tab);
+  *tab = new_tab;
+  return 0;
+}
+
+
+/**
+ * Release the resources of a compiled environtab
+ * 
+ * @param  tab  The compiled environtab
+ */
+void environtab_destroy(struct environtab* restrict tab)
+{
+  free(tab->envp);
+  tab->envp = NULL;
+  tab->count = 0;
+}
+
+
+/**
+ * Look up an environment variable in an environment
+ * 
+ * @param   envp  `NULL`-terminated list of environment variables
+ * @param   name  The name of the environment variable
+ * @return        The value of the environment variable, `NULL` if not set
+ */
+char* environtab_lookup(char* const* restrict envp, const char* restrict name)
+{
+  size_t len = strlen(name);
+  size_t i = find_entry(envp, name, len);
+  return envp[i] == NULL ? NULL : envp[i] + len + 1;
+}
+
+
+/**
+ * Build an environment from a base environment and entries that
+ * are added to it, replacing the entries in the base environment
+ * that have the same names, without copying any strings
+ * 
+ * An entry on the format `NAME`, without a value, removes the
+ * variable, and later entries override earlier entries
+ * 
+ * @param   out      Output array, must have room for the
+ *                   elements in `base` and `entries`, and
+ *                   a terminating `NULL`
+ * @param   base     `NULL`-terminated list of environment variables
+ * @param   entries  Environment variables to add
+ * @param   n        The number of elements in `entries`
+ * @return           The number of elements stored in `out`,
+ *                   excluding the terminating `NULL`
+ */
+size_t environtab_compose(char** restrict out, char* const* restrict base, char* const* restrict entries, size_t n)
+{
+  size_t i, j, k, len, count = 0;
+  
+  for (i = 0; base[i] != NULL; i++)
+    {
+      len = name_length(base[i]);
+      for (j = 0; j < n; j++)
+	if (!strncmp(base[i], entries[j], len) && ((entries[j][len] == '=') || (entries[j][len] == '\0')))
+	  break;
+      if (j == n)
+	out[count++] = base[i];
+    }
+  for (j = 0; j < n; j++)
+    {
+      len = name_length(entries[j]);
+      if (entries[j][len] == '\0')
+	continue;
+      for (k = j + 1; k < n; k++)
+	if (!strncmp(entries[j], entries[k], len) && ((entries[k][len] == '=') || (entries[k][len] == '\0')))
+	  break;
+      if (k == n)
+	out[count++] = entries[j];
+    }
+  out[count] = NULL;
+  
+  return count;
+}
+
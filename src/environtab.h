@@ -0,0 +1,132 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef DAEMOND_ENVIRONTAB_H
+#define DAEMOND_ENVIRONTAB_H
+
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+
+
+/**
+ * A compiled environtab
+ */
+struct environtab
+{
+  /**
+   * `NULL`-terminated list of environment variables, in
+   * the format of `environ`, the array and the strings
+   * are stored in the same allocation, `NULL` if the
+   * environtab has not been compiled
+   */
+  char** envp;
+  
+  /**
+   * The number of elements in `envp`,
+   * excluding the terminating `NULL`
+   */
+  size_t count;
+  
+  /**
+   * Whether the environtab file existed when it was compiled
+   */
+  int exists;
+  
+  /**
+   * The inode number of the environtab file when it was compiled
+   */
+  ino_t inode;
+  
+  /**
+   * The size of the environtab file when it was compiled
+   */
+  off_t size;
+  
+  /**
+   * The modification time of the environtab file when it was compiled
+   */
+  struct timespec mtime;
+};
+
+
+
+/**
+ * Compile an environtab into an environment
+ * 
+ * Lines on the format `NAME=VALUE` set `NAME` to `VALUE`, lines
+ * on the format `NAME` keep `NAME` from the environment of the
+ * calling process, and later lines override earlier lines.
+ * If the file does not exist, only `PATH` is kept.
+ * 
+ * @param   pathname  The pathname of the environtab
+ * @param   tab       Output parameter for the compiled environtab
+ * @return            Zero on success, -1 on error
+ */
+int environtab_compile(const char* restrict pathname, struct environtab* restrict tab);
+
+/**
+ * Recompile an environtab if the file has been modified
+ * since it was compiled, or if it has not been compiled
+ * 
+ * @param   pathname  The pathname of the environtab
+ * @param   tab       The compiled environtab, it is left
+ *                    unmodified on error
+ * @return            Zero on success, -1 on error
+ */
+int environtab_refresh(const char* restrict pathname, struct environtab* restrict tab);
+
+/**
+ * Release the resources of a compiled environtab
+ * 
+ * @param  tab  The compiled environtab
+ */
+void environtab_destroy(struct environtab* restrict tab);
+
+/**
+ * Look up an environment variable in an environment
+ * 
+ * @param   envp  `NULL`-terminated list of environment variables
+ * @param   name  The name of the environment variable
+ * @return        The value of the environment variable, `NULL` if not set
+ */
+char* environtab_lookup(char* const* restrict envp, const char* restrict name) __attribute__((pure));
+
+/**
+ * Build an environment from a base environment and entries that
+ * are added to it, replacing the entries in the base environment
+ * that have the same names, without copying any strings
+ * 
+ * An entry on the format `NAME`, without a value, removes the
+ * variable, and later entries override earlier entries
+ * 
+ * @param   out      Output array, must have room for the
+ *                   elements in `base` and `entries`, and
+ *                   a terminating `NULL`
+ * @param   base     `NULL`-terminated list of environment variables
+ * @param   entries  Environment variables to add
+ * @param   n        The number of elements in `entries`
+ * @return           The number of elements stored in `out`,
+ *                   excluding the terminating `NULL`
+ */
+size_t environtab_compose(char** restrict out, char* const* restrict base, char* const* restrict entries, size_t n);
+
+
+#endif
+
@@ -0,0 +1,582 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "config.h"
+#include "event.h"
+#include "timer.h"
+#include "slab.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/msg.h>
+
+
+
+/**
+ * The number of nanoseconds to wait before trying again
+ * when the message queue has no room for more state changes
+ */
+#define EVENT_RETRY  (NANOSECONDS / 10)
+
+/**
+ * The number of state change types
+ */
+#define EVENT_TYPE_COUNT  (EVENT_BACKOFF + 1)
+
+
+
+/**
+ * A state change that has not been sent
+ */
+struct event
+{
+  /**
+   * The service
+   */
+  const struct service* service;
+  
+  /**
+   * The state change
+   */
+  enum event_type type;
+  
+  /**
+   * The value that accompanies the state change
+   */
+  long long value;
+};
+
+
+/**
+ * A process that has subscribed to state changes
+ */
+struct event_subscriber
+{
+  /**
+   * The PID of the subscriber, and the
+   * type of the messages sent to it
+   */
+  pid_t pid;
+  
+  /**
+   * Whether the subscriber has unsubscribed, and
+   * shall be removed at the next flush
+   */
+  int unsubscribed;
+  
+  /**
+   * The state changes the subscriber wants,
+   * a bit, `1 << type`, per `enum event_type`
+   */
+  unsigned types;
+  
+  /**
+   * `NULL`-terminated list of the services the subscriber
+   * wants the state changes of, empty for all services,
+   * the names are in the same allocation
+   */
+  char** names;
+  
+  /**
+   * Ring buffer of state changes that have not been sent
+   */
+  struct event events[EVENT_BUFFER_SIZE];
+  
+  /**
+   * The index of the oldest element in `events`
+   */
+  size_t head;
+  
+  /**
+   * The number of elements in `events`
+   */
+  size_t count;
+  
+  /**
+   * The number of state changes that have been dropped since
+   * the subscriber was last told that state changes were dropped
+   */
+  unsigned long long dropped;
+};
+
+
+/**
+ * A message to a subscriber
+ */
+struct event_message
+{
+  /**
+   * The PID of the subscriber
+   */
+  long mtype;
+  
+  /**
+   * The state change, formatted like a control request
+   */
+  char mtext[];
+};
+
+
+
+/**
+ * Command line arguments
+ */
+extern char** argv;
+
+/**
+ * The subscribers
+ */
+static struct event_subscriber** subscribers = NULL;
+
+/**
+ * The number of elements in `subscribers`
+ */
+static size_t subscriber_count = 0;
+
+/**
+ * The number of elements `subscribers` has room for
+ */
+static size_t subscribers_size = 0;
+
+/**
+ * The memory for the subscribers
+ */
+static struct slab subscriber_slab = SLAB_INITIALISER(struct event_subscriber, EVENT_SUBSCRIBER_CHUNK);
+
+/**
+ * The subscriber that is sent to first at the next flush
+ */
+static size_t next_subscriber = 0;
+
+/**
+ * Buffer for messages to subscribers
+ */
+static struct event_message* message = NULL;
+
+/**
+ * The size of `message->mtext`
+ */
+static size_t message_size = 0;
+
+/**
+ * The names of the state change types
+ */
+static const char* const type_names[EVENT_TYPE_COUNT] =
+  {
+    [EVENT_STARTED]    = "started",
+    [EVENT_READY]      = "ready",
+    [EVENT_EXITED]     = "exited",
+    [EVENT_RESTARTING] = "restarting",
+    [EVENT_BACKOFF]    = "backoff"
+  };
+
+
+
+/**
+ * Parse a comma-separated list of state change types
+ * 
+ * @param   list   The list
+ * @param   types  Output parameter for the types, a bit,
+ *                 `1 << type`, per `enum event_type`
+ * @return         Zero on success, -1 if the list is invalid
+ */
+static int parse_types(const char* restrict list, unsigned* restrict types)
+{
+  size_t i, n;
+  
+  for (*types = 0;; list += n + 1)
+    {
+      n = strcspn(list, ",");
+      for (i = 0; i < EVENT_TYPE_COUNT; i++)
+	if ((strlen(type_names[i]) == n) && !strncmp(list, type_names[i], n))
+	  break;
+      if (i == EVENT_TYPE_COUNT)
+	return -1;
+      *types |= 1U << i;
+      if (list[n] == '\0')
+	return 0;
+    }
+}
+
+
+/**
+ * Copy the names of the services a subscriber wants
+ * the state changes of, into a single allocation
+ * 
+ * @param   names  `NULL`-terminated list of names
+ * @return         The copy, `NULL` on error
+ */
+static char** copy_names(char** restrict names)
+{
+  size_t i, n = 0, size = 0;
+  char** copy;
+  char* text;
+  
+  for (; names[n] != NULL; n++)
+    size += strlen(names[n]) + 1;
+  
+  copy = malloc((n + 1) * sizeof(char*) + size * sizeof(char));
+  if (copy == NULL)
+    return NULL;
+  text = (char*)(copy + n + 1);
+  for (i = 0; i < n; i++)
+    {
+      copy[i] = strcpy(text, names[i]);
+      text += strlen(text) + 1;
+    }
+  copy[n] = NULL;
+  return copy;
+}
+
+
+/**
+ * Find a subscriber by its PID
+ * 
+ * @param   pid  The PID of the subscriber
+ * @return       The subscriber, `NULL` if not found
+ */
+static __attribute__((pure)) struct event_subscriber* event_find(pid_t pid)
+{
+  size_t i;
+  
+  for (i = 0; i < subscriber_count; i++)
+    if (subscribers[i]->pid == pid)
+      return subscribers[i];
+  return NULL;
+}
+
+
+/**
+ * Check whether a subscriber wants a state change,
+ * a template, NAME@, stands for all its instances
+ * 
+ * @param   subscriber  The subscriber
+ * @param   service     The service
+ * @param   type        The state change
+ * @return              Whether the subscriber wants the state change
+ */
+static __attribute__((pure)) int event_wanted(const struct event_subscriber* restrict subscriber,
+					     const struct service* restrict service, enum event_type type)
+{
+  char** names = subscriber->names;
+  size_t n;
+  
+  if (subscriber->unsubscribed || !(subscriber->types & (1U << type)))
+    return 0;
+  if (*names == NULL)
+    return 1;
+  
+  for (; *names != NULL; names++)
+    {
+      n = strlen(*names);
+      if ((n > 0) && ((*names)[n - 1] == '@'))
+	{
+	  if (!strncmp(service->name, *names, n) && service->name[n])
+	    return 1;
+	}
+      else if (!strcmp(service->name, *names))
+	return 1;
+    }
+  return 0;
+}
+
+
+/**
+ * Make room for a state change for a subscriber whose buffer is full,
+ * by dropping the oldest state change of the same service if there
+ * is one, so that the subscriber still learns the latest state of
+ * every service, and otherwise the oldest state change
+ * 
+ * @param  subscriber  The subscriber
+ * @param  service     The service of the new state change
+ */
+static void event_drop(struct event_subscriber* restrict subscriber, const struct service* restrict service)
+{
+  size_t i;
+  
+  for (i = 0; i < subscriber->count; i++)
+    if (subscriber->events[(subscriber->head + i) % EVENT_BUFFER_SIZE].service == service)
+      break;
+  if (i == subscriber->count)
+    i = 0;
+  
+  /* Move the older state changes up over the dropped one. */
+  for (; i > 0; i--)
+    subscriber->events[(subscriber->head + i) % EVENT_BUFFER_SIZE] =
+      subscriber->events[(subscriber->head + i - 1) % EVENT_BUFFER_SIZE];
+  subscriber->head = (subscriber->head + 1) % EVENT_BUFFER_SIZE;
+  subscriber->count--;
+  subscriber->dropped++;
+}
+
+
+/**
+ * Format the next message to a subscriber into `message`
+ * 
+ * @param   subscriber  The subscriber, must have a message to send
+ * @return              The length of the message, 0 on error
+ */
+static size_t event_format(const struct event_subscriber* restrict subscriber)
+{
+  const struct event* event = subscriber->events + subscriber->head;
+  size_t n = 3 * sizeof(long long) + 32;
+  long long value;
+  void* new;
+  
+  if (subscriber->count)
+    n += strlen(event->service->name);
+  
+  if (message_size < n)
+    {
+      new = realloc(message, sizeof(struct event_message) + n * sizeof(char));
+      if (new == NULL)
+	return 0;
+      message = new;
+      message_size = n;
+    }
+  message->mtype = (long)(subscriber->pid);
+  
+  /* The subscriber is told that it has missed state changes before it is sent any more. */
+  if (subscriber->dropped)
+    return (size_t)sprintf(message->mtext, "dropped%c%llu", '\0', subscriber->dropped) + 1;
+  
+  if (event->type == EVENT_STARTED)
+    return (size_t)sprintf(message->mtext, "%s%c%s", type_names[event->type], '\0', event->service->name) + 1;
+  value = event->value;
+  if (event->type == EVENT_BACKOFF)
+    value /= 1000000;
+  return (size_t)sprintf(message->mtext, "%s%c%s%c%lli", type_names[event->type], '\0',
+			 event->service->name, '\0', value) + 1;
+}
+
+
+/**
+ * Remove subscribers that have unsubscribed and, if requested,
+ * subscribers that have died, together with the messages to
+ * them that are still in the message queue
+ * 
+ * @param  mqueue_id  The ID of the server message queue
+ * @param  dead       Whether to remove subscribers that have died
+ */
+static void event_prune(int mqueue_id, int dead)
+{
+  struct { long mtype; char mtext[1]; } discard;
+  struct event_subscriber* subscriber;
+  size_t i = 0;
+  
+  while (i < subscriber_count)
+    {
+      subscriber = subscribers[i];
+      if (!subscriber->unsubscribed && (!dead || (kill(subscriber->pid, 0) == 0) || (errno != ESRCH)))
+	{
+	  i++;
+	  continue;
+	}
+      
+      /* No one would ever read them, and they take up room meant for requests. */
+      while (msgrcv(mqueue_id, &discard, sizeof(discard.mtext), (long)(subscriber->pid), IPC_NOWAIT | MSG_NOERROR) >= 0);
+      
+      free(subscriber->names);
+      slab_free(&subscriber_slab, subscriber);
+      subscribers[i] = subscribers[--subscriber_count];
+    }
+}
+
+
+/**
+ * Subscribe to, or unsubscribe from, the state changes of services
+ * 
+ * @param   arguments  `NULL`-terminated list of arguments, the verb,
+ *                     "subscribe" or "unsubscribe", first, then the PID
+ *                     of the subscriber, and for "subscribe", options
+ *                     and the names of the services
+ * @return             The return value for `main`, -1 if the caller should not return
+ */
+int event_request(char** restrict arguments)
+{
+  const char* verb = *arguments++;
+  struct event_subscriber* subscriber;
+  unsigned types = (1U << EVENT_TYPE_COUNT) - 1;
+  char** names;
+  char* end;
+  long pid;
+  void* new;
+  
+  if (*arguments == NULL)
+    return fprintf(stderr, "%s: invalid %s request\n", *argv, verb), -1;
+  /* The PID is the message type, and the lowest message types are used by daemond. */
+  errno = 0;
+  pid = strtol(*arguments, &end, 10);
+  if (errno || *end || (end == *arguments) || (pid <= REQUEST_WAKE_UP) || (pid > INT_MAX))
+    return fprintf(stderr, "%s: invalid %s request\n", *argv, verb), -1;
+  arguments++;
+  subscriber = event_find((pid_t)pid);
+  
+  if (!strcmp(verb, "unsubscribe"))
+    {
+      if (*arguments != NULL)
+	return fprintf(stderr, "%s: invalid %s request\n", *argv, verb), -1;
+      if (subscriber != NULL)
+	subscriber->unsubscribed = 1;
+      return -1;
+    }
+  
+  for (; *arguments && !strncmp(*arguments, "--events=", strlen("--events=")); arguments++)
+    if (parse_types(*arguments + strlen("--events="), &types) < 0)
+      return fprintf(stderr, "%s: invalid %s request\n", *argv, verb), -1;
+  if ((*arguments != NULL) && (**arguments == '-'))
+    return fprintf(stderr, "%s: invalid %s request\n", *argv, verb), -1;
+  if ((kill((pid_t)pid, 0) < 0) && (errno == ESRCH))
+    return fprintf(stderr, "%s: cannot subscribe %li, no such process\n", *argv, pid), -1;
+  
+  if (names = copy_names(arguments), names == NULL)
+    return perror(*argv), -1;
+  
+  /* A subscriber that subscribes again changes what it wants,
+     but keeps the state changes that have not been sent to it. */
+  if (subscriber == NULL)
+    {
+      if (subscriber_count == subscribers_size)
+	{
+	  new = realloc(subscribers, (subscribers_size + EVENT_SUBSCRIBER_CHUNK) * sizeof(struct event_subscriber*));
+	  if (new == NULL)
+	    return perror(*argv), free(names), -1;
+	  subscribers = new;
+	  subscribers_size += EVENT_SUBSCRIBER_CHUNK;
+	}
+      subscriber = slab_alloc(&subscriber_slab);
+      if (subscriber == NULL)
+	return perror(*argv), free(names), -1;
+      subscriber->pid = (pid_t)pid;
+      subscribers[subscriber_count++] = subscriber;
+    }
+  free(subscriber->names);
+  subscriber->names = names;
+  subscriber->types = types;
+  subscriber->unsubscribed = 0;
+  return -1;
+}
+
+
+/**
+ * Queue a state change for the subscribers that want it
+ * 
+ * @param  service  The service
+ * @param  type     The state change
+ * @param  value    The PID of the service for `EVENT_READY`, its
+ *                  status, as returned by `waitpid`, for `EVENT_EXITED`,
+ *                  the number of times it has been restarted for
+ *                  `EVENT_RESTARTING`, the backoff time in nanoseconds
+ *                  for `EVENT_BACKOFF`, ignored for `EVENT_STARTED`
+ */
+void event_emit(const struct service* restrict service, enum event_type type, long long value)
+{
+  struct event_subscriber* subscriber;
+  struct event* event;
+  size_t i;
+  
+  for (i = 0; i < subscriber_count; i++)
+    {
+      subscriber = subscribers[i];
+      if (!event_wanted(subscriber, service, type))
+	continue;
+      if (subscriber->count == EVENT_BUFFER_SIZE)
+	event_drop(subscriber, service);
+      event = subscriber->events + (subscriber->head + subscriber->count++) % EVENT_BUFFER_SIZE;
+      event->service = service;
+      event->type = type;
+      event->value = value;
+    }
+}
+
+
+/**
+ * Send queued state changes to the subscribers, without waiting
+ * for room in the message queue, and schedule a retry if not
+ * everything could be sent
+ * 
+ * At most half of the message queue is filled with state changes,
+ * the other half is left for control requests, and the subscribers
+ * take turns, so that a slow subscriber does not hold up the others
+ * 
+ * @param  now        The current time
+ * @param  mqueue_id  The ID of the server message queue
+ */
+void event_flush(const struct timespec* restrict now, int mqueue_id)
+{
+  struct event_subscriber* subscriber;
+  struct msqid_ds mqueue_info;
+  struct timespec retry;
+  size_t i, j, n, sent, budget;
+  
+  event_prune(mqueue_id, 0);
+  
+  for (i = 0; i < subscriber_count; i++)
+    if (subscribers[i]->count || subscribers[i]->dropped)
+      break;
+  if (i == subscriber_count)
+    return;
+  
+  if (msgctl(mqueue_id, IPC_STAT, &mqueue_info) < 0)
+    {
+      perror(*argv);
+      return;
+    }
+  budget = mqueue_info.msg_qbytes / 2;
+  budget = budget > mqueue_info.msg_cbytes ? budget - mqueue_info.msg_cbytes : 0;
+  
+  do
+    for (j = sent = 0; j < subscriber_count; j++)
+      {
+	i = (next_subscriber + j) % subscriber_count;
+	subscriber = subscribers[i];
+	if (!subscriber->count && !subscriber->dropped)
+	  continue;
+	if (n = event_format(subscriber), n == 0)
+	  {
+	    perror(*argv);
+	    return;
+	  }
+	if ((n > budget) || (msgsnd(mqueue_id, message, n, IPC_NOWAIT) < 0))
+	  {
+	    if ((n <= budget) && (errno != EAGAIN) && (errno != EINTR))
+	      perror(*argv);
+	    goto full;
+	  }
+	budget -= n, sent++;
+	if (subscriber->dropped)
+	  subscriber->dropped = 0;
+	else
+	  subscriber->head = (subscriber->head + 1) % EVENT_BUFFER_SIZE, subscriber->count--;
+      }
+  while (sent);
+  return;
+ 
+ full:
+  /* Start with the subscriber that was not sent to the next time. */
+  next_subscriber = i;
+  event_prune(mqueue_id, 1);
+  retry = *now;
+  timer_add(&retry, EVENT_RETRY);
+  timer_wakeup_at(&retry);
+}
+
@@ -0,0 +1,99 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef DAEMOND_EVENT_H
+#define DAEMOND_EVENT_H
+
+
+#include "service.h"
+
+#include <time.h>
+
+
+
+/**
+ * A state change of a service
+ */
+enum event_type
+  {
+    /**
+     * The service has been spawned
+     */
+    EVENT_STARTED,
+    
+    /**
+     * The service has signalled readiness
+     */
+    EVENT_READY,
+    
+    /**
+     * The service has died
+     */
+    EVENT_EXITED,
+    
+    /**
+     * The service died without being requested
+     * to stop, and will be restarted
+     */
+    EVENT_RESTARTING,
+    
+    /**
+     * The service died too fast, and will
+     * be restarted after a backoff
+     */
+    EVENT_BACKOFF
+  };
+
+
+
+/**
+ * Subscribe to, or unsubscribe from, the state changes of services
+ * 
+ * @param   arguments  `NULL`-terminated list of arguments, the verb,
+ *                     "subscribe" or "unsubscribe", first, then the PID
+ *                     of the subscriber, and for "subscribe", options
+ *                     and the names of the services
+ * @return             The return value for `main`, -1 if the caller should not return
+ */
+int event_request(char** restrict arguments);
+
+/**
+ * Queue a state change for the subscribers that want it
+ * 
+ * @param  service  The service
+ * @param  type     The state change
+ * @param  value    The PID of the service for `EVENT_READY`, its
+ *                  status, as returned by `waitpid`, for `EVENT_EXITED`,
+ *                  the number of times it has been restarted for
+ *                  `EVENT_RESTARTING`, the backoff time in nanoseconds
+ *                  for `EVENT_BACKOFF`, ignored for `EVENT_STARTED`
+ */
+void event_emit(const struct service* restrict service, enum event_type type, long long value);
+
+/**
+ * Send queued state changes to the subscribers, without waiting
+ * for room in the message queue, and schedule a retry if not
+ * everything could be sent
+ * 
+ * @param  now        The current time
+ * @param  mqueue_id  The ID of the server message queue
+ */
+void event_flush(const struct timespec* restrict now, int mqueue_id);
+
+
+#endif
+
@@ -0,0 +1,652 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include "config.h"
+#include "harness.h"
+#include "timer.h"
+
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/msg.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdint.h>
+#include <ftw.h>
+
+
+
+/**
+ * The number of times to look for processes in the
+ * workspace to kill, before giving up on them
+ */
+#define TEARDOWN_ATTEMPTS  100
+
+/**
+ * The number of nanoseconds between each look for
+ * processes in the workspace to kill
+ */
+#define TEARDOWN_INTERVAL  (10 * 1000000LL)
+
+/**
+ * The number of nanoseconds between each look at the message
+ * queue while waiting for daemond to receive a message
+ */
+#define DRAIN_POLL_INTERVAL  (10 * 1000LL)
+
+/**
+ * The number of nanoseconds between each look at
+ * daemond while waiting for it to re-execute
+ */
+#define REEXEC_POLL_INTERVAL  (1000 * 1000LL)
+
+
+
+/**
+ * Command line arguments
+ */
+extern char** argv;
+
+/**
+ * The absolute pathname of the workspace, `NULL` before it is created
+ */
+char* harness_workspace = NULL;
+
+/**
+ * The ID of daemond's message queue, -1 before it is known
+ */
+int harness_mqueue_id = -1;
+
+
+
+/**
+ * Get the current time in nanoseconds
+ * 
+ * @return  The current time on `CLOCK_MONOTONIC`
+ */
+long long harness_now(void)
+{
+  struct timespec now;
+  timer_now(&now);
+  return (long long)(now.tv_sec) * NANOSECONDS + (long long)(now.tv_nsec);
+}
+
+
+/**
+ * Sleep for a number of nanoseconds
+ * 
+ * @param  ns  The number of nanoseconds to sleep
+ */
+void harness_sleep(long long ns)
+{
+  struct timespec duration;
+  duration.tv_sec = (time_t)(ns / NANOSECONDS);
+  duration.tv_nsec = (long)(ns % NANOSECONDS);
+  while (nanosleep(&duration, &duration) < 0)
+    if (errno != EINTR)
+      break;
+}
+
+
+/**
+ * Write an entire buffer to a file descriptor
+ * 
+ * @param   fd   The file descriptor
+ * @param   buf  The buffer
+ * @param   n    The size of the buffer
+ * @return       Zero on success, -1 on error
+ */
+int harness_write(int fd, const void* restrict buf, size_t n)
+{
+  const char* p = buf;
+  ssize_t r;
+  while (n)
+    {
+      if (r = write(fd, p, n), r < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return -1;
+	}
+      p += r, n -= (size_t)r;
+    }
+  return 0;
+}
+
+
+/**
+ * Fill a buffer from a file descriptor
+ * 
+ * @param   fd   The file descriptor
+ * @param   buf  The buffer
+ * @param   n    The size of the buffer
+ * @return       Zero on success, -1 on error or premature end of file
+ */
+int harness_read(int fd, void* restrict buf, size_t n)
+{
+  char* p = buf;
+  ssize_t r;
+  while (n)
+    {
+      if (r = read(fd, p, n), r < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  return -1;
+	}
+      if (r == 0)
+	return errno = EPIPE, -1;
+      p += r, n -= (size_t)r;
+    }
+  return 0;
+}
+
+
+/**
+ * Parse a numerical command line option
+ * 
+ * @param   argument  The command line argument
+ * @param   option    The option, including the equals sign
+ * @param   value     Output parameter for the value
+ * @return            1 if the argument is the option, 0 if it is
+ *                    not, -1 if the value is invalid
+ */
+int harness_parse_option(const char* restrict argument, const char* restrict option, size_t* restrict value)
+{
+  size_t n = strlen(option);
+  char* end;
+  unsigned long long v;
+  
+  if (strncmp(argument, option, n))
+    return 0;
+  errno = 0;
+  v = strtoull(argument + n, &end, 10);
+  if (errno || *end || (end == argument + n) || (v > INT_MAX))
+    return -1;
+  *value = (size_t)v;
+  return 1;
+}
+
+
+/**
+ * Create the workspace, with the run directory, the configuration
+ * directory, and links to the binaries under test, and enter it
+ * 
+ * The harness itself, daemond-NAME, is linked into the workspace
+ * with the other binaries, so that the services can execute it,
+ * and RUNDIR/NAME is created for its own files
+ * 
+ * @param   bindir  The directory with the binaries under test
+ * @param   root    The directory to create the workspace in
+ * @param   name    The name of the harness
+ * @return          Zero on success, -1 on error
+ */
+int harness_prepare(const char* restrict bindir, const char* restrict root, const char* restrict name)
+{
+  char self[sizeof(PKGNAME "-") + strlen(name)];
+  const char* binaries[] = { "daemond", "daemond-resurrectd", "start-daemond", self };
+  char template[strlen(root) + sizeof("/" PKGNAME "-.XXXXXX") + strlen(name)];
+  char own[sizeof(RUNDIR "/") + strlen(name)];
+  char bindir_path[PATH_MAX], source[PATH_MAX], target[PATH_MAX + NAME_MAX];
+  size_t i;
+  
+  sprintf(self, PKGNAME "-%s", name);
+  sprintf(own, RUNDIR "/%s", name);
+  
+  if (realpath(bindir, bindir_path) == NULL)
+    return -1;
+  
+  sprintf(template, "%s/" PKGNAME "-%s.XXXXXX", root, name);
+  if (mkdtemp(template) == NULL)
+    return -1;
+  if (harness_workspace = realpath(template, NULL), harness_workspace == NULL)
+    return -1;
+  if (chdir(harness_workspace) < 0)
+    return -1;
+  
+  if (mkdir(RUNDIR, 0750) < 0)                       return -1;
+  if (mkdir(own, 0750) < 0)                          return -1;
+  if (mkdir(SYSCONFDIR, 0750) < 0)                   return -1;
+  if (mkdir(SYSCONFDIR "/" PKGNAME ".d", 0750) < 0)  return -1;
+  if (mkdir(DAEMONDIR, 0750) < 0)                    return -1;
+  
+  for (i = 0; i < sizeof(binaries) / sizeof(*binaries); i++)
+    {
+      snprintf(target, sizeof(target), "%s/%s", bindir_path, binaries[i]);
+      if (realpath(target, source) == NULL)
+	return -1;
+      if (symlink(source, binaries[i]) < 0)
+	return -1;
+    }
+  
+  return 0;
+}
+
+
+/**
+ * Start daemond in the workspace, logging to the file `log`
+ * in the workspace, and open its message queue
+ * 
+ * @return  Zero on success, -1 on error
+ */
+int harness_start_daemond(void)
+{
+  char buf[3 * sizeof(key_t) + 2];
+  int fd, status;
+  ssize_t got;
+  pid_t pid;
+  
+  if (pid = fork(), pid == -1)
+    return -1;
+  
+  if (pid == 0)
+    {
+      if (fd = open("log", O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0640), fd >= 0)
+	dup2(fd, STDERR_FILENO);
+      if (fd = open(DEV_NULL, O_RDWR | O_CLOEXEC), fd >= 0)
+	dup2(fd, STDIN_FILENO), dup2(fd, STDOUT_FILENO);
+      execl("./start-daemond", "start-daemond", NULL);
+      perror(*argv);
+      _exit(1);
+    }
+  
+  if (waitpid(pid, &status, 0) < 0)
+    return -1;
+  if (!WIFEXITED(status) || WEXITSTATUS(status))
+    return errno = 0, fprintf(stderr, "%s: start-daemond failed\n", *argv), -1;
+  
+  if (fd = open(RUNDIR "/" PKGNAME "/mqueue.key", O_RDONLY | O_CLOEXEC), fd < 0)
+    return -1;
+  got = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (got <= 0)
+    return errno = 0, fprintf(stderr, "%s: could not read the message queue key\n", *argv), -1;
+  buf[got] = '\0';
+  
+  if (harness_mqueue_id = msgget((key_t)strtoll(buf, NULL, 10), 0), harness_mqueue_id < 0)
+    return -1;
+  return 0;
+}
+
+
+/**
+ * Send a control request to daemond
+ * 
+ * @param   verb  The verb of the request
+ * @param   name  The name of the daemon
+ * @return        Zero on success, -1 on error
+ */
+int harness_send(const char* restrict verb, const char* restrict name)
+{
+  struct
+  {
+    long mtype;
+    char mtext[64 + NAME_MAX];
+  } message;
+  size_t verb_size = strlen(verb) + 1;
+  size_t name_size = strlen(name) + 1;
+  
+  if (verb_size + name_size > sizeof(message.mtext))
+    return errno = ENAMETOOLONG, -1;
+  message.mtype = 1;
+  memcpy(message.mtext, verb, verb_size);
+  memcpy(message.mtext + verb_size, name, name_size);
+  
+  while (msgsnd(harness_mqueue_id, &message, verb_size + name_size, 0) < 0)
+    if (errno != EINTR)
+      return -1;
+  return 0;
+}
+
+
+/**
+ * Wait until daemond has received every message in its queue
+ * 
+ * @param   lrpid    The process that must not be the last one
+ *                   to have received a message, 0 if any may be
+ * @param   timeout  The number of nanoseconds to wait at most
+ * @return           Zero on success, -1 on error
+ */
+int harness_await_drain(pid_t lrpid, long long timeout)
+{
+  struct msqid_ds info;
+  long long deadline = harness_now() + timeout;
+  
+  for (;;)
+    {
+      if (msgctl(harness_mqueue_id, IPC_STAT, &info) < 0)
+	return -1;
+      if ((info.msg_qnum == 0) && (info.msg_lrpid != lrpid))
+	return 0;
+      if (harness_now() > deadline)
+	return errno = 0, fprintf(stderr, "%s: daemond did not receive its messages in time\n", *argv), -1;
+      harness_sleep(DRAIN_POLL_INTERVAL);
+    }
+}
+
+
+/**
+ * Check whether a process is running in the workspace
+ * 
+ * @param   pid  The process ID, as a string
+ * @return       Whether the working directory of the process is the workspace
+ */
+static int in_workspace(const char* pid)
+{
+  char pathname[sizeof("/proc//cwd") + NAME_MAX];
+  char buf[PATH_MAX];
+  ssize_t got;
+  
+  sprintf(pathname, "/proc/%s/cwd", pid);
+  if (got = readlink(pathname, buf, sizeof(buf) - 1), got < 0)
+    return 0;
+  buf[got] = '\0';
+  return !strcmp(buf, harness_workspace);
+}
+
+
+/**
+ * Read the name of a process
+ * 
+ * @param   pid   The process ID, as a string
+ * @param   buf   Output buffer for the name, as in /proc/PID/comm
+ * @param   size  The size of `buf`
+ * @return        Zero on success, -1 on error
+ */
+static int process_name(const char* pid, char* buf, size_t size)
+{
+  char pathname[sizeof("/proc//comm") + NAME_MAX];
+  ssize_t got;
+  int fd;
+  
+  sprintf(pathname, "/proc/%s/comm", pid);
+  if (fd = open(pathname, O_RDONLY | O_CLOEXEC), fd < 0)
+    return -1;
+  got = read(fd, buf, size - 1);
+  close(fd);
+  if (got <= 0)
+    return -1;
+  buf[got - 1] = '\0';
+  return 0;
+}
+
+
+/**
+ * Read the parent process ID of a process
+ * 
+ * @param   pid   The process ID, as a string
+ * @param   buf   Output buffer for the parent process ID, as a string
+ * @param   size  The size of `buf`
+ * @return        Zero on success, -1 on error
+ */
+static int process_parent(const char* pid, char* buf, size_t size)
+{
+  char pathname[sizeof("/proc//stat") + NAME_MAX];
+  char stat[512];
+  char* p;
+  ssize_t got;
+  int fd;
+  
+  sprintf(pathname, "/proc/%s/stat", pid);
+  if (fd = open(pathname, O_RDONLY | O_CLOEXEC), fd < 0)
+    return -1;
+  got = read(fd, stat, sizeof(stat) - 1);
+  close(fd);
+  if (got <= 0)
+    return -1;
+  stat[got] = '\0';
+  
+  /* The name may contain anything, but it is followed by the last ')'. */
+  if (p = strrchr(stat, ')'), (p == NULL) || (p[1] != ' ') || (p[2] == '\0') || (p[3] != ' '))
+    return -1;
+  p += 4;
+  snprintf(buf, size, "%.*s", (int)strcspn(p, " "), p);
+  return 0;
+}
+
+
+/**
+ * Find a process, in the workspace, by its name
+ * 
+ * Processes whose parent has the same name are skipped,
+ * they have been forked but have not executed yet
+ * 
+ * @param   name  The name of the process, as in /proc/PID/comm
+ * @return        The process ID, 0 if not found, -1 on error
+ */
+pid_t harness_find_process(const char* restrict name)
+{
+  char buf[32];
+  char ppid[3 * sizeof(pid_t) + 2];
+  struct dirent* entry;
+  pid_t found = 0;
+  DIR* dir;
+  
+  if (dir = opendir("/proc"), dir == NULL)
+    return -1;
+  
+  while (errno = 0, entry = readdir(dir), (entry != NULL) && (found == 0))
+    {
+      if ((*(entry->d_name) == '\0') || !strchr("123456789", *(entry->d_name)))
+	continue;
+      
+      /* The name in /proc/PID/comm is truncated to 15 bytes. */
+      if (process_name(entry->d_name, buf, sizeof(buf)) || strncmp(buf, name, 15))
+	continue;
+      if (!in_workspace(entry->d_name) || process_parent(entry->d_name, ppid, sizeof(ppid)))
+	continue;
+      if (!process_name(ppid, buf, sizeof(buf)) && !strncmp(buf, name, 15))
+	continue;
+      found = (pid_t)atoll(entry->d_name);
+    }
+  
+  closedir(dir);
+  return ((found == 0) && errno) ? -1 : found;
+}
+
+
+/**
+ * Check whether daemond has re-executed itself
+ * 
+ * @param   pid  The process ID of daemond
+ * @return       1 if it has, 0 if it has not, -1 on error
+ */
+static int has_reexeced(pid_t pid)
+{
+  char pathname[sizeof("/proc//cmdline") + 3 * sizeof(pid_t)];
+  char buf[256];
+  ssize_t got, i;
+  int fd;
+  
+  sprintf(pathname, "/proc/%ji/cmdline", (intmax_t)pid);
+  if (fd = open(pathname, O_RDONLY | O_CLOEXEC), fd < 0)
+    return -1;
+  got = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (got < 0)
+    return -1;
+  buf[got] = '\0';
+  
+  for (i = 0; i < got; i += (ssize_t)strlen(buf + i) + 1)
+    if (!strcmp(buf + i, "--reexecing"))
+      return 1;
+  return 0;
+}
+
+
+/**
+ * Make daemond re-execute itself, and wait until it has
+ * 
+ * A daemond built with -fprofile-generate writes its profile
+ * when it re-executes, but not when it is killed, so this
+ * is done before the workspace is torn down
+ * 
+ * @param   timeout  The number of nanoseconds to wait at most
+ * @return           Zero on success, -1 on error
+ */
+int harness_reexec_daemond(long long timeout)
+{
+  long long deadline = harness_now() + timeout;
+  pid_t pid;
+  int r;
+  
+  if (pid = harness_find_process("daemond"), pid <= 0)
+    return errno = 0, fprintf(stderr, "%s: daemond is not running\n", *argv), -1;
+  if (kill(pid, SIGUSR1) < 0)
+    return -1;
+  
+  while (r = has_reexeced(pid), r == 0)
+    {
+      if (harness_now() > deadline)
+	return errno = 0, fprintf(stderr, "%s: daemond did not re-execute in time\n", *argv), -1;
+      harness_sleep(REEXEC_POLL_INTERVAL);
+    }
+  return r;
+}
+
+
+/**
+ * Compare two samples, for `qsort`
+ * 
+ * @param   a  One of the samples
+ * @param   b  The other sample
+ * @return     Negative if `a` is smaller, positive if
+ *             `b` is smaller, zero if they are equal
+ */
+static int compare_samples(const void* a, const void* b)
+{
+  long long x = *(const long long*)a;
+  long long y = *(const long long*)b;
+  return x < y ? -1 : x > y;
+}
+
+
+/**
+ * Print statistics about samples as the members of a JSON object
+ * 
+ * @param  samples  The samples, will be sorted
+ * @param  n        The number of samples
+ */
+void harness_print_statistics(long long* restrict samples, size_t n)
+{
+  long long sum = 0;
+  size_t i;
+  
+  printf("\"samples\": %zu", n);
+  if (n == 0)
+    return;
+  
+  qsort(samples, n, sizeof(*samples), compare_samples);
+  for (i = 0; i < n; i++)
+    sum += samples[i];
+  
+  printf(", \"min\": %lli, \"mean\": %lli", samples[0], sum / (long long)n);
+  printf(", \"p50\": %lli", samples[(n - 1) * 50 / 100]);
+  printf(", \"p90\": %lli", samples[(n - 1) * 90 / 100]);
+  printf(", \"p99\": %lli", samples[(n - 1) * 99 / 100]);
+  printf(", \"max\": %lli", samples[n - 1]);
+}
+
+
+/**
+ * Kill every process, but ourself, in the workspace
+ * 
+ * @return  The number of processes that were killed, -1 on error
+ */
+static int kill_workspace(void)
+{
+  struct dirent* entry;
+  pid_t self = getpid(), pid;
+  int killed = 0;
+  DIR* dir;
+  
+  if (dir = opendir("/proc"), dir == NULL)
+    return -1;
+  
+  while (errno = 0, entry = readdir(dir), entry != NULL)
+    {
+      if ((*(entry->d_name) == '\0') || !strchr("123456789", *(entry->d_name)))
+	continue;
+      if (pid = (pid_t)atoll(entry->d_name), pid == self)
+	continue;
+      if (in_workspace(entry->d_name) && (kill(pid, SIGKILL) == 0))
+	killed++;
+    }
+  
+  closedir(dir);
+  return errno ? -1 : killed;
+}
+
+
+/**
+ * Remove a file or directory, for `nftw`
+ * 
+ * @param   pathname  The pathname of the file
+ * @param   st        Unused
+ * @param   type      Unused
+ * @param   ftw       Unused
+ * @return            Zero on success, -1 on error
+ */
+static int remove_file(const char* pathname, const struct stat* st, int type, struct FTW* ftw)
+{
+  (void) st, (void) type, (void) ftw;
+  return remove(pathname);
+}
+
+
+/**
+ * Kill daemond, its resurrector and everything else running in
+ * the workspace, remove the message queue and, unless kept,
+ * the workspace
+ * 
+ * @param  keep  Whether to keep the workspace
+ */
+void harness_teardown(int keep)
+{
+  pid_t resurrectd;
+  int i;
+  
+  if (harness_workspace == NULL)
+    return;
+  
+  /* Stop the resurrector first, so it does not bring back daemond,
+     then keep killing until nothing is left to respawn anything. */
+  if (resurrectd = harness_find_process("daemond-resurrectd"), resurrectd > 0)
+    kill(resurrectd, SIGSTOP);
+  for (i = 0; i < TEARDOWN_ATTEMPTS; i++)
+    {
+      if (kill_workspace() <= 0)
+	break;
+      harness_sleep(TEARDOWN_INTERVAL);
+    }
+  
+  if (harness_mqueue_id >= 0)
+    msgctl(harness_mqueue_id, IPC_RMID, NULL);
+  
+  if (keep)
+    fprintf(stderr, "%s: keeping %s\n", *argv, harness_workspace);
+  else if (chdir("/") == 0)
+    nftw(harness_workspace, remove_file, 16, FTW_DEPTH | FTW_PHYS);
+}
+
@@ -0,0 +1,162 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef DAEMOND_HARNESS_H
+#define DAEMOND_HARNESS_H
+
+
+#include <stddef.h>
+#include <sys/types.h>
+
+
+
+/**
+ * The absolute pathname of the workspace, `NULL` before it is created
+ */
+extern char* harness_workspace;
+
+/**
+ * The ID of daemond's message queue, -1 before it is known
+ */
+extern int harness_mqueue_id;
+
+
+
+/**
+ * Get the current time in nanoseconds
+ * 
+ * @return  The current time on `CLOCK_MONOTONIC`
+ */
+long long harness_now(void);
+
+/**
+ * Sleep for a number of nanoseconds
+ * 
+ * @param  ns  The number of nanoseconds to sleep
+ */
+void harness_sleep(long long ns);
+
+/**
+ * Write an entire buffer to a file descriptor
+ * 
+ * @param   fd   The file descriptor
+ * @param   buf  The buffer
+ * @param   n    The size of the buffer
+ * @return       Zero on success, -1 on error
+ */
+int harness_write(int fd, const void* restrict buf, size_t n);
+
+/**
+ * Fill a buffer from a file descriptor
+ * 
+ * @param   fd   The file descriptor
+ * @param   buf  The buffer
+ * @param   n    The size of the buffer
+ * @return       Zero on success, -1 on error or premature end of file
+ */
+int harness_read(int fd, void* restrict buf, size_t n);
+
+/**
+ * Parse a numerical command line option
+ * 
+ * @param   argument  The command line argument
+ * @param   option    The option, including the equals sign
+ * @param   value     Output parameter for the value
+ * @return            1 if the argument is the option, 0 if it is
+ *                    not, -1 if the value is invalid
+ */
+int harness_parse_option(const char* restrict argument, const char* restrict option, size_t* restrict value);
+
+/**
+ * Create the workspace, with the run directory, the configuration
+ * directory, and links to the binaries under test, and enter it
+ * 
+ * The harness itself, daemond-NAME, is linked into the workspace
+ * with the other binaries, so that the services can execute it,
+ * and RUNDIR/NAME is created for its own files
+ * 
+ * @param   bindir  The directory with the binaries under test
+ * @param   root    The directory to create the workspace in
+ * @param   name    The name of the harness
+ * @return          Zero on success, -1 on error
+ */
+int harness_prepare(const char* restrict bindir, const char* restrict root, const char* restrict name);
+
+/**
+ * Start daemond in the workspace, logging to the file `log`
+ * in the workspace, and open its message queue
+ * 
+ * @return  Zero on success, -1 on error
+ */
+int harness_start_daemond(void);
+
+/**
+ * Send a control request to daemond
+ * 
+ * @param   verb  The verb of the request
+ * @param   name  The name of the daemon
+ * @return        Zero on success, -1 on error
+ */
+int harness_send(const char* restrict verb, const char* restrict name);
+
+/**
+ * Wait until daemond has received every message in its queue
+ * 
+ * @param   lrpid    The process that must not be the last one
+ *                   to have received a message, 0 if any may be
+ * @param   timeout  The number of nanoseconds to wait at most
+ * @return           Zero on success, -1 on error
+ */
+int harness_await_drain(pid_t lrpid, long long timeout);
+
+/**
+ * Find a process, in the workspace, by its name
+ * 
+ * @param   name  The name of the process, as in /proc/PID/comm
+ * @return        The process ID, 0 if not found, -1 on error
+ */
+pid_t harness_find_process(const char* restrict name);
+
+/**
+ * Make daemond re-execute itself, and wait until it has, so
+ * that a daemond built with -fprofile-generate writes its profile
+ * 
+ * @param   timeout  The number of nanoseconds to wait at most
+ * @return           Zero on success, -1 on error
+ */
+int harness_reexec_daemond(long long timeout);
+
+/**
+ * Print statistics about samples as the members of a JSON object
+ * 
+ * @param  samples  The samples, will be sorted
+ * @param  n        The number of samples
+ */
+void harness_print_statistics(long long* restrict samples, size_t n);
+
+/**
+ * Kill daemond, its resurrector and everything else running in
+ * the workspace, remove the message queue and, unless kept,
+ * the workspace
+ * 
+ * @param  keep  Whether to keep the workspace
+ */
+void harness_teardown(int keep);
+
+
+#endif
+
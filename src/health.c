@@ -0,0 +1,421 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "config.h"
+#include "health.h"
+#include "service.h"
+#include "timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+
+
+/**
+ * The default number of seconds between health checks
+ */
+#define HEALTH_INTERVAL  10
+
+/**
+ * The default number of seconds a health check may take
+ */
+#define HEALTH_TIMEOUT  5
+
+/**
+ * The default number of health checks in a row
+ * a service may fail before it is restarted
+ */
+#define HEALTH_RETRIES  3
+
+/**
+ * How much, in percent, the time between two health
+ * checks of a service may differ from the interval
+ */
+#define HEALTH_JITTER  10
+
+/**
+ * The length of the beginning of an HTTP response
+ * that is needed to read the status code,
+ * "HTTP/x.y NNN"
+ */
+#define HTTP_STATUS_END  12
+
+
+
+/**
+ * Command line arguments
+ */
+extern char** argv;
+
+/**
+ * The state of the pseudorandom number generator
+ * used for jitter, zero if not seeded
+ */
+static unsigned long long jitter_state = 0;
+
+
+
+/**
+ * Get a pseudorandom number
+ * 
+ * @param   n  The number of possible values, must be positive
+ * @return     A pseudorandom number in [0, `n`)
+ */
+static long long health_random(long long n)
+{
+  struct timespec now;
+  
+  if (jitter_state == 0)
+    {
+      timer_now(&now);
+      jitter_state = ((unsigned long long)getpid() << 32) ^ (unsigned long long)(now.tv_nsec) ^ 1;
+    }
+  
+  /* xorshift64 */
+  jitter_state ^= jitter_state << 13;
+  jitter_state ^= jitter_state >> 7;
+  jitter_state ^= jitter_state << 17;
+  return (long long)(jitter_state % (unsigned long long)n);
+}
+
+
+/**
+ * Get the number of nanoseconds between health checks of a service
+ * 
+ * @param   service  The service
+ * @return           The health check interval
+ */
+static __attribute__((pure)) long long health_interval(const struct service* restrict service)
+{
+  int seconds = service->descriptor.health_interval;
+  return (long long)(seconds ? seconds : HEALTH_INTERVAL) * NANOSECONDS;
+}
+
+
+/**
+ * Get the number of nanoseconds a health check of a service may take
+ * 
+ * @param   service  The service
+ * @return           The health check timeout
+ */
+long long health_timeout(const struct service* restrict service)
+{
+  int seconds = service->descriptor.health_timeout;
+  return (long long)(seconds ? seconds : HEALTH_TIMEOUT) * NANOSECONDS;
+}
+
+
+/**
+ * Start a health check
+ * 
+ * @param   service  The service
+ * @return           1 if the health check has been started, 0 if it
+ *                   has failed already, -1 on error, in which case
+ *                   the health check is neither passed nor failed
+ */
+static int health_start(struct service* restrict service)
+{
+  struct health_probe* probe = &(service->health);
+  const struct descriptor_listener* address = &(service->descriptor.health_address);
+  char* command[DESCRIPTOR_MAX_EXEC + 1];
+  int fd, flags, saved_errno;
+  pid_t pid;
+  
+  probe->connected = 0;
+  probe->sent = probe->received = 0;
+  probe->killed = 0;
+  
+  if (service->descriptor.health == DESCRIPTOR_HEALTH_EXEC)
+    {
+      descriptor_health_command(&(service->descriptor), command);
+      if (pid = fork(), pid == -1)
+	return -1;
+      if (pid == 0)
+	{
+	  if (fd = open("/dev/null", O_RDONLY), fd >= 0)
+	    dup2(fd, STDIN_FILENO);
+	  execvp(*command, command);
+	  perror(*argv);
+	  _exit(1);
+	}
+      probe->pid = pid;
+      return 1;
+    }
+  
+  fd = socket(address->address.any.sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+  
+  /* Have SIGIO sent to us when the connection is made, or the response arrives. */
+  if ((fcntl(fd, F_SETOWN, getpid()) < 0) ||
+      (flags = fcntl(fd, F_GETFL), flags < 0) ||
+      (fcntl(fd, F_SETFL, flags | O_ASYNC) < 0))
+    {
+      saved_errno = errno;
+      close(fd);
+      return errno = saved_errno, -1;
+    }
+  
+  probe->fd = fd;
+  if (connect(fd, &(address->address.any), address->length) == 0)
+    return probe->connected = 1, 1;
+  return errno == EINPROGRESS;
+}
+
+
+/**
+ * Make as much progress as possible, without blocking,
+ * on the health check in progress on a socket
+ * 
+ * @param   service  The service
+ * @return           1 if the health check has passed, -1 if it has
+ *                   failed, 0 if it is still in progress
+ */
+static int health_poll(struct service* restrict service)
+{
+  struct health_probe* probe = &(service->health);
+  char request[DESCRIPTOR_HEALTH_PATH_SIZE + 64];
+  const char* status;
+  struct pollfd pfd;
+  socklen_t length = sizeof(int);
+  int error, code;
+  ssize_t got;
+  size_t n;
+  
+  if (!probe->connected)
+    {
+      pfd.fd = probe->fd;
+      pfd.events = POLLOUT;
+      if (poll(&pfd, 1, 0) <= 0)
+	return 0;
+      if ((getsockopt(probe->fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0) || error)
+	return -1;
+      probe->connected = 1;
+    }
+  if (service->descriptor.health == DESCRIPTOR_HEALTH_CONNECT)
+    return 1;
+  
+  n = (size_t)sprintf(request, "GET %s HTTP/1.0\r\nHost: localhost\r\nConnection: close\r\n\r\n",
+		      DESCRIPTOR_AT(&(service->descriptor), health_path));
+  while (probe->sent < n)
+    if (got = send(probe->fd, request + probe->sent, n - probe->sent, MSG_NOSIGNAL), got < 0)
+      {
+	if (errno == EINTR)
+	  continue;
+	return errno == EAGAIN ? 0 : -1;
+      }
+    else
+      probe->sent += (size_t)got;
+  
+  while (probe->received < HTTP_STATUS_END)
+    if (got = recv(probe->fd, probe->response + probe->received, HTTP_STATUS_END - probe->received, 0), got < 0)
+      {
+	if (errno == EINTR)
+	  continue;
+	return errno == EAGAIN ? 0 : -1;
+      }
+    else if (got == 0)
+      return -1;
+    else
+      probe->received += (size_t)got;
+  
+  /* Only the status code matters, the rest of the response is ignored. */
+  status = probe->response + HTTP_STATUS_END - 3;
+  if (strncmp(probe->response, "HTTP/", strlen("HTTP/")) || (status[-1] != ' '))
+    return -1;
+  if (!isdigit(status[0]) || !isdigit(status[1]) || !isdigit(status[2]))
+    return -1;
+  code = (status[0] - '0') * 100 + (status[1] - '0') * 10 + (status[2] - '0');
+  return ((200 <= code) && (code < 400)) ? 1 : -1;
+}
+
+
+/**
+ * Record the result of a health check
+ * 
+ * @param  service  The service
+ * @param  passed   Whether the health check passed
+ */
+static void health_finish(struct service* restrict service, int passed)
+{
+  struct health_probe* probe = &(service->health);
+  char discard[512];
+  
+  /* Closing with unread data resets the connection, which services may log as an error. */
+  if (probe->fd >= 0)
+    {
+      while (recv(probe->fd, discard, sizeof(discard), 0) > 0);
+      close(probe->fd), probe->fd = -1;
+    }
+  
+  if (passed)
+    {
+      probe->failures = 0;
+      return;
+    }
+  
+  probe->failures++;
+  service->metrics.health_failures++;
+  fprintf(stderr, "%s: %s failed a health check\n", *argv, service->name);
+}
+
+
+/**
+ * Start checking the health of a service that has become ready,
+ * the first health check is made at a random point within the
+ * first interval, so that services that are started together
+ * are not checked together
+ * 
+ * @param  service  The service
+ * @param  now      The current time
+ */
+void health_reset(struct service* restrict service, const struct timespec* restrict now)
+{
+  struct health_probe* probe = &(service->health);
+  
+  probe->failures = 0;
+  probe->restarting = 0;
+  probe->next = *now;
+  timer_add(&(probe->next), health_random(health_interval(service)));
+}
+
+
+/**
+ * Abort the health check in progress of a service, if any
+ * 
+ * @param  service  The service
+ */
+void health_cancel(struct service* restrict service)
+{
+  struct health_probe* probe = &(service->health);
+  
+  probe->restarting = 0;
+  if (probe->fd >= 0)
+    close(probe->fd), probe->fd = -1;
+  
+  /* The command is reaped later, but its result is ignored. */
+  if ((probe->pid > 0) && !probe->cancelled)
+    {
+      if (!probe->killed && (kill(probe->pid, SIGKILL) < 0))
+	perror(*argv);
+      probe->killed = 1;
+      probe->cancelled = 1;
+    }
+}
+
+
+/**
+ * Start, or make progress on, the health check of a running
+ * service, without blocking, and schedule the next time
+ * this should be done
+ * 
+ * @param   service  The service
+ * @param   now      The current time
+ * @return           Whether the service has failed as many health
+ *                   checks in a row as it may, and shall be restarted
+ */
+int health_tick(struct service* restrict service, const struct timespec* restrict now)
+{
+  struct health_probe* probe = &(service->health);
+  long long interval, spread;
+  int retries, r;
+  
+  if (service->descriptor.health == DESCRIPTOR_HEALTH_NONE)
+    {
+      health_cancel(service);
+      return 0;
+    }
+  
+  if ((probe->fd < 0) && (probe->pid == 0) && (timer_diff(&(probe->next), now) >= 0))
+    {
+      /* Spread the health checks of services that would otherwise be checked together. */
+      interval = health_interval(service);
+      spread = interval / 100 * HEALTH_JITTER;
+      probe->next = *now;
+      timer_add(&(probe->next), interval - spread + health_random(2 * spread + 1));
+      probe->deadline = *now;
+      timer_add(&(probe->deadline), health_timeout(service));
+      if (r = health_start(service), r < 0)
+	perror(*argv);
+      else if (r == 0)
+	health_finish(service, 0);
+    }
+  
+  if (probe->fd >= 0)
+    {
+      if (r = health_poll(service), (r == 0) && (timer_diff(&(probe->deadline), now) >= 0))
+	r = -1;
+      if (r)
+	health_finish(service, r > 0);
+      else
+	timer_wakeup_at(&(probe->deadline));
+    }
+  else if ((probe->pid > 0) && !probe->killed)
+    {
+      /* The health check fails when the killed command is reaped. */
+      if (timer_diff(&(probe->deadline), now) < 0)
+	timer_wakeup_at(&(probe->deadline));
+      else if (kill(probe->pid, SIGKILL) < 0)
+	perror(*argv);
+      else
+	probe->killed = 1;
+    }
+  
+  if ((probe->fd < 0) && (probe->pid == 0))
+    timer_wakeup_at(&(probe->next));
+  
+  retries = service->descriptor.health_retries;
+  return probe->failures >= (retries ? retries : HEALTH_RETRIES);
+}
+
+
+/**
+ * Record the result of a health check command after it has been reaped
+ * 
+ * @param   pid     The reaped process
+ * @param   status  The status of the process, as returned by `waitpid`
+ * @return          Zero if the process was a health check command, 1 otherwise
+ */
+int health_reaped(pid_t pid, int status)
+{
+  struct health_probe* probe;
+  size_t i;
+  
+  for (i = 0; i < service_count; i++)
+    {
+      probe = &(services[i]->health);
+      if (probe->pid != pid)
+	continue;
+      probe->pid = 0;
+      if (probe->cancelled)
+	probe->cancelled = 0;
+      else
+	health_finish(services[i], WIFEXITED(status) && !WEXITSTATUS(status) && !probe->killed);
+      return 0;
+    }
+  return 1;
+}
+
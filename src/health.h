@@ -0,0 +1,158 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef DAEMOND_HEALTH_H
+#define DAEMOND_HEALTH_H
+
+
+#include <sys/types.h>
+#include <time.h>
+
+
+
+/**
+ * The size of `struct health_probe.response`
+ */
+#define HEALTH_RESPONSE_SIZE  16
+
+
+
+struct service;
+
+
+/**
+ * The health checking of a service
+ */
+struct health_probe
+{
+  /**
+   * The socket of the health check in progress, -1 if none
+   */
+  int fd;
+  
+  /**
+   * The process of the health check command, 0 if none
+   */
+  pid_t pid;
+  
+  /**
+   * Whether the health check command has been killed
+   * because it timed out, or because the health
+   * checking of the service was cancelled
+   */
+  int killed;
+  
+  /**
+   * Whether the health check command has been killed because
+   * the health checking of the service was cancelled
+   */
+  int cancelled;
+  
+  /**
+   * Whether `fd` is connected
+   */
+  int connected;
+  
+  /**
+   * The number of bytes of the HTTP request that have been sent
+   */
+  size_t sent;
+  
+  /**
+   * The beginning of the HTTP response
+   */
+  char response[HEALTH_RESPONSE_SIZE];
+  
+  /**
+   * The number of bytes in `response`
+   */
+  size_t received;
+  
+  /**
+   * When the next health check is started
+   */
+  struct timespec next;
+  
+  /**
+   * When the health check in progress times out
+   */
+  struct timespec deadline;
+  
+  /**
+   * The number of health checks in a row the service has failed
+   */
+  int failures;
+  
+  /**
+   * Whether the service is being stopped, to be
+   * restarted, because it has become unhealthy
+   */
+  int restarting;
+};
+
+
+
+/**
+ * Get the number of nanoseconds a health check of a service may take
+ * 
+ * @param   service  The service
+ * @return           The health check timeout
+ */
+long long health_timeout(const struct service* restrict service) __attribute__((pure));
+
+/**
+ * Start checking the health of a service that has become ready,
+ * the first health check is made at a random point within the
+ * first interval, so that services that are started together
+ * are not checked together
+ * 
+ * @param  service  The service
+ * @param  now      The current time
+ */
+void health_reset(struct service* restrict service, const struct timespec* restrict now);
+
+/**
+ * Abort the health check in progress of a service, if any
+ * 
+ * @param  service  The service
+ */
+void health_cancel(struct service* restrict service);
+
+/**
+ * Start, or make progress on, the health check of a running
+ * service, without blocking, and schedule the next time
+ * this should be done
+ * 
+ * @param   service  The service
+ * @param   now      The current time
+ * @return           Whether the service has failed as many health
+ *                   checks in a row as it may, and shall be restarted
+ */
+int health_tick(struct service* restrict service, const struct timespec* restrict now);
+
+/**
+ * Record the result of a health check command after it has been reaped
+ * 
+ * @param   pid     The reaped process
+ * @param   status  The status of the process, as returned by `waitpid`
+ * @return          Zero if the process was a health check command, 1 otherwise
+ */
+int health_reaped(pid_t pid, int status);
+
+
+#endif
+
@@ -0,0 +1,274 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "config.h"
+#include "listener.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+
+
+
+/**
+ * Sockets inherited from the daemond that re-executed
+ * into this process, that have not yet been claimed,
+ * -1 for those that have been claimed
+ */
+static int* inherited = NULL;
+
+/**
+ * The number of elements in `inherited`
+ */
+static size_t inherited_count = 0;
+
+
+
+/**
+ * Check whether a socket is bound to the address of a listener
+ * 
+ * @param   fd        The socket
+ * @param   listener  The listener
+ * @return            Whether the socket is bound to the address
+ */
+static int listener_is(int fd, const struct descriptor_listener* restrict listener)
+{
+  struct descriptor_listener bound;
+  socklen_t length = sizeof(bound.type);
+  
+  memset(&bound, 0, sizeof(bound));
+  if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &(bound.type), &length) < 0)
+    return 0;
+  bound.length = sizeof(bound.address);
+  if (getsockname(fd, &(bound.address.any), &(bound.length)) < 0)
+    return 0;
+  return listener_equal(&bound, listener);
+}
+
+
+/**
+ * Check whether something is listening on a unix socket
+ * 
+ * @param   listener  The unix socket
+ * @return            Whether the socket is in use
+ */
+static int listener_in_use(const struct descriptor_listener* restrict listener)
+{
+  int fd, r;
+  
+  if (fd = socket(AF_UNIX, listener->type | SOCK_CLOEXEC | SOCK_NONBLOCK, 0), fd < 0)
+    return 0;
+  r = (connect(fd, &(listener->address.any), listener->length) == 0) || (errno == EAGAIN);
+  close(fd);
+  return r;
+}
+
+
+/**
+ * Keep a socket inherited from the daemond that re-executed into
+ * this process, until it is claimed by `listener_open`
+ * 
+ * @param   fd  The socket
+ * @return      Zero on success, -1 on error
+ */
+int listener_inherit(int fd)
+{
+  int* new;
+  
+  if (fcntl(fd, F_SETFD, FD_CLOEXEC) < 0)
+    return -1;
+  if (new = realloc(inherited, (inherited_count + 1) * sizeof(int)), new == NULL)
+    return -1;
+  inherited = new;
+  inherited[inherited_count++] = fd;
+  return 0;
+}
+
+
+/**
+ * Close the inherited sockets that have not been claimed
+ */
+void listener_forget_inherited(void)
+{
+  while (inherited_count--)
+    if (inherited[inherited_count] >= 0)
+      close(inherited[inherited_count]);
+  free(inherited), inherited = NULL;
+  inherited_count = 0;
+}
+
+
+/**
+ * Create, bind and listen on a socket, or claim an
+ * inherited socket that is bound to the same address
+ * 
+ * @param   listener  The socket to create
+ * @return            The file descriptor of the socket, -1 on error
+ */
+int listener_open(const struct descriptor_listener* restrict listener)
+{
+  struct stat attr;
+  int fd, saved_errno, one = 1;
+  size_t i;
+  
+  /* Connections made while daemond re-executed are waiting in these. */
+  for (i = 0; i < inherited_count; i++)
+    if ((inherited[i] >= 0) && listener_is(inherited[i], listener))
+      {
+	fd = inherited[i];
+	inherited[i] = -1;
+	return fd;
+      }
+  
+  fd = socket(listener->address.any.sa_family, listener->type | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+  
+  /* Remove stale sockets, left by an earlier instance of daemond,
+     but not sockets that a daemon is still listening on. */
+  if (listener->address.any.sa_family == AF_UNIX)
+    {
+      if ((lstat(listener->address.un.sun_path, &attr) == 0) && S_ISSOCK(attr.st_mode))
+	{
+	  if (listener_in_use(listener))
+	    {
+	      errno = EADDRINUSE;
+	      goto fail;
+	    }
+	  unlink(listener->address.un.sun_path);
+	}
+    }
+  else if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0)
+    goto fail;
+  
+  if (bind(fd, &(listener->address.any), listener->length) < 0)
+    goto fail;
+  if ((listener->type == SOCK_STREAM) && (listen(fd, SOMAXCONN) < 0))
+    goto fail;
+  
+  /* Have SIGIO sent to us when `listener_notify` enables it. */
+  if (fcntl(fd, F_SETOWN, getpid()) < 0)
+    goto fail;
+  
+  return fd;
+  
+ fail:
+  saved_errno = errno;
+  close(fd);
+  return errno = saved_errno, -1;
+}
+
+
+/**
+ * Check whether two sockets have the same address
+ * 
+ * @param   a  One of the sockets
+ * @param   b  The other socket
+ * @return     Whether the sockets have the same address
+ */
+int listener_equal(const struct descriptor_listener* restrict a,
+		   const struct descriptor_listener* restrict b)
+{
+  return (a->type == b->type) && (a->length == b->length) &&
+    !memcmp(&(a->address), &(b->address), (size_t)(a->length));
+}
+
+
+/**
+ * Enable or disable SIGIO on incoming connections
+ * 
+ * @param   fds     The sockets
+ * @param   n       The number of elements in `fds`
+ * @param   enable  Whether to enable SIGIO
+ * @return          Zero on success, -1 on error
+ */
+int listener_notify(const int* restrict fds, size_t n, int enable)
+{
+  size_t i;
+  int flags;
+  
+  for (i = 0; i < n; i++)
+    {
+      if (flags = fcntl(fds[i], F_GETFL), flags < 0)
+	return -1;
+      flags = enable ? (flags | O_ASYNC) : (flags & ~O_ASYNC);
+      if (fcntl(fds[i], F_SETFL, flags) < 0)
+	return -1;
+    }
+  
+  return 0;
+}
+
+
+/**
+ * Check, without blocking, whether there are
+ * pending connections on any of a set of sockets
+ * 
+ * @param   fds  The sockets
+ * @param   n    The number of elements in `fds`
+ * @return       1 if there are pending connections, 0 if
+ *               there are not, -1 on error
+ */
+int listener_pending(const int* restrict fds, size_t n)
+{
+  struct pollfd pfds[DESCRIPTOR_MAX_LISTEN];
+  size_t i;
+  int r;
+  
+  for (i = 0; i < n; i++)
+    {
+      pfds[i].fd = fds[i];
+      pfds[i].events = POLLIN;
+    }
+  
+  if (r = poll(pfds, (nfds_t)n, 0), r < 0)
+    return errno == EINTR ? 0 : -1;
+  return r > 0;
+}
+
+
+/**
+ * Place sockets at `LISTENER_FDS_START` and upwards, without
+ * close-on-exec, to be called between fork and `start_daemon`
+ * 
+ * @param   fds  The sockets
+ * @param   n    The number of elements in `fds`
+ * @return       Zero on success, -1 on error
+ */
+int listener_pass(const int* restrict fds, size_t n)
+{
+  int moved[DESCRIPTOR_MAX_LISTEN];
+  size_t i;
+  
+  /* Move the sockets out of the way first, so
+     that none of them is replaced by another. */
+  for (i = 0; i < n; i++)
+    if (moved[i] = fcntl(fds[i], F_DUPFD_CLOEXEC, LISTENER_FDS_START + (int)n), moved[i] < 0)
+      return -1;
+  
+  for (i = 0; i < n; i++)
+    if (dup2(moved[i], LISTENER_FDS_START + (int)i) < 0)
+      return -1;
+  
+  return 0;
+}
+
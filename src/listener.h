@@ -0,0 +1,102 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef DAEMOND_LISTENER_H
+#define DAEMOND_LISTENER_H
+
+
+#include "descriptor.h"
+
+#include <stddef.h>
+
+
+
+/**
+ * The file descriptor of the first listening
+ * socket a daemon inherits
+ */
+#define LISTENER_FDS_START  3
+
+
+
+/**
+ * Keep a socket inherited from the daemond that re-executed into
+ * this process, until it is claimed by `listener_open`
+ * 
+ * @param   fd  The socket
+ * @return      Zero on success, -1 on error
+ */
+int listener_inherit(int fd);
+
+/**
+ * Close the inherited sockets that have not been claimed
+ */
+void listener_forget_inherited(void);
+
+/**
+ * Create, bind and listen on a socket, or claim an
+ * inherited socket that is bound to the same address
+ * 
+ * @param   listener  The socket to create
+ * @return            The file descriptor of the socket, -1 on error
+ */
+int listener_open(const struct descriptor_listener* restrict listener);
+
+/**
+ * Check whether two sockets have the same address
+ * 
+ * @param   a  One of the sockets
+ * @param   b  The other socket
+ * @return     Whether the sockets have the same address
+ */
+int listener_equal(const struct descriptor_listener* restrict a,
+		   const struct descriptor_listener* restrict b) __attribute__((pure));
+
+/**
+ * Enable or disable SIGIO on incoming connections
+ * 
+ * @param   fds     The sockets
+ * @param   n       The number of elements in `fds`
+ * @param   enable  Whether to enable SIGIO
+ * @return          Zero on success, -1 on error
+ */
+int listener_notify(const int* restrict fds, size_t n, int enable);
+
+/**
+ * Check, without blocking, whether there are
+ * pending connections on any of a set of sockets
+ * 
+ * @param   fds  The sockets
+ * @param   n    The number of elements in `fds`
+ * @return       1 if there are pending connections, 0 if
+ *               there are not, -1 on error
+ */
+int listener_pending(const int* restrict fds, size_t n);
+
+/**
+ * Place sockets at `LISTENER_FDS_START` and upwards, without
+ * close-on-exec, to be called between fork and `start_daemon`
+ * 
+ * @param   fds  The sockets
+ * @param   n    The number of elements in `fds`
+ * @return       Zero on success, -1 on error
+ */
+int listener_pass(const int* restrict fds, size_t n);
+
+
+#endif
+
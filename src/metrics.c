@@ -0,0 +1,395 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "config.h"
+#include "metrics.h"
+#include "service.h"
+#include "cgroup.h"
+#include "timer.h"
+#include "selfcheck.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/msg.h>
+
+
+
+/**
+ * The pathname of the metrics file
+ */
+#define METRICS_PATHNAME  RUNDIR "/" PKGNAME "/metrics"
+
+
+
+/**
+ * Global supervision counters
+ */
+struct daemond_metrics metrics;
+
+/**
+ * The upper bounds, in nanoseconds, of the finite histogram buckets
+ */
+static const long long bucket_bounds[HISTOGRAM_BUCKETS] =
+  {
+    1000000LL, 5000000LL, 10000000LL, 50000000LL, 100000000LL,
+    500000000LL, NANOSECONDS, 5 * NANOSECONDS, 10 * NANOSECONDS, 60 * NANOSECONDS
+  };
+
+/**
+ * The upper bounds of the histogram buckets, as printed
+ */
+static const char* const bucket_labels[HISTOGRAM_BUCKETS + 1] =
+  {
+    "0.001", "0.005", "0.01", "0.05", "0.1", "0.5", "1", "5", "10", "60", "+Inf"
+  };
+
+/**
+ * When the metrics file should be rewritten next
+ */
+static struct timespec next_write;
+
+/**
+ * Whether `next_write` is set
+ */
+static int have_next_write = 0;
+
+
+
+/**
+ * Add an observation to a histogram
+ * 
+ * @param  histogram  The histogram
+ * @param  ns         The observed latency in nanoseconds
+ */
+void histogram_observe(struct histogram* restrict histogram, long long ns)
+{
+  size_t i;
+  
+  if (ns < 0)
+    ns = 0;
+  for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+    if (ns <= bucket_bounds[i])
+      break;
+  
+  histogram->buckets[i]++;
+  histogram->count++;
+  histogram->sum += (unsigned long long)ns;
+}
+
+
+/**
+ * Print a duration in seconds
+ * 
+ * @param  f   The output file
+ * @param  ns  The duration in nanoseconds
+ */
+static void print_seconds(FILE* restrict f, unsigned long long ns)
+{
+  fprintf(f, "%llu.%09llu", ns / NANOSECONDS, ns % NANOSECONDS);
+}
+
+
+/**
+ * Print the labels of a sample
+ * 
+ * @param  f        The output file
+ * @param  service  The name of the service, `NULL` if not service specific
+ * @param  le       The upper bound of the histogram bucket, `NULL` if not a bucket
+ */
+static void print_labels(FILE* restrict f, const char* restrict service, const char* restrict le)
+{
+  if ((service == NULL) && (le == NULL))
+    return;
+  fprintf(f, "{");
+  if (service != NULL)
+    {
+      fprintf(f, "service=\"");
+      for (; *service; service++)
+	if      (*service == '\\')  fprintf(f, "\\\\");
+	else if (*service == '"')   fprintf(f, "\\\"");
+	else if (*service == '\n')  fprintf(f, "\\n");
+	else                        fputc(*service, f);
+      fprintf(f, "\"%s", le == NULL ? "" : ",");
+    }
+  if (le != NULL)
+    fprintf(f, "le=\"%s\"", le);
+  fprintf(f, "}");
+}
+
+
+/**
+ * Print the samples of a histogram
+ * 
+ * @param  f          The output file
+ * @param  metric     The name of the metric
+ * @param  service    The name of the service, `NULL` if not service specific
+ * @param  histogram  The histogram
+ */
+static void print_histogram(FILE* restrict f, const char* restrict metric,
+			    const char* restrict service, const struct histogram* restrict histogram)
+{
+  unsigned long long cumulative = 0;
+  size_t i;
+  
+  for (i = 0; i <= HISTOGRAM_BUCKETS; i++)
+    {
+      cumulative += histogram->buckets[i];
+      fprintf(f, "%s_bucket", metric);
+      print_labels(f, service, bucket_labels[i]);
+      fprintf(f, " %llu\n", cumulative);
+    }
+  
+  fprintf(f, "%s_sum", metric);
+  print_labels(f, service, NULL);
+  fprintf(f, " ");
+  print_seconds(f, histogram->sum);
+  fprintf(f, "\n%s_count", metric);
+  print_labels(f, service, NULL);
+  fprintf(f, " %llu\n", histogram->count);
+}
+
+
+/**
+ * Print the header of a metric
+ * 
+ * @param  f       The output file
+ * @param  metric  The name of the metric
+ * @param  type    The type of the metric
+ * @param  help    Description of the metric
+ */
+static void print_header(FILE* restrict f, const char* restrict metric,
+			 const char* restrict type, const char* restrict help)
+{
+  fprintf(f, "# HELP %s %s\n# TYPE %s %s\n", metric, help, metric, type);
+}
+
+
+/**
+ * Print a per-service counter
+ * 
+ * @param  f       The output file
+ * @param  metric  The name of the metric
+ * @param  help    Description of the metric
+ * @param  member  The counter's member in `struct service_metrics`
+ */
+#define print_service_counter(f, metric, help, member)		\
+  do								\
+    {								\
+      size_t i_;						\
+      print_header(f, metric, "counter", help);			\
+      for (i_ = 0; i_ < service_count; i_++)			\
+	{							\
+	  fprintf(f, "%s", metric);				\
+	  print_labels(f, services[i_]->name, NULL);		\
+	  fprintf(f, " %llu\n", services[i_]->metrics.member);	\
+	}							\
+    }								\
+  while (0)
+
+
+/**
+ * Print the resource usage of all services
+ * 
+ * @param  f  The output file
+ */
+static void print_usage(FILE* restrict f)
+{
+  struct cgroup_usage* usage;
+  char* have;
+  size_t i;
+  
+  usage = malloc(service_count * sizeof(*usage) + service_count * sizeof(char));
+  if (usage == NULL)
+    return;
+  have = (char*)(usage + service_count);
+  for (i = 0; i < service_count; i++)
+    have[i] = cgroup_usage(services[i]->name, usage + i) == 0;
+  
+  print_header(f, "daemond_service_cpu_seconds_total", "counter", "CPU time consumed by the service");
+  for (i = 0; i < service_count; i++)
+    if (have[i])
+      {
+	fprintf(f, "daemond_service_cpu_seconds_total");
+	print_labels(f, services[i]->name, NULL);
+	fprintf(f, " %llu.%06llu\n", usage[i].cpu / 1000000ULL, usage[i].cpu % 1000000ULL);
+      }
+  
+  print_header(f, "daemond_service_memory_bytes", "gauge", "Memory used by the service");
+  for (i = 0; i < service_count; i++)
+    if (have[i] && usage[i].have_memory)
+      {
+	fprintf(f, "daemond_service_memory_bytes");
+	print_labels(f, services[i]->name, NULL);
+	fprintf(f, " %llu\n", usage[i].memory);
+      }
+  
+  print_header(f, "daemond_service_io_read_bytes_total", "counter", "Bytes read from block devices by the service");
+  for (i = 0; i < service_count; i++)
+    if (have[i] && usage[i].have_io)
+      {
+	fprintf(f, "daemond_service_io_read_bytes_total");
+	print_labels(f, services[i]->name, NULL);
+	fprintf(f, " %llu\n", usage[i].io_read);
+      }
+  
+  print_header(f, "daemond_service_io_written_bytes_total", "counter", "Bytes written to block devices by the service");
+  for (i = 0; i < service_count; i++)
+    if (have[i] && usage[i].have_io)
+      {
+	fprintf(f, "daemond_service_io_written_bytes_total");
+	print_labels(f, services[i]->name, NULL);
+	fprintf(f, " %llu\n", usage[i].io_written);
+      }
+  
+  free(usage);
+}
+
+
+/**
+ * Write all metrics in the text exposition format
+ * 
+ * @param  f          The output file
+ * @param  mqueue_id  The ID of the server message queue
+ * @param  usage      The resource usage of daemond, `NULL` if unknown
+ */
+static void print_metrics(FILE* restrict f, int mqueue_id, const struct selfcheck_usage* restrict usage)
+{
+  struct msqid_ds mqueue_info;
+  size_t i;
+  
+  print_header(f, "daemond_spawns_total", "counter", "Number of spawned services");
+  fprintf(f, "daemond_spawns_total %llu\n", metrics.spawns);
+  print_header(f, "daemond_restarts_total", "counter", "Number of unrequested restarts of services");
+  fprintf(f, "daemond_restarts_total %llu\n", metrics.restarts);
+  print_header(f, "daemond_reaps_total", "counter", "Number of reaped processes");
+  fprintf(f, "daemond_reaps_total %llu\n", metrics.reaps);
+  print_header(f, "daemond_untracked_reaps_total", "counter", "Number of reaped processes not belonging to a service");
+  fprintf(f, "daemond_untracked_reaps_total %llu\n", metrics.untracked_reaps);
+  print_header(f, "daemond_control_requests_total", "counter", "Number of received control requests");
+  fprintf(f, "daemond_control_requests_total %llu\n", metrics.requests);
+  print_header(f, "daemond_services", "gauge", "Number of known services");
+  fprintf(f, "daemond_services %zu\n", service_count);
+  
+  if (msgctl(mqueue_id, IPC_STAT, &mqueue_info) == 0)
+    {
+      print_header(f, "daemond_queue_messages", "gauge", "Number of messages in the control queue");
+      fprintf(f, "daemond_queue_messages %llu\n", (unsigned long long)(mqueue_info.msg_qnum));
+      print_header(f, "daemond_queue_bytes", "gauge", "Number of bytes in the control queue");
+      fprintf(f, "daemond_queue_bytes %llu\n", (unsigned long long)(mqueue_info.msg_cbytes));
+    }
+  
+  if (usage != NULL)
+    {
+      print_header(f, "daemond_resident_memory_bytes", "gauge", "Resident memory of daemond");
+      fprintf(f, "daemond_resident_memory_bytes %lli\n", usage->resident);
+      print_header(f, "daemond_open_fds", "gauge", "Number of file descriptors daemond has open");
+      fprintf(f, "daemond_open_fds %lli\n", usage->fds);
+    }
+  
+  print_header(f, "daemond_control_request_latency_seconds", "histogram", "Time spent handling control requests");
+  print_histogram(f, "daemond_control_request_latency_seconds", NULL, &(metrics.request_latency));
+  print_header(f, "daemond_reap_latency_seconds", "histogram", "Time from SIGCHLD to reaping");
+  print_histogram(f, "daemond_reap_latency_seconds", NULL, &(metrics.reap_latency));
+  
+  print_header(f, "daemond_service_up", "gauge", "Whether the service is running");
+  for (i = 0; i < service_count; i++)
+    {
+      fprintf(f, "daemond_service_up");
+      print_labels(f, services[i]->name, NULL);
+      fprintf(f, " %i\n", services[i]->state == SERVICE_RUNNING);
+    }
+  
+  print_service_counter(f, "daemond_service_spawns_total", "Number of times the service has been spawned", spawns);
+  print_service_counter(f, "daemond_service_restarts_total", "Number of unrequested restarts of the service", restarts);
+  print_service_counter(f, "daemond_service_exits_total", "Number of times the service has died", exits);
+  print_service_counter(f, "daemond_service_health_failures_total", "Number of failed health checks of the service",
+			health_failures);
+  
+  print_header(f, "daemond_service_backoff_seconds_total", "counter", "Time spent waiting to restart the service");
+  for (i = 0; i < service_count; i++)
+    {
+      fprintf(f, "daemond_service_backoff_seconds_total");
+      print_labels(f, services[i]->name, NULL);
+      fprintf(f, " ");
+      print_seconds(f, services[i]->metrics.backoff_time);
+      fprintf(f, "\n");
+    }
+  
+  print_header(f, "daemond_service_spawn_ready_seconds", "histogram", "Time from spawn to readiness");
+  for (i = 0; i < service_count; i++)
+    print_histogram(f, "daemond_service_spawn_ready_seconds", services[i]->name, &(services[i]->metrics.spawn_ready));
+  
+  if (cgroup_enabled())
+    print_usage(f);
+}
+
+
+/**
+ * Atomically rewrite the metrics file
+ * 
+ * @param   mqueue_id  The ID of the server message queue
+ * @return             Zero on success, -1 on error
+ */
+static int metrics_write(int mqueue_id)
+{
+  struct selfcheck_usage usage;
+  int fd, have_usage;
+  FILE* f;
+  
+  /* Measure before the file is opened, so that it is not counted. */
+  have_usage = selfcheck_measure(&usage) == 0;
+  
+  fd = open(METRICS_PATHNAME ".tmp", O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return -1;
+  if (f = fdopen(fd, "w"), f == NULL)
+    return close(fd), unlink(METRICS_PATHNAME ".tmp"), -1;
+  
+  print_metrics(f, mqueue_id, have_usage ? &usage : NULL);
+  
+  if (fclose(f) == EOF)
+    return unlink(METRICS_PATHNAME ".tmp"), -1;
+  return rename(METRICS_PATHNAME ".tmp", METRICS_PATHNAME);
+}
+
+
+/**
+ * Rewrite the metrics file, if it is time to do so,
+ * and schedule the next time it should be rewritten
+ * 
+ * @param   now        The current time
+ * @param   mqueue_id  The ID of the server message queue
+ * @return             Zero on success, -1 on error
+ */
+int metrics_tick(const struct timespec* restrict now, int mqueue_id)
+{
+  int r = 0;
+  
+  if (!have_next_write || (timer_diff(&next_write, now) >= 0))
+    {
+      r = metrics_write(mqueue_id);
+      next_write = *now;
+      timer_add(&next_write, METRICS_INTERVAL * NANOSECONDS);
+      have_next_write = 1;
+    }
+  
+  timer_wakeup_at(&next_write);
+  return r;
+}
+
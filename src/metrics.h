@@ -0,0 +1,167 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef DAEMOND_METRICS_H
+#define DAEMOND_METRICS_H
+
+
+#include <time.h>
+
+
+
+/**
+ * The number of finite buckets in a histogram
+ */
+#define HISTOGRAM_BUCKETS  10
+
+
+
+/**
+ * A latency histogram
+ */
+struct histogram
+{
+  /**
+   * The number of observations in each bucket,
+   * not cumulative, the last element is the +Inf bucket
+   */
+  unsigned long long buckets[HISTOGRAM_BUCKETS + 1];
+  
+  /**
+   * The total number of observations
+   */
+  unsigned long long count;
+  
+  /**
+   * The sum of all observations, in nanoseconds
+   */
+  unsigned long long sum;
+};
+
+
+/**
+ * Supervision counters for a single service
+ */
+struct service_metrics
+{
+  /**
+   * The number of times the service has been spawned
+   */
+  unsigned long long spawns;
+  
+  /**
+   * The number of times the service has been
+   * restarted without being requested to
+   */
+  unsigned long long restarts;
+  
+  /**
+   * The number of times the service has died
+   */
+  unsigned long long exits;
+  
+  /**
+   * The total time, in nanoseconds, spent waiting
+   * before restarting a service that died too fast
+   */
+  unsigned long long backoff_time;
+  
+  /**
+   * The number of health checks the service has failed
+   */
+  unsigned long long health_failures;
+  
+  /**
+   * The time between spawn and readiness
+   */
+  struct histogram spawn_ready;
+};
+
+
+/**
+ * Global supervision counters
+ */
+struct daemond_metrics
+{
+  /**
+   * The number of spawned services
+   */
+  unsigned long long spawns;
+  
+  /**
+   * The number of restarts of services
+   * that was not requested by a user
+   */
+  unsigned long long restarts;
+  
+  /**
+   * The number of reaped processes
+   */
+  unsigned long long reaps;
+  
+  /**
+   * The number of reaped processes that
+   * did not belong to any known service
+   */
+  unsigned long long untracked_reaps;
+  
+  /**
+   * The number of received control requests
+   */
+  unsigned long long requests;
+  
+  /**
+   * The time spent handling control requests
+   */
+  struct histogram request_latency;
+  
+  /**
+   * The time between SIGCHLD and the reaping of a process
+   */
+  struct histogram reap_latency;
+};
+
+
+
+/**
+ * Global supervision counters
+ */
+extern struct daemond_metrics metrics;
+
+
+
+/**
+ * Add an observation to a histogram
+ * 
+ * @param  histogram  The histogram
+ * @param  ns         The observed latency in nanoseconds
+ */
+void histogram_observe(struct histogram* restrict histogram, long long ns);
+
+/**
+ * Rewrite the metrics file, if it is time to do so,
+ * and schedule the next time it should be rewritten
+ * 
+ * @param   now        The current time
+ * @param   mqueue_id  The ID of the server message queue
+ * @return             Zero on success, -1 on error
+ */
+int metrics_tick(const struct timespec* restrict now, int mqueue_id);
+
+
+#endif
+
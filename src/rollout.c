@@ -0,0 +1,406 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "config.h"
+#include "rollout.h"
+#include "service.h"
+#include "timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+
+
+/**
+ * The number of nanoseconds a restarted or updated service
+ * must keep running, without dying, to be considered ready
+ */
+#define ROLLOUT_SETTLE  (1 * NANOSECONDS)
+
+/**
+ * The default number of seconds a service may take
+ * to become ready before it is considered to have failed
+ */
+#define ROLLOUT_TIMEOUT  60
+
+
+
+/**
+ * The progress of a service in a rollout
+ */
+enum rollout_progress
+  {
+    /**
+     * The service has not been restarted or updated yet
+     */
+    ROLLOUT_PENDING,
+    
+    /**
+     * The service is being restarted or updated
+     */
+    ROLLOUT_IN_FLIGHT,
+    
+    /**
+     * The service has been restarted or updated and is ready
+     */
+    ROLLOUT_DONE,
+    
+    /**
+     * The service did not become ready
+     */
+    ROLLOUT_FAILED
+  };
+
+
+/**
+ * A service in a rollout
+ */
+struct rollout_member
+{
+  /**
+   * The name of the service
+   */
+  char* name;
+  
+  /**
+   * The progress of the service
+   */
+  enum rollout_progress progress;
+  
+  /**
+   * When the service was restarted or updated
+   */
+  struct timespec requested;
+  
+  /**
+   * The number of times the service had exited
+   * when it was restarted or updated
+   */
+  unsigned long long exits;
+};
+
+
+
+/**
+ * Command line arguments
+ */
+extern char** argv;
+
+/**
+ * Whether a rollout is in progress
+ */
+static int rolling = 0;
+
+/**
+ * Whether the rollout is an update rather than a restart
+ */
+static int updating;
+
+/**
+ * The maximum number of services that may
+ * be restarted or updated at the same time
+ */
+static size_t surge;
+
+/**
+ * The number of failed services after which the rollout is aborted
+ */
+static size_t max_failures;
+
+/**
+ * The number of nanoseconds a service may take to become ready
+ */
+static long long timeout;
+
+/**
+ * The services in the rollout
+ */
+static struct rollout_member* members = NULL;
+
+/**
+ * The number of elements in `members`
+ */
+static size_t member_count = 0;
+
+/**
+ * The verb sent for each service
+ */
+static char restart_verb[] = "restart";
+
+/**
+ * The verb sent for each service in an update
+ */
+static char update_verb[] = "update";
+
+
+
+/**
+ * Parse the value of an option
+ * 
+ * @param   argument  The option
+ * @param   option    The name of the option, with the "="
+ * @param   value     Output parameter for the value
+ * @return            1 if `argument` is `option`, 0 if it is
+ *                    not, -1 if its value is invalid
+ */
+static int parse_option(const char* restrict argument, const char* restrict option, size_t* restrict value)
+{
+  size_t n = strlen(option);
+  unsigned long long v;
+  char* end;
+  
+  if (strncmp(argument, option, n))
+    return 0;
+  argument += n;
+  errno = 0;
+  v = strtoull(argument, &end, 10);
+  if (errno || *end || (end == argument) || (*argument == '-') || (v > INT_MAX))
+    return -1;
+  return *value = (size_t)v, 1;
+}
+
+
+/**
+ * Add a service to the rollout, or just count it
+ * 
+ * @param  name  The name of the service
+ * @param  size  The total length of the names, will be updated
+ * @param  text  Where to store the name, will be updated,
+ *               `NULL` if the service shall only be counted
+ */
+static void rollout_add(const char* restrict name, size_t* restrict size, char** restrict text)
+{
+  if (*text != NULL)
+    {
+      members[member_count].name = strcpy(*text, name);
+      members[member_count].progress = ROLLOUT_PENDING;
+      *text += strlen(name) + 1;
+    }
+  *size += strlen(name) + 1;
+  member_count++;
+}
+
+
+/**
+ * Add the requested services to the rollout, or just count them,
+ * a template, NAME@, stands for all its instances that are not stopped
+ * 
+ * @param  names  `NULL`-terminated list of names of services
+ * @param  size   Output parameter for the total length of the names
+ * @param  text   Where to store the names, will be updated,
+ *                `NULL` if the services shall only be counted
+ */
+static void rollout_add_all(char** restrict names, size_t* restrict size, char** restrict text)
+{
+  size_t i, n;
+  
+  member_count = 0, *size = 0;
+  for (; *names != NULL; names++)
+    {
+      n = strlen(*names);
+      if ((n == 0) || ((*names)[n - 1] != '@'))
+	{
+	  rollout_add(*names, size, text);
+	  continue;
+	}
+      for (i = 0; i < service_count; i++)
+	if (!strncmp(services[i]->name, *names, n) && services[i]->name[n])
+	  if (services[i]->state != SERVICE_STOPPED)
+	    rollout_add(services[i]->name, size, text);
+    }
+}
+
+
+/**
+ * Restart or update a service in the rollout
+ * 
+ * @param   member  The service
+ * @param   now     The current time
+ * @return          The return value for `main`, -1 if the caller should not return
+ */
+static int rollout_member_begin(struct rollout_member* restrict member, const struct timespec* restrict now)
+{
+  char* arguments[] = { updating ? update_verb : restart_verb, member->name, NULL };
+  struct service* service = service_find(member->name);
+  
+  member->progress = ROLLOUT_IN_FLIGHT;
+  member->requested = *now;
+  member->exits = service ? service->metrics.exits : 0;
+  
+  return service_control(arguments);
+}
+
+
+/**
+ * Check whether a service in the rollout has become ready or failed
+ * 
+ * @param   member  The service, must be in flight
+ * @param   now     The current time
+ * @return          The progress of the service
+ */
+static enum rollout_progress rollout_member_check(const struct rollout_member* restrict member,
+						  const struct timespec* restrict now)
+{
+  struct service* service = service_find(member->name);
+  struct timespec deadline;
+  
+  if (service == NULL)
+    return ROLLOUT_FAILED;
+  
+  /* An update is done in place, so the service must not die. A restarted
+     service must have been started after the restart was requested. */
+  if (updating && ((service->state != SERVICE_RUNNING) || (service->metrics.exits != member->exits)))
+    return ROLLOUT_FAILED;
+  if ((service->state == SERVICE_STOPPED) || (service->state == SERVICE_BACKOFF))
+    return ROLLOUT_FAILED;
+  if (service->state == SERVICE_LISTENING)
+    return ROLLOUT_DONE;
+  
+  /* A service that dies right after it has signalled readiness is not ready. */
+  if ((service->state == SERVICE_RUNNING) && (updating || (timer_diff(&member->requested, &service->started) >= 0)))
+    {
+      deadline = updating ? member->requested : service->started;
+      timer_add(&deadline, ROLLOUT_SETTLE);
+      if (timer_diff(&deadline, now) >= 0)
+	return ROLLOUT_DONE;
+      timer_wakeup_at(&deadline);
+    }
+  
+  deadline = member->requested;
+  timer_add(&deadline, timeout);
+  if (timer_diff(&deadline, now) >= 0)
+    return ROLLOUT_FAILED;
+  timer_wakeup_at(&deadline);
+  return ROLLOUT_IN_FLIGHT;
+}
+
+
+/**
+ * Start a rolling restart or update of a group of services
+ * 
+ * @param   arguments  `NULL`-terminated list of arguments, the verb,
+ *                     "rolling-restart" or "rolling-update", first,
+ *                     then options, then the names of the services
+ * @return             The return value for `main`, -1 if the caller should not return
+ */
+int rollout_request(char** restrict arguments)
+{
+  const char* verb = *arguments++;
+  size_t n = 0, size = 0, seconds = ROLLOUT_TIMEOUT;
+  struct timespec now;
+  char* text;
+  int r = 0;
+  
+  if (rolling)
+    return fprintf(stderr, "%s: a rollout is already in progress\n", *argv), -1;
+  
+  surge = 1, max_failures = 0;
+  for (; *arguments && (**arguments == '-'); arguments++)
+    if ((r = parse_option(*arguments, "--surge=", &surge)) ||
+	(r = parse_option(*arguments, "--max-failures=", &max_failures)) ||
+	(r = parse_option(*arguments, "--timeout=", &seconds)))
+      {
+	if (r < 0)
+	  break;
+      }
+    else
+      break;
+  if ((r < 0) || (*arguments == NULL) || (**arguments == '-') || (surge == 0))
+    return fprintf(stderr, "%s: invalid %s request\n", *argv, verb), -1;
+  
+  /* Copy the names into the same allocation as the members. */
+  text = NULL;
+  rollout_add_all(arguments, &size, &text);
+  if (n = member_count, n == 0)
+    return fprintf(stderr, "%s: no instances of %s are known\n", *argv, *arguments), -1;
+  free(members);
+  members = malloc(n * sizeof(struct rollout_member) + size * sizeof(char));
+  if (members == NULL)
+    return member_count = 0, perror(*argv), -1;
+  text = (char*)(members + n);
+  rollout_add_all(arguments, &size, &text);
+  
+  rolling = 1;
+  updating = !strcmp(verb, "rolling-update");
+  timeout = (long long)seconds * NANOSECONDS;
+  fprintf(stderr, "%s: rolling %s of %zu services, %zu at a time\n",
+	  *argv, updating ? "update" : "restart", member_count, surge);
+  
+  timer_now(&now);
+  return rollout_tick(&now);
+}
+
+
+/**
+ * Check whether the services being restarted or updated are
+ * ready, restart or update more services if they are, and
+ * schedule the next time this should be done
+ * 
+ * @param   now  The current time
+ * @return       The return value for `main`, -1 if the caller should not return
+ */
+int rollout_tick(const struct timespec* restrict now)
+{
+  size_t i, in_flight = 0, failed = 0, done = 0;
+  struct rollout_member* member;
+  int r;
+  
+  if (!rolling)
+    return -1;
+  
+  for (i = 0; i < member_count; i++)
+    {
+      member = members + i;
+      if (member->progress == ROLLOUT_IN_FLIGHT)
+	{
+	  member->progress = rollout_member_check(member, now);
+	  if (member->progress == ROLLOUT_DONE)
+	    fprintf(stderr, "%s: %s is ready\n", *argv, member->name);
+	  else if (member->progress == ROLLOUT_FAILED)
+	    fprintf(stderr, "%s: %s did not become ready\n", *argv, member->name);
+	}
+      in_flight += member->progress == ROLLOUT_IN_FLIGHT;
+      failed += member->progress == ROLLOUT_FAILED;
+      done += member->progress == ROLLOUT_DONE;
+    }
+  
+  if (failed > max_failures)
+    {
+      fprintf(stderr, "%s: rollout aborted after %zu failures, %zu services are ready\n", *argv, failed, done);
+      return rolling = 0, -1;
+    }
+  
+  for (i = 0; (i < member_count) && (in_flight < surge); i++)
+    if (members[i].progress == ROLLOUT_PENDING)
+      {
+	if (r = rollout_member_begin(members + i, now), r >= 0)
+	  return r;
+	in_flight++;
+      }
+  
+  if (in_flight == 0)
+    {
+      fprintf(stderr, "%s: rollout finished, %zu services are ready, %zu failed\n", *argv, done, failed);
+      rolling = 0;
+    }
+  
+  return -1;
+}
+
@@ -0,0 +1,48 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef DAEMOND_ROLLOUT_H
+#define DAEMOND_ROLLOUT_H
+
+
+#include <time.h>
+
+
+
+/**
+ * Start a rolling restart or update of a group of services
+ * 
+ * @param   arguments  `NULL`-terminated list of arguments, the verb,
+ *                     "rolling-restart" or "rolling-update", first,
+ *                     then options, then the names of the services
+ * @return             The return value for `main`, -1 if the caller should not return
+ */
+int rollout_request(char** restrict arguments);
+
+/**
+ * Check whether the services being restarted or updated are
+ * ready, restart or update more services if they are, and
+ * schedule the next time this should be done
+ * 
+ * @param   now  The current time
+ * @return       The return value for `main`, -1 if the caller should not return
+ */
+int rollout_tick(const struct timespec* restrict now);
+
+
+#endif
+
@@ -0,0 +1,195 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "config.h"
+#include "selfcheck.h"
+#include "service.h"
+#include "timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+
+
+
+/**
+ * Command line arguments
+ */
+extern char** argv;
+
+/**
+ * The resource usage when daemond entered its mane loop
+ */
+static struct selfcheck_usage baseline;
+
+/**
+ * Whether `baseline` is set
+ */
+static int have_baseline = 0;
+
+/**
+ * The resource usage at the last report
+ */
+static struct selfcheck_usage last;
+
+/**
+ * The number of nanoseconds between periodic
+ * reports, zero if periodic reports are off
+ */
+static long long interval = 0;
+
+/**
+ * When the next periodic report is made
+ */
+static struct timespec next_report;
+
+
+
+/**
+ * Measure the resource usage of daemond
+ * 
+ * @param   usage  Output parameter for the resource usage
+ * @return         Zero on success, -1 on error
+ */
+int selfcheck_measure(struct selfcheck_usage* restrict usage)
+{
+  char buf[6 * (3 * sizeof(long long) + 1) + 1];
+  long long pages, fds = 0;
+  long page_size;
+  ssize_t got;
+  DIR* dir;
+  int fd;
+  
+  /* The second field is the number of resident pages. */
+  if (fd = open(SELF_STATM, O_RDONLY | O_CLOEXEC), fd < 0)
+    return -1;
+  got = read(fd, buf, sizeof(buf) - sizeof(char));
+  close(fd);
+  if (got < 0)
+    return -1;
+  buf[got] = '\0';
+  if ((sscanf(buf, "%*s %lli", &pages) != 1) || (page_size = sysconf(_SC_PAGESIZE), page_size < 0))
+    return errno = EINVAL, -1;
+  
+  /* ., .. and the directory stream's own file descriptor are not counted. */
+  if (dir = opendir(SELF_FD), dir == NULL)
+    return -1;
+  while (errno = 0, readdir(dir) != NULL)
+    fds++;
+  if (errno)
+    return closedir(dir), -1;
+  closedir(dir);
+  
+  usage->resident = pages * page_size;
+  usage->fds = fds - 3;
+  return 0;
+}
+
+
+/**
+ * Report the resource usage of daemond, and how
+ * it has changed since the mane loop was entered
+ * and since the last report
+ */
+static void selfcheck_report(void)
+{
+  struct selfcheck_usage usage;
+  
+  if (selfcheck_measure(&usage) < 0)
+    {
+      perror(*argv);
+      return;
+    }
+  if (!have_baseline)
+    baseline = last = usage, have_baseline = 1;
+  
+  fprintf(stderr, "%s: self-check: %lli kB resident (%+lli kB since start, %+lli kB since last), "
+	  "%lli file descriptors (%+lli since start, %+lli since last), %zu services\n", *argv,
+	  usage.resident / 1024, (usage.resident - baseline.resident) / 1024, (usage.resident - last.resident) / 1024,
+	  usage.fds, usage.fds - baseline.fds, usage.fds - last.fds, service_count);
+  last = usage;
+}
+
+
+/**
+ * Report the resource usage of daemond, or
+ * turn periodic reports on or off
+ * 
+ * @param   arguments  `NULL`-terminated list of arguments, the verb,
+ *                     "self-check", first, then optionally "on",
+ *                     optionally followed by the number of seconds
+ *                     between reports, or "off"
+ * @return             The return value for `main`, -1 if the caller should not return
+ */
+int selfcheck_request(char** restrict arguments)
+{
+  const char* verb = *arguments++;
+  long long seconds = SELF_CHECK_INTERVAL;
+  char* end;
+  
+  if ((arguments[0] != NULL) && !strcmp(arguments[0], "off") && (arguments[1] == NULL))
+    return interval = 0, -1;
+  
+  if ((arguments[0] != NULL) && !strcmp(arguments[0], "on") && ((arguments[1] == NULL) || (arguments[2] == NULL)))
+    {
+      if (arguments[1] != NULL)
+	{
+	  errno = 0;
+	  seconds = strtoll(arguments[1], &end, 10);
+	  if (errno || *end || (end == arguments[1]) || (seconds <= 0) || (seconds > INT_MAX))
+	    return fprintf(stderr, "%s: invalid %s request\n", *argv, verb), -1;
+	}
+      interval = seconds * NANOSECONDS;
+      timer_now(&next_report);
+      timer_add(&next_report, interval);
+    }
+  else if (arguments[0] != NULL)
+    return fprintf(stderr, "%s: invalid %s request\n", *argv, verb), -1;
+  
+  selfcheck_report();
+  return -1;
+}
+
+
+/**
+ * Report the resource usage of daemond, if periodic reports are on
+ * and it is time to do so, and schedule the next time it should be done
+ * 
+ * @param  now  The current time
+ */
+void selfcheck_tick(const struct timespec* restrict now)
+{
+  /* Growth is measured from the first turn of the mane loop, when daemond has settled. */
+  if (!have_baseline && (selfcheck_measure(&baseline) == 0))
+    last = baseline, have_baseline = 1;
+  
+  if (interval == 0)
+    return;
+  if (timer_diff(&next_report, now) >= 0)
+    {
+      selfcheck_report();
+      next_report = *now;
+      timer_add(&next_report, interval);
+    }
+  timer_wakeup_at(&next_report);
+}
+
@@ -0,0 +1,74 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef DAEMOND_SELFCHECK_H
+#define DAEMOND_SELFCHECK_H
+
+
+#include <time.h>
+
+
+
+/**
+ * The resource usage of daemond itself
+ */
+struct selfcheck_usage
+{
+  /**
+   * The resident memory, in bytes
+   */
+  long long resident;
+  
+  /**
+   * The number of open file descriptors
+   */
+  long long fds;
+};
+
+
+
+/**
+ * Measure the resource usage of daemond
+ * 
+ * @param   usage  Output parameter for the resource usage
+ * @return         Zero on success, -1 on error
+ */
+int selfcheck_measure(struct selfcheck_usage* restrict usage);
+
+/**
+ * Report the resource usage of daemond, or
+ * turn periodic reports on or off
+ * 
+ * @param   arguments  `NULL`-terminated list of arguments, the verb,
+ *                     "self-check", first, then optionally "on",
+ *                     optionally followed by the number of seconds
+ *                     between reports, or "off"
+ * @return             The return value for `main`, -1 if the caller should not return
+ */
+int selfcheck_request(char** restrict arguments);
+
+/**
+ * Report the resource usage of daemond, if periodic reports are on
+ * and it is time to do so, and schedule the next time it should be done
+ * 
+ * @param  now  The current time
+ */
+void selfcheck_tick(const struct timespec* restrict now);
+
+
+#endif
+
@@ -0,0 +1,2079 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "config.h"
+#include "service.h"
+#include "daemonise.h"
+#include "cgroup.h"
+#include "listener.h"
+#include "environtab.h"
+#include "timer.h"
+#include "event.h"
+#include "slab.h"
+
+#include <stdint.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <ctype.h>
+#include <sys/wait.h>
+
+
+
+/**
+ * The number of nanoseconds a service must have been
+ * running to not be considered to be dying too fast
+ */
+#define MINIMUM_LIFETIME  (1 * NANOSECONDS)
+
+/**
+ * The first backoff time, in nanoseconds, for
+ * a service that is dying too fast
+ */
+#define BACKOFF_INITIAL  (1 * NANOSECONDS)
+
+/**
+ * The maximum backoff time, in nanoseconds, for
+ * a service that is dying too fast
+ */
+#define BACKOFF_MAXIMUM  (5 * 60 * NANOSECONDS)
+
+/**
+ * The reciprocal of the share of CPU time a service
+ * may use and still be considered to be idle
+ */
+#define IDLE_CPU_SHARE  1000
+
+/**
+ * The default time, in nanoseconds, services are given
+ * to stop during a shutdown before they are killed
+ */
+#define SHUTDOWN_DEADLINE  (10 * NANOSECONDS)
+
+/**
+ * The file in which daemond passes the services
+ * on to itself when it is re-executed
+ */
+#define STATE_PATHNAME  RUNDIR "/" PKGNAME "/state"
+
+
+
+/**
+ * Command line arguments
+ */
+extern char** argv;
+
+/**
+ * The environment of the process
+ */
+extern char** environ;
+
+/**
+ * All known services
+ */
+struct service** services = NULL;
+
+/**
+ * The number of elements in `services`
+ */
+size_t service_count = 0;
+
+/**
+ * The number of elements `services` has room for
+ */
+static size_t services_size = 0;
+
+/**
+ * The memory for the services
+ */
+static struct slab service_slab = SLAB_INITIALISER(struct service, SERVICE_CHUNK);
+
+/**
+ * Whether services are signalled by their process groups
+ */
+int service_signal_groups = 0;
+
+/**
+ * The verb used to start a service
+ */
+static char start_verb[] = "start";
+
+/**
+ * The verb used to stop a service
+ */
+static char stop_verb[] = "stop";
+
+/**
+ * The option used to force stop a service
+ */
+static char force_option[] = "--force";
+
+/**
+ * The compiled environtab, the base environment of all services
+ */
+static struct environtab environment;
+
+/**
+ * Whether all services are being stopped
+ */
+static int shutting_down = 0;
+
+/**
+ * Whether the services that had not stopped
+ * by `shutdown_deadline` have been killed
+ */
+static int shutdown_escalated;
+
+/**
+ * Whether all services have stopped since the last shutdown began
+ */
+static int shutdown_completed = 0;
+
+/**
+ * When the shutdown began
+ */
+static struct timespec shutdown_began;
+
+/**
+ * When services that have not stopped are killed
+ */
+static struct timespec shutdown_deadline;
+
+
+
+/**
+ * Get the name of a service state
+ * 
+ * @param   state  The state
+ * @return         The name of the state
+ */
+const char* service_state_name(enum service_state state)
+{
+  switch (state)
+    {
+    case SERVICE_STOPPED:   return "stopped";
+    case SERVICE_STARTING:  return "starting";
+    case SERVICE_RUNNING:   return "running";
+    case SERVICE_STOPPING:  return "stopping";
+    case SERVICE_BACKOFF:   return "backoff";
+    case SERVICE_LISTENING: return "listening";
+    case SERVICE_WAITING:   return "waiting";
+    default:                return "unknown";
+    }
+}
+
+
+/**
+ * Find a service by its name
+ * 
+ * @param   name  The name of the service
+ * @return        The service, `NULL` if not found
+ */
+struct service* service_find(const char* restrict name)
+{
+  size_t i;
+  for (i = 0; i < service_count; i++)
+    if (!strcmp(services[i]->name, name))
+      return services[i];
+  return NULL;
+}
+
+
+/**
+ * Find the service a process belongs to
+ * 
+ * @param   pid  The process
+ * @return       The service, `NULL` if not found
+ */
+static __attribute__((pure)) struct service* service_find_pid(pid_t pid)
+{
+  size_t i;
+  for (i = 0; i < service_count; i++)
+    if ((services[i]->pid == pid) || (services[i]->launcher == pid))
+      return services[i];
+  return NULL;
+}
+
+
+/**
+ * Check whether a service is required by another
+ * service that is running or about to run
+ * 
+ * @param   service  The service
+ * @return           Whether the service is required
+ */
+static __attribute__((pure)) int service_required(const struct service* restrict service)
+{
+  size_t i;
+  for (i = 0; i < service_count; i++)
+    if ((services[i]->state != SERVICE_STOPPED) && (services[i]->state != SERVICE_LISTENING))
+      if (descriptor_requires(&(services[i]->descriptor), service->name))
+	return 1;
+  return 0;
+}
+
+
+/**
+ * Check whether a name is the name of a template, NAME@,
+ * rather than the name of a service
+ * 
+ * @param   name  The name
+ * @return        Whether the name is the name of a template
+ */
+static __attribute__((pure)) int is_template(const char* restrict name)
+{
+  size_t n = strlen(name);
+  return n && (name[n - 1] == '@');
+}
+
+
+/**
+ * Check whether a service is an instance of a template
+ * 
+ * @param   service   The service
+ * @param   template  The name of the template, NAME@
+ * @param   n         The length of `template`
+ * @return            The instance number, 0 if the service is not an instance
+ *                    of the template or the instance is not a number
+ */
+static __attribute__((pure)) unsigned long int instance_of(const struct service* restrict service,
+							  const char* restrict template, size_t n)
+{
+  const char* instance = service->name + n;
+  char* end;
+  unsigned long int number;
+  
+  if (strncmp(service->name, template, n) || !isdigit(*instance))
+    return 0;
+  number = strtoul(instance, &end, 10);
+  return *end ? 0 : number;
+}
+
+
+/**
+ * Duplicate a list of arguments into a single allocation
+ * 
+ * @param   verb       The verb to store instead of the first argument,
+ *                     `NULL` to copy the first argument as well
+ * @param   arguments  `NULL`-terminated list of arguments
+ * @return             The duplicate, `NULL` on error
+ */
+static char** copy_arguments(char* restrict verb, char** restrict arguments)
+{
+  size_t i, n, size = 0;
+  char** rc;
+  char* p;
+  
+  for (n = 0; arguments[n] != NULL; n++)
+    if (n || (verb == NULL))
+      size += strlen(arguments[n]) + 1;
+  
+  rc = malloc((n + 1) * sizeof(char*) + size * sizeof(char));
+  if (rc == NULL)
+    return NULL;
+  
+  p = (char*)(rc + n + 1);
+  rc[0] = verb;
+  for (i = verb ? 1 : 0; i < n; i++)
+    {
+      size = strlen(arguments[i]) + 1;
+      rc[i] = memcpy(p, arguments[i], size * sizeof(char));
+      p += size;
+    }
+  rc[n] = NULL;
+  
+  return rc;
+}
+
+
+/**
+ * Create a new service
+ * 
+ * @param   arguments  The arguments with which the service is started
+ * @return             The service, `NULL` on error
+ */
+static struct service* service_add(char** restrict arguments)
+{
+  struct service** new;
+  struct service* service;
+  
+  /* Services are never removed, so make room for a chunk of them at a time. */
+  if (service_count == services_size)
+    {
+      new = realloc(services, (services_size + SERVICE_CHUNK) * sizeof(struct service*));
+      if (new == NULL)
+	return NULL;
+      services = new;
+      services_size += SERVICE_CHUNK;
+    }
+  
+  service = slab_alloc(&service_slab);
+  if (service == NULL)
+    return NULL;
+  service->arguments = copy_arguments(start_verb, arguments);
+  if (service->arguments == NULL)
+    return slab_free(&service_slab, service), NULL;
+  service->name = service->arguments[1];
+  service->state = SERVICE_STOPPED;
+  service->health.fd = -1;
+  
+  return services[service_count++] = service;
+}
+
+
+/**
+ * Replace the arguments with which a service is started
+ * 
+ * @param   service    The service
+ * @param   arguments  The new arguments
+ * @return             Zero on success, -1 on error
+ */
+static int service_set_arguments(struct service* restrict service, char** restrict arguments)
+{
+  char** new = copy_arguments(start_verb, arguments);
+  if (new == NULL)
+    return -1;
+  free(service->arguments);
+  service->arguments = new;
+  service->name = new[1];
+  return 0;
+}
+
+
+/**
+ * Close the sockets daemond listens on for a service
+ * 
+ * @param  service  The service
+ */
+static void service_unlisten(struct service* restrict service)
+{
+  while (service->listen_count)
+    close(service->listen_fds[--(service->listen_count)]);
+}
+
+
+/**
+ * Listen on the sockets declared in a new descriptor for a service,
+ * sockets the service already has are kept so that no connections
+ * are lost, and sockets that are no longer declared are closed
+ * 
+ * @param   service     The service
+ * @param   descriptor  The new descriptor for the service
+ * @return              Zero on success, -1 on error, in which
+ *                      case the old sockets are kept
+ */
+static int service_listen(struct service* restrict service, const struct descriptor* restrict descriptor)
+{
+  int fds[DESCRIPTOR_MAX_LISTEN];
+  size_t kept[DESCRIPTOR_MAX_LISTEN];
+  size_t i, j, n = service->listen_count;
+  int saved_errno;
+  
+  for (i = 0; i < descriptor->listen_count; i++)
+    {
+      for (j = 0; j < n; j++)
+	if ((service->listen_fds[j] >= 0) &&
+	    listener_equal(DESCRIPTOR_LISTEN(descriptor) + i, DESCRIPTOR_LISTEN(&(service->descriptor)) + j))
+	  break;
+      if ((kept[i] = j) < n)
+	{
+	  fds[i] = service->listen_fds[j];
+	  service->listen_fds[j] = -1;
+	}
+      else if (fds[i] = listener_open(DESCRIPTOR_LISTEN(descriptor) + i), fds[i] < 0)
+	goto fail;
+    }
+  
+  for (j = 0; j < n; j++)
+    if (service->listen_fds[j] >= 0)
+      close(service->listen_fds[j]);
+  memcpy(service->listen_fds, fds, descriptor->listen_count * sizeof(int));
+  service->listen_count = descriptor->listen_count;
+  return 0;
+  
+ fail:
+  saved_errno = errno;
+  while (i--)
+    if (kept[i] < n)
+      service->listen_fds[kept[i]] = fds[i];
+    else
+      close(fds[i]);
+  return errno = saved_errno, -1;
+}
+
+
+/**
+ * Put a service that is not running to rest, if it
+ * is started on connections, daemond will continue
+ * to listen on its sockets, otherwise the sockets
+ * are closed and the service is stopped
+ * 
+ * Deferred control requests for the service are dropped,
+ * and services waiting for it are put to rest as well
+ * 
+ * @param  service     The service
+ * @param  may_listen  Whether the service may continue to listen
+ */
+static void service_rest(struct service* restrict service, int may_listen)
+{
+  int on_connection = service->descriptor.listen_start;
+  size_t i;
+  
+  on_connection |= service->descriptor.activation == DESCRIPTOR_ACTIVATION_LAZY;
+  if (may_listen && on_connection && service->listen_count)
+    {
+      service->state = SERVICE_LISTENING;
+      if (listener_notify(service->listen_fds, service->listen_count, 1) < 0)
+	perror(*argv);
+    }
+  else
+    {
+      service->state = SERVICE_STOPPED;
+      service_unlisten(service);
+    }
+  
+  if (service->deferred_count)
+    fprintf(stderr, "%s: %s did not start, dropping %zu requests\n", *argv, service->name, service->deferred_count);
+  while (service->deferred_count)
+    free(service->deferred[--(service->deferred_count)]);
+  free(service->deferred), service->deferred = NULL;
+  
+  for (i = 0; i < service_count; i++)
+    if ((services[i]->state == SERVICE_WAITING) && descriptor_requires(&(services[i]->descriptor), service->name))
+      {
+	fprintf(stderr, "%s: %s requires %s, which is not running\n", *argv, services[i]->name, service->name);
+	service_rest(services[i], 0);
+      }
+}
+
+
+/**
+ * Get the base environment for services, recompiling
+ * the environtab if it has been modified
+ * 
+ * @param   count  Output parameter for the number of environment variables
+ * @return         `NULL`-terminated list of environment variables
+ */
+static char* const* service_environment(size_t* restrict count)
+{
+  if (environtab_refresh(ENVIRONTAB, &environment) < 0)
+    perror(*argv);
+  if (environment.envp != NULL)
+    return *count = environment.count, environment.envp;
+  for (*count = 0; environ[*count] != NULL; ++*count);
+  return environ;
+}
+
+
+/**
+ * Spawn a service
+ * 
+ * @param   service  The service
+ * @param   now      The current time
+ * @return           Zero on success, -1 on error
+ */
+static int service_spawn(struct service* restrict service, const struct timespec* restrict now)
+{
+  char listen_fds[sizeof(ENV_LISTEN_FDS_TAG "=") + 3 * sizeof(size_t)];
+  char* entries[DESCRIPTOR_MAX_ENVIRONMENT + 1];
+  char* command[DESCRIPTOR_MAX_EXEC + 1];
+  char* const* envp;
+  size_t count, n;
+  pid_t pid;
+  
+  if (!cgroup_enabled())
+    {
+      if (service->descriptor.flags & (DESCRIPTOR_HAVE_MEMORY_MAX | DESCRIPTOR_HAVE_MEMORY_HIGH))
+	fprintf(stderr, "%s: %s: memory limits require cgroups, ignoring\n", *argv, service->name);
+    }
+  else if (cgroup_create(service->name) < 0)
+    perror(*argv);
+  else if (descriptor_apply_cgroup(service->name, &(service->descriptor)) < 0)
+    perror(*argv);
+  
+  if (service->state == SERVICE_LISTENING)
+    if (listener_notify(service->listen_fds, service->listen_count, 0) < 0)
+      perror(*argv);
+  
+  /* The environment is the shared environtab and the service's own
+     changes, joined by pointers only in the child. */
+  envp = service_environment(&count);
+  n = descriptor_environment(&(service->descriptor), entries);
+  sprintf(listen_fds, ENV_LISTEN_FDS_TAG "=%zu", service->listen_count);
+  if (service->listen_count)
+    entries[n++] = listen_fds;
+  
+  if (pid = fork(), pid == -1)
+    return -1;
+  if (pid == 0)
+    {
+      if (cgroup_enabled() && (cgroup_enter(service->name) < 0))
+	perror(*argv);
+      if (listener_pass(service->listen_fds, service->listen_count) < 0)
+	{
+	  perror(*argv);
+	  _exit(1);
+	}
+      if (descriptor_apply(&(service->descriptor)) < 0)
+	{
+	  /* LSB: program is not configured. */
+	  perror(*argv);
+	  _exit(6);
+	}
+      {
+	char* env[count + n + 1];
+	environtab_compose(env, envp, entries, n);
+	if (descriptor_command(&(service->descriptor), command) == 0)
+	  {
+	    if (NATIVE_LIFECYCLE)
+	      {
+		/* LSB: program is not configured. */
+		fprintf(stderr, "%s: %s has no exec command\n", *argv, service->name);
+		_exit(6);
+	      }
+	    start_daemon(service->arguments, env, NULL);
+	  }
+	start_daemon(service->arguments, env, command);
+      }
+    }
+  
+  if (service->state == SERVICE_BACKOFF)
+    service->metrics.backoff_time += (unsigned long long)timer_diff(&service->backoff_start, now);
+  
+  service->state = SERVICE_STARTING;
+  service->launcher = pid;
+  service->pid = 0;
+  service->spawned = *now;
+  service->metrics.spawns++;
+  metrics.spawns++;
+  event_emit(service, EVENT_STARTED, 0);
+  return 0;
+}
+
+
+/**
+ * Replace the descriptor of a service
+ * 
+ * @param  service     The service
+ * @param  descriptor  The new descriptor, the service takes over its memory,
+ *                     so it is left as a descriptor whose memory has been released
+ */
+static void service_set_descriptor(struct service* restrict service, struct descriptor* restrict descriptor)
+{
+  descriptor_destroy(&(service->descriptor));
+  service->descriptor = *descriptor;
+  descriptor->data = NULL;
+}
+
+
+/**
+ * Register a service from its descriptor
+ * 
+ * @param   name        The name of the service
+ * @param   descriptor  The descriptor of the service, which is copied
+ * @return              The service, `NULL` on error
+ */
+static struct service* service_register_descriptor(char* restrict name, const struct descriptor* restrict descriptor)
+{
+  char* arguments[] = { start_verb, name, NULL };
+  struct service* service;
+  struct descriptor copy;
+  
+  if (descriptor_copy(&copy, descriptor) < 0)
+    return NULL;
+  if (service = service_add(arguments), service == NULL)
+    return descriptor_destroy(&copy), NULL;
+  if (service_listen(service, descriptor) < 0)
+    perror(*argv);
+  service->descriptor = copy;
+  return service;
+}
+
+
+/**
+ * Find a service, and register it from its
+ * descriptor if it has not been registered
+ * 
+ * @param   name  The name of the service
+ * @return        The service, `NULL` on error
+ */
+static struct service* service_obtain(char* restrict name)
+{
+  struct descriptor descriptor;
+  struct service* service;
+  
+  if (service = service_find(name), service != NULL)
+    return service;
+  if (descriptor_load(name, &descriptor) < 0)
+    return NULL;
+  service = service_register_descriptor(name, &descriptor);
+  descriptor_destroy(&descriptor);
+  return service;
+}
+
+
+/**
+ * Start a service, the service is spawned once the services
+ * it requires are running, and they are started if they are not
+ * 
+ * @param   service  The service, must not be running
+ * @param   now      The current time
+ * @return           Zero on success, -1 on error, in which case an
+ *                   error has been printed and the service put to rest
+ */
+static int service_start(struct service* restrict service, const struct timespec* restrict now)
+{
+  char* name = DESCRIPTOR_AT(&(service->descriptor), requires);
+  struct service* required;
+  int waiting = 0;
+  size_t i;
+  
+  if (shutting_down)
+    return service_rest(service, 0), -1;
+  
+  service->backoff = 0;
+  
+  if (service->descriptor.requires_count)
+    {
+      if (service->state == SERVICE_LISTENING)
+	if (listener_notify(service->listen_fds, service->listen_count, 0) < 0)
+	  perror(*argv);
+      if (service->state == SERVICE_BACKOFF)
+	service->metrics.backoff_time += (unsigned long long)timer_diff(&service->backoff_start, now);
+      service->state = SERVICE_WAITING;
+    }
+  
+  for (i = 0; i < service->descriptor.requires_count; i++, name += strlen(name) + 1)
+    {
+      if (required = service_obtain(name), required == NULL)
+	{
+	  if (errno)
+	    perror(*argv);
+	  fprintf(stderr, "%s: %s requires %s, which is not available\n", *argv, service->name, name);
+	  return service_rest(service, 0), -1;
+	}
+      if (required->state == SERVICE_RUNNING)
+	continue;
+      waiting = 1;
+      if (required->state == SERVICE_STOPPING)
+	required->restart = 1;
+      else if ((required->state == SERVICE_STOPPED) ||
+	       (required->state == SERVICE_LISTENING) ||
+	       (required->state == SERVICE_BACKOFF))
+	if (service_start(required, now) < 0)
+	  return service->state == SERVICE_WAITING ? (service_rest(service, 0), -1) : -1;
+    }
+  
+  if (waiting)
+    return 0;
+  if (service_spawn(service, now) < 0)
+    return perror(*argv), service_rest(service, 0), -1;
+  return 0;
+}
+
+
+/**
+ * Spawn the services that were waiting for
+ * services they require, that are now running
+ * 
+ * @param  now  The current time
+ */
+static void service_proceed(const struct timespec* restrict now)
+{
+  struct service* required;
+  const char* name;
+  size_t i, j;
+  
+  for (i = 0; i < service_count; i++)
+    if (services[i]->state == SERVICE_WAITING)
+      {
+	name = DESCRIPTOR_AT(&(services[i]->descriptor), requires);
+	for (j = 0; j < services[i]->descriptor.requires_count; j++, name += strlen(name) + 1)
+	  if (required = service_find(name), (required == NULL) || (required->state != SERVICE_RUNNING))
+	    break;
+	if (j < services[i]->descriptor.requires_count)
+	  continue;
+	if (service_spawn(services[i], now) < 0)
+	  perror(*argv), service_rest(services[i], 0);
+      }
+}
+
+
+/**
+ * Get the CPU time a service has consumed
+ * 
+ * @param   service  The service
+ * @return           The consumed CPU time, in nanoseconds, -1 on error
+ */
+static long long service_cpu_time(const struct service* restrict service)
+{
+  struct cgroup_usage usage;
+  char pathname[sizeof("/proc//stat") + 3 * sizeof(pid_t)];
+  char buf[1024];
+  unsigned long long utime, stime;
+  char* p = NULL;
+  long ticks;
+  FILE* f;
+  
+  if (cgroup_enabled())
+    return cgroup_usage(service->name, &usage) < 0 ? -1 : (long long)(usage.cpu * 1000);
+  
+  /* Without cgroups, only the main process is measured. */
+  sprintf(pathname, "/proc/%ji/stat", (intmax_t)(service->pid));
+  if (f = fopen(pathname, "re"), f == NULL)
+    return -1;
+  if (fgets(buf, (int)sizeof(buf), f) != NULL)
+    p = strrchr(buf, ')');
+  fclose(f);
+  if ((p == NULL) || (ticks = sysconf(_SC_CLK_TCK), ticks <= 0))
+    return -1;
+  if (sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2)
+    return -1;
+  return (long long)((utime + stime) * (unsigned long long)(NANOSECONDS / ticks));
+}
+
+
+/**
+ * Mark a service as being active
+ * 
+ * @param  service  The service
+ * @param  now      The current time
+ */
+static void service_active(struct service* restrict service, const struct timespec* restrict now)
+{
+  service->idle_since = *now;
+  if (service->descriptor.idle_stop)
+    service->idle_cpu = service_cpu_time(service);
+}
+
+
+/**
+ * Run the daemon script of a service asynchronously
+ * 
+ * If daemond performs all lifecycle actions itself, the
+ * request is only reported as not possible, or for status
+ * requests, the state of the service is reported
+ * 
+ * @param   service    The service, `NULL` if the daemon is not known
+ * @param   arguments  The arguments for the script, the verb
+ *                     first and the name of the daemon second
+ * @return             Zero on success, -1 on error
+ */
+static int service_run_script(struct service* restrict service, char** restrict arguments)
+{
+  char* entries[DESCRIPTOR_MAX_ENVIRONMENT + 1];
+  char* const* envp;
+  char* cgroup = NULL;
+  size_t count, n = 0;
+  pid_t pid;
+  
+  if (NATIVE_LIFECYCLE)
+    {
+      if (!strcmp(arguments[0], "status"))
+	fprintf(stderr, "%s: %s is %s\n", *argv, arguments[1],
+		service_state_name(service ? service->state : SERVICE_STOPPED));
+      else
+	fprintf(stderr, "%s: cannot %s %s without a daemon script\n", *argv, arguments[0], arguments[1]);
+      return 0;
+    }
+  
+  envp = service_environment(&count);
+  if (service != NULL)
+    n = descriptor_environment(&(service->descriptor), entries);
+  
+  if (pid = fork(), pid == -1)
+    return -1;
+  if (pid == 0)
+    {
+      if (cgroup_enabled())
+	if (cgroup = cgroup_path(arguments[1], NULL), cgroup == NULL)
+	  perror(*argv);
+      {
+	char entry[cgroup ? sizeof(ENV_DAEMON_CGROUP_TAG "=") + strlen(cgroup) : 1];
+	char* env[count + n + 2];
+	if (cgroup != NULL)
+	  {
+	    sprintf(entry, ENV_DAEMON_CGROUP_TAG "=%s", cgroup);
+	    entries[n++] = entry;
+	  }
+	environtab_compose(env, envp, entries, n);
+	run_daemon_script(arguments, env);
+      }
+    }
+  return 0;
+}
+
+
+/**
+ * Check whether a stop request is a request to force stop the service
+ * 
+ * @param   arguments  The arguments of the request
+ * @return             Whether the service should be force stopped
+ */
+static int __attribute__((pure)) is_force_stop(char** restrict arguments)
+{
+  for (arguments += 2; *arguments != NULL; arguments++)
+    if (!strcmp(*arguments, "--force") || !strcmp(*arguments, "-f"))
+      return 1;
+  return 0;
+}
+
+
+/**
+ * Get the signal a service's descriptor declares for an action
+ * 
+ * @param   declared  The signal in the descriptor
+ * @param   fallback  The default signal for the action
+ * @return            The signal, `DESCRIPTOR_SIGNAL_NONE` if the
+ *                    action is left to the daemon script
+ */
+static int __attribute__((const)) action_signal(int declared, int fallback)
+{
+  return declared ? declared : fallback;
+}
+
+
+/**
+ * Send a signal to a service, or to its process
+ * group if services are signalled by their groups
+ * 
+ * @param   service  The service, must have a known PID
+ * @param   signo    The signal
+ * @return           Zero on success, -1 on error
+ */
+static int service_signal(const struct service* restrict service, int signo)
+{
+  pid_t group;
+  
+  /* The daemon is in a session of its own, unless it has left it. */
+  if (service_signal_groups)
+    if (group = getpgid(service->pid), (group > 1) && (group != getpgrp()))
+      return kill(-group, signo);
+  return kill(service->pid, signo);
+}
+
+
+/**
+ * Request that a running service stops
+ * 
+ * @param   service    The service
+ * @param   arguments  The arguments for the daemon script's `stop`,
+ *                     `NULL` for the default arguments
+ * @return             Zero on success, -1 on error
+ */
+static int service_stop(struct service* restrict service, char** restrict arguments)
+{
+  char* default_arguments[] = { stop_verb, service->name, NULL };
+  int signo = action_signal(service->descriptor.stop_signal, SIGTERM);
+  
+  if (arguments && is_force_stop(arguments))
+    signo = action_signal(service->descriptor.kill_signal, SIGKILL);
+  
+  /* Without daemon scripts, a signal is the only way to stop the service. */
+  if (NATIVE_LIFECYCLE && (signo == DESCRIPTOR_SIGNAL_NONE))
+    signo = SIGTERM;
+  
+  if (service->state != SERVICE_STOPPING)
+    timer_now(&service->stop_requested);
+  service->state = SERVICE_STOPPING;
+  service->stop = 0;
+  
+  /* The death of the service is noticed when it is reaped. */
+  if ((service->pid > 0) && (signo != DESCRIPTOR_SIGNAL_NONE))
+    return service_signal(service, signo);
+  return service_run_script(service, arguments ? arguments : default_arguments);
+}
+
+
+/**
+ * Perform a status or signalling control request without the daemon
+ * script, if daemond knows enough about the service to do so
+ * 
+ * @param   service    The service
+ * @param   arguments  The arguments of the request
+ * @return             Whether the request has been performed
+ */
+static int service_control_natively(struct service* restrict service, char** restrict arguments)
+{
+  const char* verb = arguments[0];
+  int signo;
+  
+  /* A stopped service may still be running if daemond has
+     been re-executed, the daemon script can find out. */
+  if (!strcmp(verb, "status"))
+    {
+      if (service->state == SERVICE_STOPPED)
+	return 0;
+      fprintf(stderr, "%s: %s is %s\n", *argv, service->name, service_state_name(service->state));
+      return 1;
+    }
+  
+  if ((service->state != SERVICE_RUNNING) || (service->pid <= 0))
+    return 0;
+  
+  if (!strcmp(verb, "reload") || !strcmp(verb, "force-reload"))
+    signo = action_signal(service->descriptor.reload_signal, SIGHUP);
+  else if (!strcmp(verb, "update") || !strcmp(verb, "force-update"))
+    signo = action_signal(service->descriptor.update_signal, SIGUSR1);
+  else
+    return 0;
+  if (signo == DESCRIPTOR_SIGNAL_NONE)
+    return 0;
+  
+  if (kill(service->pid, signo) < 0)
+    perror(*argv);
+  return 1;
+}
+
+
+/**
+ * Update a service after it has died
+ * 
+ * @param  service  The service
+ * @param  status   The status of the service, as returned by `waitpid`
+ * @param  now      The current time
+ */
+static void service_died(struct service* restrict service, int status, const struct timespec* restrict now)
+{
+  long long lived = 0;
+  
+  if (service->state == SERVICE_RUNNING)
+    lived = timer_diff(&service->started, now);
+  
+  service->pid = 0;
+  service->launcher = 0;
+  service->last_status = status;
+  service->metrics.exits++;
+  event_emit(service, EVENT_EXITED, status);
+  health_cancel(service);
+  
+  /* Do not let descendants outlive the service. */
+  if (cgroup_enabled() && (cgroup_populated(service->name) > 0))
+    if (cgroup_kill(service->name) < 0)
+      perror(*argv);
+  
+  if ((service->state == SERVICE_STOPPING) || service->stop || shutting_down)
+    {
+      if (shutting_down && ((service->state == SERVICE_STOPPING) || service->stop))
+	fprintf(stderr, "%s: %s stopped in %lli ms\n", *argv, service->name,
+		timer_diff(&service->stop_requested, now) / 1000000);
+      service->stop = 0;
+      if (!service->restart)
+	{
+	  service_rest(service, service->idled);
+	  service->idled = 0;
+	}
+      else
+	{
+	  service->state = SERVICE_STOPPED;
+	  service->restart = 0;
+	  service_start(service, now);
+	}
+      return;
+    }
+  
+  /* Print was is going on. */
+  if (WIFEXITED(status))
+    fprintf(stderr, "%s: %s exited with value %i", *argv, service->name, WEXITSTATUS(status));
+  else
+    fprintf(stderr, "%s: %s died by signal %i", *argv, service->name, WTERMSIG(status));
+  
+  /* Do not restart services that exited cleanly or are not runnable. */
+  if (WIFEXITED(status) && (WEXITSTATUS(status) == 0))
+    {
+      service_rest(service, 1);
+      fprintf(stderr, "\n");
+      return;
+    }
+  if (WIFEXITED(status) && (2 <= WEXITSTATUS(status)) && (WEXITSTATUS(status) <= 6))
+    {
+      service_rest(service, 0);
+      fprintf(stderr, ", not respawning\n");
+      return;
+    }
+  
+  service->metrics.restarts++;
+  metrics.restarts++;
+  event_emit(service, EVENT_RESTARTING, (long long)(service->metrics.restarts));
+  
+  if (lived >= MINIMUM_LIFETIME)
+    {
+      fprintf(stderr, ", respawning\n");
+      service_start(service, now);
+      return;
+    }
+  
+  if (service->backoff == 0)
+    service->backoff = BACKOFF_INITIAL;
+  else if (service->backoff < BACKOFF_MAXIMUM / 2)
+    service->backoff *= 2;
+  else
+    service->backoff = BACKOFF_MAXIMUM;
+  
+  fprintf(stderr, ", dying too fast, respawning in %lli seconds\n", service->backoff / NANOSECONDS);
+  service->state = SERVICE_BACKOFF;
+  service->backoff_start = *now;
+  service->backoff_end = *now;
+  timer_add(&service->backoff_end, service->backoff);
+  event_emit(service, EVENT_BACKOFF, service->backoff);
+}
+
+
+/**
+ * Update a service after its `start_daemon` process has exited
+ * 
+ * @param  service  The service
+ * @param  status   The status of the process, as returned by `waitpid`
+ * @param  now      The current time
+ */
+static void service_launched(struct service* restrict service, int status, const struct timespec* restrict now)
+{
+  char* pid_pathname;
+  pid_t pid = -1;
+  size_t i;
+  
+  service->launcher = 0;
+  
+  if (!WIFEXITED(status) || WEXITSTATUS(status))
+    {
+      service_died(service, status, now);
+      return;
+    }
+  
+  /* Learn the PID of the daemon, it will have been reparented to us. */
+  pid_pathname = malloc((strlen(RUNDIR "/.pid") + strlen(service->name) + 1) * sizeof(char));
+  if (pid_pathname != NULL)
+    {
+      sprintf(pid_pathname, RUNDIR "/%s.pid", service->name);
+      pid = read_pid(pid_pathname);
+      free(pid_pathname);
+    }
+  if ((pid <= 0) || (kill(pid, 0) < 0))
+    {
+      fprintf(stderr, "%s: could not find the PID of %s\n", *argv, service->name);
+      service_died(service, 1 << 8, now);
+      return;
+    }
+  
+  service->state = SERVICE_RUNNING;
+  service->pid = pid;
+  service->started = *now;
+  histogram_observe(&service->metrics.spawn_ready, timer_diff(&service->spawned, now));
+  event_emit(service, EVENT_READY, pid);
+  service_active(service, now);
+  health_reset(service, now);
+  
+  if (service->stop)
+    {
+      if (service_stop(service, NULL) < 0)
+	perror(*argv);
+      return;
+    }
+  
+  /* Run the requests that started the service. */
+  for (i = 0; i < service->deferred_count; i++)
+    {
+      if (service_run_script(service, service->deferred[i]) < 0)
+	perror(*argv);
+      free(service->deferred[i]);
+    }
+  free(service->deferred), service->deferred = NULL;
+  service->deferred_count = 0;
+  
+  service_proceed(now);
+}
+
+
+/**
+ * Start a lazily activated service that is not running, because of
+ * a control request, if it is not already starting
+ * 
+ * @param   service  The service
+ * @param   now      The current time
+ * @return           Whether the control request shall be deferred
+ *                   until the service has started
+ */
+static int service_demanded(struct service* restrict service, const struct timespec* restrict now)
+{
+  if (service->descriptor.activation != DESCRIPTOR_ACTIVATION_LAZY)
+    return 0;
+  if ((service->state == SERVICE_STOPPED) ||
+      (service->state == SERVICE_LISTENING) ||
+      (service->state == SERVICE_BACKOFF))
+    service_start(service, now);
+  return (service->state == SERVICE_STARTING) || (service->state == SERVICE_WAITING);
+}
+
+
+/**
+ * Kill a service that did not stop before the shutdown deadline
+ * 
+ * @param  service  The service
+ */
+static void service_kill(struct service* restrict service)
+{
+  char* arguments[] = { stop_verb, service->name, force_option, NULL };
+  
+  fprintf(stderr, "%s: %s did not stop in time, killing\n", *argv, service->name);
+  
+  if (service->launcher > 0)
+    if (kill(service->launcher, SIGKILL) < 0)
+      perror(*argv);
+  if (service->pid <= 0)
+    return;
+  
+  if (!cgroup_enabled())
+    {
+      if (service_stop(service, arguments) < 0)
+	perror(*argv);
+      return;
+    }
+  
+  /* Kill the service and all its descendants atomically. */
+  if (service->state != SERVICE_STOPPING)
+    timer_now(&service->stop_requested);
+  service->state = SERVICE_STOPPING;
+  if (cgroup_kill(service->name) < 0)
+    perror(*argv);
+}
+
+
+/**
+ * Stop the services that no longer are required by any
+ * service that has not stopped, kill all services that
+ * have not stopped if the deadline has passed, and
+ * finish the shutdown when all services have stopped
+ * 
+ * @param  now  The current time
+ */
+static void service_shutdown_proceed(const struct timespec* restrict now)
+{
+  struct service* service;
+  size_t i, remaining = 0;
+  
+  for (i = 0; i < service_count; i++)
+    {
+      service = services[i];
+      if ((service->state == SERVICE_RUNNING) && !service_required(service))
+	if (service_stop(service, NULL) < 0)
+	  perror(*argv);
+      if ((service->state != SERVICE_STOPPED) && (service->state != SERVICE_LISTENING))
+	remaining++;
+    }
+  
+  if (remaining == 0)
+    {
+      fprintf(stderr, "%s: all services stopped in %lli ms\n", *argv,
+	      timer_diff(&shutdown_began, now) / 1000000);
+      shutting_down = 0;
+      shutdown_completed = 1;
+      return;
+    }
+  
+  if (shutdown_escalated)
+    return;
+  if (timer_diff(&shutdown_deadline, now) < 0)
+    {
+      timer_wakeup_at(&shutdown_deadline);
+      return;
+    }
+  
+  shutdown_escalated = 1;
+  for (i = 0; i < service_count; i++)
+    if ((services[i]->state != SERVICE_STOPPED) && (services[i]->state != SERVICE_LISTENING))
+      service_kill(services[i]);
+}
+
+
+/**
+ * Stop all services, in parallel, but each only once
+ * no service that requires it is running
+ * 
+ * Services that have not stopped by the deadline are killed
+ * 
+ * @param   arguments  The arguments of the request, the verb
+ *                     first, optionally followed by the deadline
+ *                     in seconds
+ * @return             The return value for `main`, -1 if the caller should not return
+ */
+static int service_shutdown(char** restrict arguments)
+{
+  long long deadline = SHUTDOWN_DEADLINE;
+  struct service* service;
+  struct timespec now;
+  char* end;
+  size_t i;
+  
+  if (arguments[1] != NULL)
+    {
+      errno = 0;
+      deadline = strtoll(arguments[1], &end, 10);
+      if (errno || *end || (end == arguments[1]) || (deadline < 0) || (deadline > LLONG_MAX / NANOSECONDS))
+	return fprintf(stderr, "%s: invalid shutdown deadline: %s\n", *argv, arguments[1]), -1;
+      deadline *= NANOSECONDS;
+    }
+  
+  timer_now(&now);
+  fprintf(stderr, "%s: shutting down\n", *argv);
+  shutting_down = 1;
+  shutdown_completed = 0;
+  shutdown_escalated = 0;
+  shutdown_began = now;
+  shutdown_deadline = now;
+  timer_add(&shutdown_deadline, deadline);
+  
+  for (i = 0; i < service_count; i++)
+    {
+      service = services[i];
+      service->restart = 0;
+      service->idled = 0;
+      if (service->state == SERVICE_BACKOFF)
+	service->metrics.backoff_time += (unsigned long long)timer_diff(&service->backoff_start, &now);
+      if ((service->state == SERVICE_BACKOFF) ||
+	  (service->state == SERVICE_LISTENING) ||
+	  (service->state == SERVICE_WAITING))
+	service_rest(service, 0);
+      else if (service->state == SERVICE_STARTING)
+	service->stop = 1, service->stop_requested = now;
+    }
+  
+  service_shutdown_proceed(&now);
+  return -1;
+}
+
+
+/**
+ * Start or stop instances of a template, so that
+ * the instances NAME@1 to NAME@N are running, and
+ * other numbered instances are not
+ * 
+ * @param   arguments  The arguments of the request, the verb first,
+ *                     then the name of the template, with or without
+ *                     the "@", and then the number of instances, at
+ *                     most `MAX_INSTANCES`
+ * @return             The return value for `main`, -1 if the caller should not return
+ */
+static int service_scale(char** restrict arguments)
+{
+  size_t i, n = strlen(arguments[1]) + !is_template(arguments[1]);
+  char template[n + 1];
+  char instance[n + 3 * sizeof(size_t) + 1];
+  char pathname[sizeof(DAEMONDIR "/" DESCRIPTOR_SUFFIX) + n];
+  char* start_arguments[] = { start_verb, instance, NULL };
+  char* stop_arguments[] = { stop_verb, instance, NULL };
+  struct service* service;
+  unsigned long int number;
+  long int count;
+  char* end;
+  int r;
+  
+  if (arguments[2] == NULL)
+    return fprintf(stderr, "%s: received invalid message\n", *argv), -1;
+  errno = 0;
+  count = strtol(arguments[2], &end, 10);
+  if (errno || *end || (end == arguments[2]) || (count < 0) || (count > MAX_INSTANCES))
+    return fprintf(stderr, "%s: invalid number of instances: %s\n", *argv, arguments[2]), -1;
+  
+  /* Without a template descriptor, every instance would be a daemon script service. */
+  sprintf(template, "%s%s", arguments[1], is_template(arguments[1]) ? "" : "@");
+  sprintf(pathname, DAEMONDIR "/%s" DESCRIPTOR_SUFFIX, template);
+  if (access(pathname, F_OK) < 0)
+    {
+      if (errno != ENOENT)
+	return perror(*argv), -1;
+      return fprintf(stderr, "%s: %s has no descriptor\n", *argv, template), -1;
+    }
+  fprintf(stderr, "%s: scaling %s to %li instances\n", *argv, template, count);
+  
+  for (i = 1; i <= (size_t)count; i++)
+    {
+      sprintf(instance, "%s%zu", template, i);
+      service = service_find(instance);
+      if ((service != NULL) && (service->state != SERVICE_STOPPED) && (service->state != SERVICE_LISTENING))
+	continue;
+      if (r = service_control(start_arguments), r >= 0)
+	return r;
+    }
+  
+  for (i = 0; i < service_count; i++)
+    {
+      number = instance_of(services[i], template, n);
+      if ((number <= (unsigned long int)count) || (services[i]->state == SERVICE_STOPPED))
+	continue;
+      sprintf(instance, "%s%lu", template, number);
+      if (r = service_control(stop_arguments), r >= 0)
+	return r;
+    }
+  
+  return -1;
+}
+
+
+/**
+ * Take over a service from the daemond that
+ * has re-executed into this process
+ * 
+ * @param  service   The service, registered but not yet running
+ * @param  state     The state the service was in
+ * @param  launcher  The PID of the process running `start_daemon`, or zero
+ * @param  pid       The PID of the service, or zero
+ * @param  restart   Whether the service was to be started again once stopped
+ * @param  now       The current time
+ */
+static void service_adopt(struct service* restrict service, enum service_state state,
+			  pid_t launcher, pid_t pid, int restart, const struct timespec* restrict now)
+{
+  switch (state)
+    {
+    case SERVICE_STARTING:
+    case SERVICE_RUNNING:
+    case SERVICE_STOPPING:
+      /* The processes are still our children, even if they have died. */
+      if ((launcher <= 0) && (pid <= 0))
+	break;
+      service->state = state;
+      service->launcher = launcher;
+      service->pid = pid;
+      service->restart = restart;
+      service->spawned = *now;
+      service->started = *now;
+      service->stop_requested = *now;
+      if (state == SERVICE_RUNNING)
+	{
+	  service_active(service, now);
+	  health_reset(service, now);
+	}
+      return;
+      
+    case SERVICE_BACKOFF:
+    case SERVICE_WAITING:
+      /* It may already have been started because another service requires it. */
+      if ((service->state == SERVICE_STOPPED) || (service->state == SERVICE_LISTENING))
+	service_start(service, now);
+      return;
+      
+    default:
+      break;
+    }
+  
+  service_rest(service, 1);
+}
+
+
+/**
+ * Take over the services from the daemond that
+ * has re-executed into this process
+ * 
+ * @param  now  The current time
+ */
+static void service_take_over(const struct timespec* restrict now)
+{
+  char line[NAME_MAX + (5 + DESCRIPTOR_MAX_LISTEN) * 3 * sizeof(intmax_t) + 16];
+  char state_name[16];
+  intmax_t launcher, pid;
+  struct service* service;
+  size_t j, fds;
+  int i, fd, restart, off;
+  char* name;
+  FILE* f;
+  
+  if (f = fopen(STATE_PATHNAME, "re"), f == NULL)
+    {
+      if (errno != ENOENT)
+	perror(*argv);
+      return;
+    }
+  unlink(STATE_PATHNAME);
+  
+  while (fgets(line, (int)sizeof(line), f) != NULL)
+    {
+      off = 0;
+      sscanf(line, "%15s %jd %jd %i %zu %n", state_name, &launcher, &pid, &restart, &fds, &off);
+      name = line + off;
+      
+      /* The sockets are claimed when the service is registered. */
+      for (j = 0; (j < fds) && off; j++)
+	{
+	  off = 0;
+	  sscanf(name, "%i %n", &fd, &off);
+	  name += off;
+	  if (off && (listener_inherit(fd) < 0))
+	    perror(*argv);
+	}
+      name[strcspn(name, "\n")] = '\0';
+      for (i = SERVICE_STOPPED; i <= SERVICE_WAITING; i++)
+	if (!strcmp(state_name, service_state_name((enum service_state)i)))
+	  break;
+      if ((off == 0) || (*name == '\0') || (i > SERVICE_WAITING))
+	{
+	  fprintf(stderr, "%s: %s: invalid line\n", *argv, STATE_PATHNAME);
+	  continue;
+	}
+      
+      if (service = service_obtain(name), service == NULL)
+	{
+	  if (errno)
+	    perror(*argv);
+	  fprintf(stderr, "%s: could not take over %s\n", *argv, name);
+	  continue;
+	}
+      service_adopt(service, (enum service_state)i, (pid_t)launcher, (pid_t)pid, restart, now);
+    }
+  
+  if (ferror(f))
+    perror(*argv);
+  fclose(f);
+  listener_forget_inherited();
+}
+
+
+/**
+ * Register the services whose descriptors have eager or lazy
+ * activation, and start those with eager activation
+ * 
+ * @param   spawn  Whether services with eager activation shall be started,
+ *                 otherwise daemond has re-executed, and the services
+ *                 that were running are taken over
+ * @return         Zero on success, -1 on error
+ */
+int service_register(int spawn)
+{
+  size_t i, n, suffix = strlen(DESCRIPTOR_SUFFIX);
+  struct descriptor descriptor;
+  struct service* service;
+  struct dirent* file;
+  struct timespec now;
+  int saved_errno;
+  DIR* dir;
+  
+  if (descriptor_cache_open() < 0)
+    perror(*argv);
+  
+  if (dir = opendir(DAEMONDIR), dir == NULL)
+    return errno == ENOENT ? 0 : -1;
+  
+  timer_now(&now);
+  if (!spawn)
+    service_take_over(&now);
+  
+  while (errno = 0, file = readdir(dir), file != NULL)
+    {
+      n = strlen(file->d_name);
+      if ((*(file->d_name) == '.') || (n <= suffix) || strcmp(file->d_name + n - suffix, DESCRIPTOR_SUFFIX))
+	continue;
+      file->d_name[n - suffix] = '\0';
+      
+      /* Services that have been taken over, or that are required by
+	 services that have already been started, have been registered. */
+      if (service_find(file->d_name) != NULL)
+	continue;
+      if (descriptor_load(file->d_name, &descriptor) < 0)
+	{
+	  if (errno)
+	    perror(*argv);
+	  continue;
+	}
+      if (descriptor.activation == DESCRIPTOR_ACTIVATION_MANUAL)
+	{
+	  descriptor_destroy(&descriptor);
+	  continue;
+	}
+      
+      /* A template registers its first instances, NAME@1 to NAME@N. */
+      for (i = 1; i <= (is_template(file->d_name) ? (size_t)descriptor.instances : 1); i++)
+	{
+	  char instance[n + 3 * sizeof(size_t) + 1];
+	  char* name = file->d_name;
+	  if (is_template(file->d_name))
+	    {
+	      sprintf(instance, "%s%zu", file->d_name, i);
+	      if (service_find(name = instance) != NULL)
+		continue;
+	    }
+	  if (service = service_register_descriptor(name, &descriptor), service == NULL)
+	    {
+	      saved_errno = errno;
+	      descriptor_destroy(&descriptor);
+	      closedir(dir);
+	      return errno = saved_errno, -1;
+	    }
+	  if (spawn && (descriptor.activation == DESCRIPTOR_ACTIVATION_EAGER))
+	    service_start(service, &now);
+	  else
+	    service_rest(service, 1);
+	}
+      descriptor_destroy(&descriptor);
+    }
+  
+  saved_errno = errno;
+  closedir(dir);
+  if (descriptor_cache_save() < 0)
+    perror(*argv);
+  return errno = saved_errno, saved_errno ? -1 : 0;
+}
+
+
+/**
+ * Write down the state of the services, so that they can be
+ * taken over by the program daemond is re-executing into,
+ * and let their sockets be inherited by it
+ * 
+ * Services that are waiting to be started are listed last,
+ * so that the services they require have been taken over
+ * before they are started
+ * 
+ * @return  Zero on success, -1 on error
+ */
+int service_hand_over(void)
+{
+  struct service* service;
+  int pass, saved_errno;
+  size_t i, j;
+  FILE* f;
+  
+  if (f = fopen(STATE_PATHNAME, "we"), f == NULL)
+    return -1;
+  
+  for (pass = 0; pass < 2; pass++)
+    for (i = 0; i < service_count; i++)
+      {
+	service = services[i];
+	if (((service->state == SERVICE_STOPPED) && !service->listen_count) || strchr(service->name, '\n'))
+	  continue;
+	if (((service->state == SERVICE_BACKOFF) || (service->state == SERVICE_WAITING)) != pass)
+	  continue;
+	fprintf(f, "%s %ji %ji %i %zu", service_state_name(service->state),
+		(intmax_t)(service->launcher), (intmax_t)(service->pid), service->restart, service->listen_count);
+	for (j = 0; j < service->listen_count; j++)
+	  {
+	    fprintf(f, " %i", service->listen_fds[j]);
+	    if (fcntl(service->listen_fds[j], F_SETFD, 0) < 0)
+	      {
+		saved_errno = errno;
+		fclose(f);
+		service_take_back();
+		return errno = saved_errno, -1;
+	      }
+	  }
+	fprintf(f, " %s\n", service->name);
+      }
+  
+  if (fflush(f) || ferror(f))
+    {
+      saved_errno = errno;
+      fclose(f);
+      goto fail;
+    }
+  if (fclose(f))
+    {
+      saved_errno = errno;
+      goto fail;
+    }
+  return 0;
+  
+ fail:
+  service_take_back();
+  return errno = saved_errno, -1;
+}
+
+
+/**
+ * Keep the services after a failed re-exec, undoing `service_hand_over`
+ */
+void service_take_back(void)
+{
+  size_t i, j;
+  
+  /* A later re-exec writes a new file, but do not leave a stale one behind. */
+  unlink(STATE_PATHNAME);
+  
+  /* The sockets must not be inherited by the daemons. */
+  for (i = 0; i < service_count; i++)
+    for (j = 0; j < services[i]->listen_count; j++)
+      fcntl(services[i]->listen_fds[j], F_SETFD, FD_CLOEXEC);
+}
+
+
+/**
+ * Perform a control request
+ * 
+ * @param   arguments  `NULL`-terminated list of arguments, the verb first,
+ *                     then the name of the daemon, followed by optional
+ *                     additional script-dependent arguments
+ * @return             The return value for `main`, -1 if the caller should not return
+ */
+int service_control(char** restrict arguments)
+{
+  const char* verb = arguments[0];
+  struct descriptor descriptor;
+  struct service* service;
+  char*** deferred;
+  struct timespec now;
+  
+  if (!strcmp(verb, "shutdown"))
+    return service_shutdown(arguments);
+  
+  if (arguments[1] == NULL)
+    return fprintf(stderr, "%s: received invalid message\n", *argv), -1;
+  
+  if (!strcmp(verb, "scale"))
+    return service_scale(arguments);
+  if (is_template(arguments[1]))
+    return fprintf(stderr, "%s: %s is a template, not a daemon\n", *argv, arguments[1]), -1;
+  
+  timer_now(&now);
+  service = service_find(arguments[1]);
+  
+  if (!strcmp(verb, "try-restart") && ((service == NULL) || (service->state != SERVICE_RUNNING)))
+    return fprintf(stderr, "%s: %s is not running\n", *argv, arguments[1]), -1;
+  
+  if ((!strcmp(verb, "start") || !strcmp(verb, "restart") || !strcmp(verb, "try-restart")) && shutting_down)
+    return fprintf(stderr, "%s: cannot start %s while shutting down\n", *argv, arguments[1]), -1;
+  
+  if (!strcmp(verb, "start") || !strcmp(verb, "restart") || !strcmp(verb, "try-restart"))
+    {
+      if (descriptor_load(arguments[1], &descriptor) < 0)
+	return errno ? perror(*argv), -1 : -1;
+      if (descriptor_cache_save() < 0)
+	perror(*argv);
+      
+      if (service == NULL)
+	{
+	  if (service = service_add(arguments), service == NULL)
+	    return perror(*argv), descriptor_destroy(&descriptor), -1;
+	}
+      else if (service_set_arguments(service, arguments) < 0)
+	return perror(*argv), descriptor_destroy(&descriptor), -1;
+      
+      if (service_listen(service, &descriptor) < 0)
+	return perror(*argv), descriptor_destroy(&descriptor), -1;
+      service_set_descriptor(service, &descriptor);
+      
+      if (service->state == SERVICE_STOPPING)
+	service->restart = 1, service->idled = 0;
+      else if ((service->state == SERVICE_STARTING) || (service->state == SERVICE_WAITING))
+	service->stop = 0;
+      else if ((service->state == SERVICE_STOPPED) && descriptor.listen_start && service->listen_count)
+	service_rest(service, 1);
+      else if (service->state != SERVICE_RUNNING)
+	service_start(service, &now);
+      else if (!strcmp(verb, "start"))
+	fprintf(stderr, "%s: %s is already running\n", *argv, service->name);
+      else
+	{
+	  service->restart = 1;
+	  if (service_stop(service, NULL) < 0)
+	    perror(*argv);
+	}
+    }
+  else if (!strcmp(verb, "stop"))
+    {
+      /* A service that daemond is not tracking may still be running, if it
+	 was started before daemond was resurrected, the daemon script can
+	 find out. */
+      if ((service == NULL) || (service->state == SERVICE_STOPPED))
+	{
+	  if (NATIVE_LIFECYCLE)
+	    fprintf(stderr, "%s: %s is not running\n", *argv, arguments[1]);
+	  else if (service_run_script(service, arguments) < 0)
+	    perror(*argv);
+	}
+      else if (service->state == SERVICE_BACKOFF)
+	{
+	  service->metrics.backoff_time += (unsigned long long)timer_diff(&service->backoff_start, &now);
+	  service_rest(service, 0);
+	}
+      else if ((service->state == SERVICE_LISTENING) || (service->state == SERVICE_WAITING))
+	service_rest(service, 0);
+      else if (service->state == SERVICE_STARTING)
+	service->stop = 1, service->restart = 0;
+      else if (service->state == SERVICE_STOPPING)
+	service->restart = 0, service->idled = 0;
+      else if (cgroup_enabled() && is_force_stop(arguments))
+	{
+	  /* Kill the service and all its descendants atomically. */
+	  service->state = SERVICE_STOPPING;
+	  service->restart = 0;
+	  if (cgroup_kill(service->name) < 0)
+	    perror(*argv);
+	}
+      else
+	{
+	  service->restart = 0;
+	  if (service_stop(service, arguments) < 0)
+	    perror(*argv);
+	}
+    }
+  else if ((service != NULL) && strcmp(verb, "status") && service_demanded(service, &now))
+    {
+      /* Run the request once the service has been started on demand. */
+      if (deferred = realloc(service->deferred, (service->deferred_count + 1) * sizeof(char**)), deferred == NULL)
+	return perror(*argv), -1;
+      service->deferred = deferred;
+      if (deferred[service->deferred_count] = copy_arguments(NULL, arguments), deferred[service->deferred_count] == NULL)
+	return perror(*argv), -1;
+      service->deferred_count++;
+    }
+  else if ((service == NULL) || !service_control_natively(service, arguments))
+    {
+      if (service_run_script(service, arguments) < 0)
+	perror(*argv);
+    }
+  
+  if ((service != NULL) && (service->state == SERVICE_RUNNING))
+    service_active(service, &now);
+  
+  return -1;
+}
+
+
+/**
+ * Apply a template descriptor that has been modified, added or
+ * removed, to each instance of the template that is known,
+ * or register the first instances of a new template
+ * 
+ * @param   name     The name of the template, NAME@
+ * @param   removed  Whether the descriptor has been removed
+ * @return           The return value for `main`, -1 if the caller should not return
+ */
+static int service_reconfigure_template(const char* restrict name, int removed)
+{
+  size_t i, n = strlen(name), known = 0;
+  char instance[NAME_MAX + 1];
+  struct descriptor descriptor;
+  int r;
+  
+  for (i = 0; i < service_count; i++)
+    if (!strncmp(services[i]->name, name, n) && services[i]->name[n] && (strlen(services[i]->name) <= NAME_MAX))
+      {
+	known = 1;
+	strcpy(instance, services[i]->name);
+	if (r = service_reconfigure(instance, removed), r >= 0)
+	  return r;
+      }
+  if (known || removed || (n + 3 * sizeof(size_t) > NAME_MAX))
+    return -1;
+  
+  if (descriptor_load(name, &descriptor) < 0)
+    return errno ? perror(*argv), -1 : -1;
+  n = (size_t)descriptor.instances;
+  descriptor_destroy(&descriptor);
+  for (i = 1; i <= n; i++)
+    {
+      sprintf(instance, "%s%zu", name, i);
+      if (r = service_reconfigure(instance, 0), r >= 0)
+	return r;
+    }
+  return -1;
+}
+
+
+/**
+ * Apply a descriptor that has been modified or added, and read,
+ * only a service that has not been registered is started
+ * 
+ * @param   service     The service, `NULL` if it has not been registered
+ * @param   name        The name of the service
+ * @param   descriptor  The new descriptor, must still be released with
+ *                      `descriptor_destroy`
+ * @param   now         The current time
+ * @return              The return value for `main`, -1 if the caller should not return
+ */
+static int service_reconfigure_loaded(struct service* restrict service, char* restrict name,
+				      struct descriptor* restrict descriptor, const struct timespec* restrict now)
+{
+  /* A stopped service may have been stopped deliberately, it is
+     only started again when that is requested. */
+  if ((service != NULL) && (service->state == SERVICE_STOPPED))
+    return service_set_descriptor(service, descriptor), -1;
+  
+  if (service == NULL)
+    {
+      /* Register the service as if daemond had just started. */
+      if (descriptor->activation == DESCRIPTOR_ACTIVATION_MANUAL)
+	return -1;
+      if (service = service_register_descriptor(name, descriptor), service == NULL)
+	return perror(*argv), 1;
+      if (descriptor->activation == DESCRIPTOR_ACTIVATION_EAGER)
+	service_start(service, now);
+      else
+	service_rest(service, 1);
+      return -1;
+    }
+  
+  if (descriptor_spawn_differs(&(service->descriptor), descriptor) &&
+      ((service->state == SERVICE_RUNNING) || (service->state == SERVICE_STARTING)))
+    {
+      if (service_listen(service, descriptor) < 0)
+	return perror(*argv), -1;
+      service_set_descriptor(service, descriptor);
+      fprintf(stderr, "%s: descriptor of %s modified, restarting\n", *argv, name);
+      service->restart = 1;
+      if (service->state == SERVICE_STARTING)
+	service->stop = 1;
+      else if (service_stop(service, NULL) < 0)
+	perror(*argv);
+      return -1;
+    }
+  
+  /* Nothing that requires a restart has changed. */
+  if (service_listen(service, descriptor) < 0)
+    return perror(*argv), -1;
+  service_set_descriptor(service, descriptor);
+  if (cgroup_enabled() && ((service->state == SERVICE_RUNNING) || (service->state == SERVICE_STARTING)))
+    if (descriptor_apply_cgroup(name, &(service->descriptor)) < 0)
+      perror(*argv);
+  if (service->state == SERVICE_LISTENING)
+    service_rest(service, 1);
+  
+  return -1;
+}
+
+
+/**
+ * Apply a descriptor that has been modified, added or removed,
+ * only doing what the change requires: a service is restarted
+ * only if what is applied when it is spawned has changed
+ * 
+ * @param   name     The name of the service
+ * @param   removed  Whether the descriptor has been removed
+ * @return           The return value for `main`, -1 if the caller should not return
+ */
+int service_reconfigure(char* restrict name, int removed)
+{
+  char* stop_arguments[] = { stop_verb, name, NULL };
+  struct service* service = service_find(name);
+  struct descriptor descriptor;
+  struct timespec now;
+  int r;
+  
+  if (is_template(name))
+    return service_reconfigure_template(name, removed);
+  
+  timer_now(&now);
+  
+  /* Services that are only started on request keep running. */
+  if (removed)
+    {
+      if ((service == NULL) || (service->descriptor.activation == DESCRIPTOR_ACTIVATION_MANUAL))
+	return -1;
+      service->descriptor.activation = DESCRIPTOR_ACTIVATION_MANUAL;
+      service->descriptor.listen_start = 0;
+      if (service->state == SERVICE_STOPPED)
+	return -1;
+      fprintf(stderr, "%s: descriptor of %s removed, stopping\n", *argv, name);
+      return service_control(stop_arguments);
+    }
+  
+  if (descriptor_load(name, &descriptor) < 0)
+    return errno ? perror(*argv), -1 : -1;
+  r = service_reconfigure_loaded(service, name, &descriptor, &now);
+  descriptor_destroy(&descriptor);
+  return r;
+}
+
+
+/**
+ * Recompile the environtab after it has been modified, so that
+ * errors are reported immediately rather than when a service is
+ * spawned, running services are not restarted
+ */
+void service_environment_changed(void)
+{
+  if (environtab_refresh(ENVIRONTAB, &environment) < 0)
+    perror(*argv);
+}
+
+
+/**
+ * Update the services after a process has been reaped
+ * 
+ * @param   pid     The reaped process
+ * @param   status  The status of the process, as returned by `waitpid`
+ * @return          Zero if the process belonged to a service, 1 otherwise
+ */
+int service_reaped(pid_t pid, int status)
+{
+  struct service* service = service_find_pid(pid);
+  struct timespec now;
+  
+  if (service == NULL)
+    return health_reaped(pid, status);
+  
+  timer_now(&now);
+  if (service->launcher == pid)
+    service_launched(service, status, &now);
+  else
+    service_died(service, status, &now);
+  
+  return 0;
+}
+
+
+/**
+ * Stop a service if it has been idle for too long
+ * 
+ * A service is idle if no control requests have been made
+ * for it, no running service requires it, and it has used
+ * almost no CPU time
+ * 
+ * @param  service  The service
+ * @param  now      The current time
+ */
+static void service_check_idle(struct service* restrict service, const struct timespec* restrict now)
+{
+  long long period = service->descriptor.idle_stop * NANOSECONDS;
+  struct timespec deadline = service->idle_since;
+  long long cpu;
+  
+  timer_add(&deadline, period);
+  if (timer_diff(&deadline, now) < 0)
+    {
+      timer_wakeup_at(&deadline);
+      return;
+    }
+  
+  cpu = service_cpu_time(service);
+  if ((cpu < 0) || (service->idle_cpu < 0) || (cpu - service->idle_cpu > period / IDLE_CPU_SHARE) || service_required(service))
+    {
+      service->idle_since = *now;
+      service->idle_cpu = cpu;
+      deadline = *now;
+      timer_add(&deadline, period);
+      timer_wakeup_at(&deadline);
+      return;
+    }
+  
+  fprintf(stderr, "%s: %s has been idle for %i seconds, stopping\n", *argv, service->name, service->descriptor.idle_stop);
+  service->idled = 1;
+  service->restart = 0;
+  if (service_stop(service, NULL) < 0)
+    perror(*argv);
+}
+
+
+/**
+ * Restart a service if it has failed too many health checks in a row
+ * 
+ * @param  service  The service, must be running
+ * @param  now      The current time
+ */
+static void service_check_health(struct service* restrict service, const struct timespec* restrict now)
+{
+  if (!health_tick(service, now))
+    return;
+  
+  fprintf(stderr, "%s: %s is unhealthy, restarting\n", *argv, service->name);
+  service->metrics.restarts++;
+  metrics.restarts++;
+  event_emit(service, EVENT_RESTARTING, (long long)(service->metrics.restarts));
+  
+  health_cancel(service);
+  service->health.restarting = 1;
+  service->restart = 1;
+  if (service_stop(service, NULL) < 0)
+    perror(*argv);
+}
+
+
+/**
+ * Kill a service that is being restarted because it is unhealthy,
+ * if it has not stopped within its health check timeout, as
+ * it may be too hung to stop by itself
+ * 
+ * @param  service  The service, must be stopping
+ * @param  now      The current time
+ */
+static void service_check_stopped(struct service* restrict service, const struct timespec* restrict now)
+{
+  struct timespec deadline = service->stop_requested;
+  
+  timer_add(&deadline, health_timeout(service));
+  if (timer_diff(&deadline, now) < 0)
+    {
+      timer_wakeup_at(&deadline);
+      return;
+    }
+  
+  service->health.restarting = 0;
+  service_kill(service);
+}
+
+
+/**
+ * Check whether all services have stopped since the last shutdown began
+ * 
+ * @return  Whether the last shutdown has completed
+ */
+int service_shutdown_completed(void)
+{
+  return shutdown_completed;
+}
+
+
+/**
+ * Restart services that are done backing off, start
+ * services that have pending connections on their
+ * sockets, and schedule the next time this should be done
+ * 
+ * @param  now  The current time
+ */
+void service_tick(const struct timespec* restrict now)
+{
+  long long backoff;
+  size_t i;
+  int r;
+  if (shutting_down)
+    service_shutdown_proceed(now);
+  for (i = 0; i < service_count; i++)
+    if (services[i]->state == SERVICE_BACKOFF)
+      {
+	if (timer_diff(&services[i]->backoff_end, now) < 0)
+	  timer_wakeup_at(&services[i]->backoff_end);
+	else
+	  {
+	    /* The services it requires may have stopped, but the
+	       backoff keeps growing while it dies too fast. */
+	    backoff = services[i]->backoff;
+	    if (service_start(services[i], now) == 0)
+	      services[i]->backoff = backoff;
+	  }
+      }
+    else if (services[i]->state == SERVICE_LISTENING)
+      {
+	if (r = listener_pending(services[i]->listen_fds, services[i]->listen_count), r < 0)
+	  perror(*argv);
+	else if (r)
+	  service_start(services[i], now);
+      }
+    else if (services[i]->state == SERVICE_RUNNING)
+      {
+	if (services[i]->descriptor.idle_stop)
+	  service_check_idle(services[i], now);
+	if (services[i]->state == SERVICE_RUNNING)
+	  service_check_health(services[i], now);
+      }
+    else if ((services[i]->state == SERVICE_STOPPING) && services[i]->health.restarting)
+      service_check_stopped(services[i], now);
+}
+
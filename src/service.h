@@ -0,0 +1,329 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef DAEMOND_SERVICE_H
+#define DAEMOND_SERVICE_H
+
+
+#include "metrics.h"
+#include "descriptor.h"
+#include "health.h"
+
+#include <sys/types.h>
+#include <time.h>
+
+
+
+/**
+ * The state of a service
+ */
+enum service_state
+  {
+    /**
+     * The service is not running
+     */
+    SERVICE_STOPPED,
+    
+    /**
+     * The service has been spawned but
+     * has not yet signalled readiness
+     */
+    SERVICE_STARTING,
+    
+    /**
+     * The service is running
+     */
+    SERVICE_RUNNING,
+    
+    /**
+     * The service has been requested to stop
+     */
+    SERVICE_STOPPING,
+    
+    /**
+     * The service died too fast and is
+     * waiting before it is restarted
+     */
+    SERVICE_BACKOFF,
+    
+    /**
+     * The service is not running, but daemond is
+     * listening on its sockets and will start it
+     * when a connection is made
+     */
+    SERVICE_LISTENING,
+    
+    /**
+     * The service is waiting for the services
+     * it requires to start before it is spawned
+     */
+    SERVICE_WAITING
+  };
+
+
+/**
+ * A service managed by daemond
+ */
+struct service
+{
+  /**
+   * The name of the service
+   */
+  char* name;
+  
+  /**
+   * `NULL`-terminated list of arguments for `start_daemon`
+   */
+  char** arguments;
+  
+  /**
+   * The state of the service
+   */
+  enum service_state state;
+  
+  /**
+   * The PID of the process that is running `start_daemon`,
+   * zero if the service is not starting
+   */
+  pid_t launcher;
+  
+  /**
+   * The PID of the service, zero if not running
+   */
+  pid_t pid;
+  
+  /**
+   * Whether the service should be started
+   * again once it has stopped
+   */
+  int restart;
+  
+  /**
+   * Whether the service should be stopped
+   * as soon as it has become ready
+   */
+  int stop;
+  
+  /**
+   * The exit status of the last death, as returned by `waitpid`
+   */
+  int last_status;
+  
+  /**
+   * When the service was spawned
+   */
+  struct timespec spawned;
+  
+  /**
+   * When the service became ready
+   */
+  struct timespec started;
+  
+  /**
+   * When the service entered `SERVICE_BACKOFF`
+   */
+  struct timespec backoff_start;
+  
+  /**
+   * When the service should leave `SERVICE_BACKOFF`
+   */
+  struct timespec backoff_end;
+  
+  /**
+   * The current backoff time in nanoseconds
+   */
+  long long backoff;
+  
+  /**
+   * When the service was requested to stop
+   */
+  struct timespec stop_requested;
+  
+  /**
+   * Supervision counters for the service
+   */
+  struct service_metrics metrics;
+  
+  /**
+   * The scheduling attributes and resource
+   * limits declared for the service
+   */
+  struct descriptor descriptor;
+  
+  /**
+   * The sockets daemond listens on for the service,
+   * corresponding to the first elements of
+   * `descriptor.listen`
+   */
+  int listen_fds[DESCRIPTOR_MAX_LISTEN];
+  
+  /**
+   * The number of elements in `listen_fds`
+   */
+  size_t listen_count;
+  
+  /**
+   * Whether the service is being stopped
+   * because it has been idle
+   */
+  int idled;
+  
+  /**
+   * When the service was last seen being active
+   */
+  struct timespec idle_since;
+  
+  /**
+   * The consumed CPU time, in nanoseconds, of the
+   * service at `idle_since`, -1 if unknown
+   */
+  long long idle_cpu;
+  
+  /**
+   * The health checking of the service
+   */
+  struct health_probe health;
+  
+  /**
+   * Control requests, each a `NULL`-terminated
+   * list of arguments, that are run once the
+   * service has started
+   */
+  char*** deferred;
+  
+  /**
+   * The number of elements in `deferred`
+   */
+  size_t deferred_count;
+};
+
+
+
+/**
+ * All known services
+ */
+extern struct service** services;
+
+/**
+ * The number of elements in `services`
+ */
+extern size_t service_count;
+
+/**
+ * Whether services are stopped by signalling their
+ * process groups, rather than only their main processes
+ */
+extern int service_signal_groups;
+
+
+
+/**
+ * Get the name of a service state
+ * 
+ * @param   state  The state
+ * @return         The name of the state
+ */
+const char* service_state_name(enum service_state state) __attribute__((const));
+
+/**
+ * Find a service by its name
+ * 
+ * @param   name  The name of the service
+ * @return        The service, `NULL` if not found
+ */
+struct service* service_find(const char* restrict name) __attribute__((pure));
+
+/**
+ * Register the services whose descriptors have eager or lazy
+ * activation, and start those with eager activation
+ * 
+ * @param   spawn  Whether services with eager activation shall be started,
+ *                 otherwise daemond has re-executed, and the services
+ *                 that were running are taken over
+ * @return         Zero on success, -1 on error
+ */
+int service_register(int spawn);
+
+/**
+ * Write down the state of the services, so that they can be
+ * taken over by the program daemond is re-executing into
+ * 
+ * @return  Zero on success, -1 on error
+ */
+int service_hand_over(void);
+
+/**
+ * Keep the services after a failed re-exec, undoing `service_hand_over`
+ */
+void service_take_back(void);
+
+/**
+ * Perform a control request
+ * 
+ * @param   arguments  `NULL`-terminated list of arguments, the verb first,
+ *                     then the name of the daemon, followed by optional
+ *                     additional script-dependent arguments
+ * @return             The return value for `main`, -1 if the caller should not return
+ */
+int service_control(char** restrict arguments);
+
+/**
+ * Apply a descriptor that has been modified, added or removed,
+ * only doing what the change requires: a service is restarted
+ * only if what is applied when it is spawned has changed
+ * 
+ * @param   name     The name of the service
+ * @param   removed  Whether the descriptor has been removed
+ * @return           The return value for `main`, -1 if the caller should not return
+ */
+int service_reconfigure(char* restrict name, int removed);
+
+/**
+ * Recompile the environtab after it has been modified, so that
+ * errors are reported immediately rather than when a service is
+ * spawned, running services are not restarted
+ */
+void service_environment_changed(void);
+
+/**
+ * Update the services after a process has been reaped
+ * 
+ * @param   pid     The reaped process
+ * @param   status  The status of the process, as returned by `waitpid`
+ * @return          Zero if the process belonged to a service, 1 otherwise
+ */
+int service_reaped(pid_t pid, int status);
+
+/**
+ * Check whether all services have stopped since the last shutdown began
+ * 
+ * @return  Whether the last shutdown has completed
+ */
+int service_shutdown_completed(void) __attribute__((pure));
+
+/**
+ * Restart services that are done backing off, start
+ * services that have pending connections on their
+ * sockets, and schedule the next time this should be done
+ * 
+ * @param  now  The current time
+ */
+void service_tick(const struct timespec* restrict now);
+
+
+#endif
+
@@ -0,0 +1,93 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "slab.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+
+/**
+ * Make sure that a number of objects can be
+ * taken from a slab without allocating memory
+ * 
+ * @param   slab   The slab
+ * @param   count  The number of objects
+ * @return         Zero on success, -1 on error
+ */
+int slab_reserve(struct slab* restrict slab, size_t count)
+{
+  size_t available = slab->capacity - slab->used;
+  size_t i, n;
+  char* chunk;
+  
+  if (count <= available)
+    return 0;
+  
+  /* Allocate whole chunks, the memory is never returned to the heap. */
+  n = count - available;
+  n = (n + slab->chunk - 1) / slab->chunk * slab->chunk;
+  if (chunk = malloc(n * slab->size), chunk == NULL)
+    return -1;
+  
+  for (i = n; i--;)
+    {
+      *(void**)(void*)(chunk + i * slab->size) = slab->free;
+      slab->free = chunk + i * slab->size;
+    }
+  slab->capacity += n;
+  return 0;
+}
+
+
+/**
+ * Take a zero-initialised object from a slab
+ * 
+ * @param   slab  The slab
+ * @return        The object, `NULL` on error
+ */
+void* slab_alloc(struct slab* restrict slab)
+{
+  void* object;
+  
+  if ((slab->free == NULL) && (slab_reserve(slab, 1) < 0))
+    return NULL;
+  
+  object = slab->free;
+  slab->free = *(void**)object;
+  slab->used++;
+  return memset(object, 0, slab->size);
+}
+
+
+/**
+ * Return an object to the slab it was taken from
+ * 
+ * @param  slab    The slab
+ * @param  object  The object, may be `NULL`
+ */
+void slab_free(struct slab* restrict slab, void* restrict object)
+{
+  if (object == NULL)
+    return;
+  
+  *(void**)object = slab->free;
+  slab->free = object;
+  slab->used--;
+}
+
@@ -0,0 +1,110 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef DAEMOND_SLAB_H
+#define DAEMOND_SLAB_H
+
+
+#include <stddef.h>
+
+
+
+/**
+ * The alignment of the objects in a slab
+ */
+#define SLAB_ALIGN  __BIGGEST_ALIGNMENT__
+
+/**
+ * Static initialiser for `struct slab`
+ * 
+ * @param  type   The type of the objects
+ * @param  chunk  The number of objects to allocate at a time
+ */
+#define SLAB_INITIALISER(type, chunk)						\
+  { (sizeof(type) + SLAB_ALIGN - 1) / SLAB_ALIGN * SLAB_ALIGN, chunk, NULL, 0, 0 }
+
+
+
+/**
+ * A cache of objects of one type
+ * 
+ * Objects are allocated in chunks that are never freed,
+ * and objects that are freed are kept for reuse, so the
+ * memory used for the objects never exceeds what was
+ * needed when most objects were in use at once, and
+ * it is not fragmented by other allocations
+ */
+struct slab
+{
+  /**
+   * The size of each object, including padding
+   */
+  size_t size;
+  
+  /**
+   * The number of objects to allocate at a time
+   */
+  size_t chunk;
+  
+  /**
+   * Linked list of free objects, each free
+   * object begins with a pointer to the next
+   */
+  void* free;
+  
+  /**
+   * The number of objects that have been allocated
+   */
+  size_t capacity;
+  
+  /**
+   * The number of objects in use
+   */
+  size_t used;
+};
+
+
+
+/**
+ * Make sure that a number of objects can be
+ * taken from a slab without allocating memory
+ * 
+ * @param   slab   The slab
+ * @param   count  The number of objects
+ * @return         Zero on success, -1 on error
+ */
+int slab_reserve(struct slab* restrict slab, size_t count);
+
+/**
+ * Take a zero-initialised object from a slab
+ * 
+ * @param   slab  The slab
+ * @return        The object, `NULL` on error
+ */
+void* slab_alloc(struct slab* restrict slab);
+
+/**
+ * Return an object to the slab it was taken from
+ * 
+ * @param  slab    The slab
+ * @param  object  The object, may be `NULL`
+ */
+void slab_free(struct slab* restrict slab, void* restrict object);
+
+
+#endif
+
@@ -15,7 +15,10 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#define _GNU_SOURCE
 #include "config.h"
+#include "environtab.h"
+#include "timer.h"
 
 #include <unistd.h>
 #include <stdio.h>
@@ -43,12 +46,34 @@ static char** argv;
  */
 static pid_t pid;
 
+/**
+ * File descriptor, opened with `O_PATH`, for
+ * our directory inside RUNDIR, -1 when closed
+ */
+static int rundir = -1;
+
+/**
+ * The signal mask before SIGCHLD was blocked,
+ * but with SIGCHLD unblocked
+ */
+static sigset_t original_mask;
+
+/**
+ * Whether to print how long each startup phase takes
+ */
+static int time_startup = 0;
+
+/**
+ * When the current startup phase began
+ */
+static struct timespec phase_start;
+
 
 
 /**
  * This function will be called in the parent
  * process when a signal is catched. It is only
- * here to make sure `pause` gets interrupted.
+ * here to make sure `sigsuspend` gets interrupted.
  * 
  * @param  signo  The caught signal
  */
@@ -59,39 +84,42 @@ static void parent_handle_signal(int signo)
 
 
 /**
- * Use some proper randomness to seed the randomness
+ * Announce how long the latest startup phase took,
+ * if `--time-startup` was used
+ * 
+ * @param  phase  The name of the phase that just completed
  */
-static void seed_random(void)
+static void phase_done(const char* phase)
 {
-  void* ap = malloc(1);
-  void* bp = malloc(1);
-  unsigned int a = (unsigned int)(long)ap;
-  unsigned int b = (unsigned int)(long)bp;
-  unsigned int c = (unsigned int)time(NULL);
-  free(ap);
-  free(bp);
-  b = (b << (4 * sizeof(unsigned int)))
-    | (b >> (4 * sizeof(unsigned int)));
-  srand(a ^ b ^ c);
+  struct timespec now;
+  if (!time_startup)
+    return;
+  timer_now(&now);
+  fprintf(stderr, "%s: %s: %lli us\n", *argv, phase, timer_diff(&phase_start, &now) / 1000);
+  phase_start = now;
 }
 
 
 /**
- * Generate a System V IPC key
+ * Derive the System V IPC key of the message queue from the
+ * identity of our directory inside RUNDIR, in the spirit of `ftok`
+ * 
+ * Unlike `ftok`, all bits of the device and inode numbers
+ * are mixed into the key. Every start of the same instance
+ * derives the same key, and thus uses the same queue.
+ * The key is folded into 31 bits, so distinct instances
+ * can, although unlikely, get the same key
  * 
- * @return  The generated key
+ * @param   st  The status of the directory
+ * @return      The key, never `IPC_PRIVATE`
  */
-static key_t generate_key(void)
+static key_t derive_key(const struct stat* st)
 {
-  key_t key = IPC_PRIVATE;
-  long long max = 1LL << (8 * sizeof(key_t) - 2);
-  max |= max - 1;
-  while (key == IPC_PRIVATE)
-    {
-      int rnd = rand();
-      key = (key_t)((double)rnd / ((double)RAND_MAX + 1) * (double)(max - 1)) + 1;
-    }
-  return key;
+  uint64_t h = (uint64_t)st->st_dev * 0x9E3779B97F4A7C15ULL;
+  h ^= (uint64_t)st->st_ino + 0x632BE59BD9B4E019ULL + (h << 6) + (h >> 2);
+  h ^= h >> 29, h *= 0xBF58476D1CE4E5B9ULL, h ^= h >> 32;
+  h &= 0x7FFFFFFFULL;
+  return (key_t)(h ? h : 1);
 }
 
 
@@ -104,215 +132,175 @@ static key_t generate_key(void)
  */
 static int mkdirs(const char* pathname, mode_t mode)
 {
-  char* path = strdup(pathname);
-  size_t s, n = strlen(pathname);
-  char* p;
-  
-  if (path == NULL)
-    return -1;
-  
-  while ((p = strrchr(path, '/')))
-    *p = '\0';
+  char path[strlen(pathname) + 1];
+  char* p = path;
   
-  for (; s = strlen(path), s < n; path[s] = '/')
-    if (mkdir(path, mode) < 0)
-      if (errno != EEXIST)
-	return free(path), -1;
+  strcpy(path, pathname);
+  while ((p = strchr(p + 1, '/')))
+    {
+      *p = '\0';
+      if (mkdir(path, mode) < 0)
+	if (errno != EEXIST)
+	  return -1;
+      *p = '/';
+    }
   
-  return free(path), mkdir(pathname, mode);
+  return mkdir(path, mode);
 }
 
 
 /**
- * Create a System V message queue
+ * Open our directory inside RUNDIR, creating it if it is missing
  * 
- * @return  Zero on success, the value with which `main` should return on failure
+ * The directory normally only needs to be created at the
+ * first start after boot, so the first `open` is all it
+ * takes in the common case
+ * 
+ * @return  Zero on success, -1 on error
  */
-static int create_mqueue(void)
+static int open_rundir(void)
 {
-  char buf[3 * sizeof(key_t) + 2];
-  int fd = -1, saved_errno, mqueue_id;
-  key_t mqueue_key;
-  size_t n;
+  int parent, saved_errno;
   
-  /* Create a System V message queue with a random key. */
-  seed_random();
- retry_mqueue:
-  mqueue_key = generate_key();
-  mqueue_id = msgget(mqueue_key, 0750 | IPC_CREAT | IPC_EXCL);
-  if (mqueue_id < 0)
-    {
-      if (errno == EEXIST)
-	goto retry_mqueue;
-      else
-	return 1;
-    }
+  rundir = open(RUNDIR "/" PKGNAME, O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (rundir >= 0)
+    return 0;
+  if (errno != ENOENT)
+    return -1;
   
-  /* Store the key in a file. */
-  fd = open(RUNDIR "/" PKGNAME "/mqueue.key", O_CREAT | O_EXCL | O_WRONLY, 0640);
-  if (fd < 0)
-    goto fail;
-  sprintf(buf, "%ji\n", (intmax_t)mqueue_key);
-  n = strlen(buf) * sizeof(char);
-  if (write(fd, buf, n) < (ssize_t)n)
-    {
-      unlink(RUNDIR "/" PKGNAME "/mqueue.key");
-      goto fail;
-    }
-  if (close(fd) < 0)
-    perror(*argv);
-  fd = -1;
+  parent = open(RUNDIR, O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if ((parent < 0) && (errno == ENOENT))
+    if ((mkdirs(RUNDIR, 0750) == 0) || (errno == EEXIST))
+      parent = open(RUNDIR, O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (parent < 0)
+    return -1;
   
-  return 0;
+  if ((mkdirat(parent, PKGNAME, 0750) == 0) || (errno == EEXIST))
+    rundir = openat(parent, PKGNAME, O_PATH | O_DIRECTORY | O_CLOEXEC);
   
- fail:
   saved_errno = errno;
-  if (msgctl(mqueue_id, IPC_RMID, NULL) < 0)
-    perror(*argv);
-  if (fd >= 0)
-    if (close(fd) < 0)
-      perror(*argv);
-  return errno = saved_errno, 1;
+  close(parent);
+  errno = saved_errno;
+  return rundir < 0 ? -1 : 0;
 }
 
 
 /**
- * Read an entire file, ignoring interruptions
+ * Read the key of the message queue from the key file
  * 
- * @param   pathname  The pathname of the file
- * @param   n         The number of read characters
- * @return            The content of the file, `NULL` on error
+ * @param   key  Output parameter for the key
+ * @return       Zero on success, -1 if the file
+ *               is missing, unreadable or invalid
  */
-static char* read_file(const char* restrict pathname, size_t* restrict n)
+static int read_key(key_t* key)
 {
-  char* restrict content = NULL;
-  char* restrict old = NULL;
-  size_t ptr = 0;
+  char buf[3 * sizeof(key_t) + 2];
   ssize_t got;
-  int fd, saved_errno;
-  
-  if (fd = open(pathname, O_RDONLY), fd < 0)
-    return NULL;
-  
-  for (*n = 0;;)
-    {
-      if (*n - ptr < 4096)
-	{
-	  content = realloc(old = content, (*n += 8 << 10) * sizeof(char));
-	  if (content == NULL)
-	    goto fail;
-	  old = NULL;
-	}
-      got = read(fd, content + ptr, *n - ptr);
-      if ((got < 0) && (errno == EINTR))  continue;
-      else if (got < 0)                   goto fail;
-      else if (got == 0)                  break;
-      else                                ptr += (size_t)got;
-    }
-  
-  *n = ptr / sizeof(char);
-  close(fd), fd = -1;
-  return content;
+  char* end;
+  int fd;
   
- fail:
-  saved_errno = errno;
-  free(content);
-  free(old);
-  errno = saved_errno;
-  return NULL;
+  if (fd = openat(rundir, "mqueue.key", O_RDONLY | O_CLOEXEC), fd < 0)
+    return -1;
+  got = read(fd, buf, sizeof(buf) - sizeof(char));
+  close(fd);
+  if (got <= 0)
+    return -1;
+  buf[got] = '\0';
+  *key = (key_t)strtoll(buf, &end, 10);
+  return ((end == buf) || (end[0] != '\n') || end[1]) ? -1 : 0;
 }
 
 
 /**
- * Parse the content of the environtab
+ * Check that a message queue was created by us, with our
+ * permissions, rather than by another program using the same key
  * 
- * @param   environtab  The content of the environtab
- * @return              `environ` as described by `environtab`, `NULL` on error
+ * @param   mqueue_id  The ID of the message queue
+ * @return             1 if the queue is ours, 0 otherwise
  */
-static char** environtab_parse(char* restrict environtab)
+static int is_own_mqueue(int mqueue_id)
 {
-  size_t saved_i = 0, saved_n = 0, n;
-  char** restrict saved_env = NULL;
-  char** restrict saved_env_old = NULL;
-  char* end;
-  char* begin;
-  char* restrict var;
-  char* restrict entry;
-  char* restrict old;
-  int saved_errno;
+  struct msqid_ds info;
+  if (msgctl(mqueue_id, IPC_STAT, &info) < 0)
+    return 0;
+  return (info.msg_perm.cuid == geteuid()) && ((info.msg_perm.mode & 0777) == 0750);
+}
+
+
+/**
+ * Publish the key file atomically, replacing a stale key
+ * file, so that it is never observed empty or partially written
+ * 
+ * @param   buf  The contents of the file
+ * @param   n    The length of `buf`
+ * @return       Zero on success, -1 on error
+ */
+static int publish_key(const char* buf, size_t n)
+{
+  char temporary[sizeof("mqueue.key.") + 3 * sizeof(pid_t)];
+  int fd, saved_errno;
   
-  for (begin = environtab;; begin = end + 1)
+  sprintf(temporary, "mqueue.key.%ji", (intmax_t)getpid());
+  if (fd = openat(rundir, temporary, O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0640), fd < 0)
+    return -1;
+  if (write(fd, buf, n) < (ssize_t)n)
+    goto fail;
+  if (close(fd) < 0)
     {
-      if (saved_i == saved_n)
-	{
-	  saved_env_old = saved_env;
-	  saved_env = realloc(saved_env, (saved_n += 8) * sizeof(char*));
-	  if (saved_env == NULL)
-	    goto fail;
-	  saved_env_old = NULL;
-	}
-      if (end = strchr(begin, '\n'), end == NULL)
-	break;
-      if (*end = '\0', *begin == '\0')
-	continue;
-      if (strchr(begin, '='))
-	{
-	  saved_env[saved_i] = strdup(begin);
-	  if (saved_env[saved_i++] == NULL)
-	    goto fail;
-	}
-      else if ((var = getenv(begin)))
-	{
-	  n = strlen(begin) + strlen(var) + 2;
-	  if (old = strdup(begin), old == NULL)
-	    goto fail;
-	  if (entry = realloc(old, n * sizeof(char)), entry == NULL)
-	    goto fail;
-	  saved_env[saved_i++] = entry, old = NULL;
-	  n = strlen(entry);
-	  entry[n++] = '=';
-	  memcpy(entry + n, var, (strlen(var) + 1) * sizeof(char));
-	}
+      fd = -1;
+      goto fail;
     }
+  fd = -1;
+  if (renameat(rundir, temporary, rundir, "mqueue.key") < 0)
+    goto fail;
   
-  return saved_env;
+  return 0;
   
  fail:
   saved_errno = errno;
-  free(old);
-  free(saved_env);
-  free(saved_env_old);
-  errno = saved_errno;
-  return NULL;
+  if (fd >= 0)
+    close(fd);
+  unlinkat(rundir, temporary, 0);
+  return errno = saved_errno, -1;
 }
 
 
 /**
- * Clear the environment variables and fill it with new/stored values
+ * Create the System V message queue, unless it already exists
  * 
- * @param   new_environ  The new environment variables with their associated values
- * @param   n            The number of elements in `new_environ`
- * @return               Zero on success, -1 on error
+ * @return  Zero on success, the value with which `main` should return on failure
  */
-static int set_environ(char* const* restrict new_environ, size_t n)
+static int create_mqueue(void)
 {
-  size_t i;
+  char buf[3 * sizeof(key_t) + 2];
+  int mqueue_id;
+  key_t mqueue_key;
+  struct stat st;
   
-  if (clearenv() != 0)
-    return -1;
+  /* Normally, the published queue still exists. */
+  if (read_key(&mqueue_key) == 0)
+    if (mqueue_id = msgget(mqueue_key, 0), (mqueue_id >= 0) && is_own_mqueue(mqueue_id))
+      return 0;
   
-  for (i = 0; i < n; i++)
+  /* Otherwise the key file is missing, or stale, if the queue has been removed.
+   * Concurrent starts of this instance derive the same key, so they open the
+   * same queue and publish the same key. */
+  if (fstat(rundir, &st) < 0)
+    return 1;
+  mqueue_key = derive_key(&st);
+  mqueue_id = msgget(mqueue_key, 0750 | IPC_CREAT);
+  if ((mqueue_id < 0) && (errno != EACCES))
+    return 1;
+  if ((mqueue_id < 0) || !is_own_mqueue(mqueue_id))
     {
-      char* var = new_environ[i];
-      char* val = strchr(var, '=');
-      if (val == NULL)
-	abort();
-      *val++ = '\0';
-      if (setenv(var, val, 1) < 0)
-	return -1;
+      fprintf(stderr, "%s: the message queue key %ji is used by another program\n",
+	      *argv, (intmax_t)mqueue_key);
+      return errno = 0, 1;
     }
   
-  return 0;
+  /* Store the key in a file. */
+  sprintf(buf, "%ji\n", (intmax_t)mqueue_key);
+  return publish_key(buf, strlen(buf) * sizeof(char)) < 0;
 }
 
 
@@ -320,66 +308,18 @@ static int set_environ(char* const* restrict new_environ, size_t n)
  * Remove unrecognised environment variables,
  * and potentially add new environment variables
  * 
+ * The compiled environment is never freed, it
+ * becomes the environment of the process
+ * 
  * @return  Zero on success, -1 on error
  */
 static int sanitise_environment(void)
 {
-  char* restrict old = NULL;
-  char* restrict environtab = NULL;
-  int fd = -1, rc = 0, saved_errno = 0;
-  char** restrict saved_env = NULL;
-  size_t i, n, saved_n = 0;
-  
-  /* Get environment table. */
-  if (access(SYSCONFDIR "/" PKGNAME ".d/environtab", F_OK) == 0)
-    {
-      environtab = read_file(SYSCONFDIR "/" PKGNAME ".d/environtab", &n);
-      if (environtab == NULL)
-	return -1;
-    }
-  else if (errno != ENOENT)
+  struct environtab tab;
+  if (environtab_compile(ENVIRONTAB, &tab) < 0)
     return -1;
-  else
-    /* Default table. */
-    if (environtab = strdup("PATH\n"), environtab == NULL)
-      goto fail;
-    else
-      n = strlen("PATH\n");
-  
-  /* Make sure the table ends with a new line. */
-  if (environtab[n - 1] != '\n')
-    {
-      old = environtab;
-      environtab = realloc(environtab, (n + 1) * sizeof(char));
-      if (environtab == NULL)
-	goto fail;
-      environtab[n++] = '\n';
-      old = NULL;
-    }
-  
-  /* Store environment variables before clearing and find new values. */
-  if (saved_env = environtab_parse(environtab), saved_env == NULL)
-    goto fail;
-  
-  /* Clear unwanted environment variables and add new ones. */
-  if (set_environ(saved_env, saved_n) < 0)
-    goto fail;
-  
-  goto done;
-  
- fail:
-  saved_errno = errno;
-  rc = -1;
-  if (fd >= 0)
-    close(fd);
-  free(old);
- done:
-  free(environtab);
-  for (i = 0; i < saved_n; i++)
-    free(saved_env[i]);
-  free(saved_env);
-  errno = saved_errno;
-  return rc;
+  environ = tab.envp;
+  return 0;
 }
 
 
@@ -390,28 +330,34 @@ static int sanitise_environment(void)
  */
 static int initialise_daemon(void)
 {
+  sigset_t mask;
   int r;
   
   umask(022);
   
-  if (mkdirs(RUNDIR "/" PKGNAME, 0750) < 0)
-    if (errno != EEXIST)
-      return 1;
-  
-  if (access(RUNDIR "/" PKGNAME "/mqueue.key", F_OK) < 0)
-    {
-      if (errno == ENOENT)
-	if ((r = create_mqueue()))
-	  return r;
-      if (errno != ENOENT)
-	return 1;
-    }
-  
+  if (open_rundir() < 0)
+    return 1;
+  phase_done("rundir");
+  
+  r = create_mqueue();
+  close(rundir), rundir = -1;
+  if (r)
+    return r;
+  phase_done("mqueue");
+  
+  /* Block SIGCHLD until we are waiting for it, lest it is lost. */
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  if (sigprocmask(SIG_BLOCK, &mask, &original_mask) < 0)
+    return 1;
+  sigdelset(&original_mask, SIGCHLD);
   if (signal(SIGCHLD, parent_handle_signal) == SIG_ERR)
     return 1;
+  phase_done("signals");
   
   if (sanitise_environment() < 0)
     return 1;
+  phase_done("environment");
   
   return 0;
 }
@@ -424,6 +370,8 @@ static int initialise_daemon(void)
  */
 static int child_procedure(void)
 {
+  if (sigprocmask(SIG_SETMASK, &original_mask, NULL) < 0)
+    return 1;
   execlp(LIBEXECDIR "/daemond-resurrectd", "daemond-resurrectd", NULL);
   return 1;
 }
@@ -439,7 +387,8 @@ static int parent_procedure(void)
   int rc = 0;
   pid_t r;
   
-  pause();
+  sigsuspend(&original_mask);
+  phase_done("resurrectd");
   
   r = waitpid(pid, &rc, WNOHANG);
   if (r == -1)
@@ -455,7 +404,9 @@ static int parent_procedure(void)
 
 
 /**
- * Starts the daemon (-managing) daemon and its immortality protocol
+ * Starts the daemon (-managing) daemon and its immortality protocol,
+ * or with `--init`, execute into daemond, without the immortality
+ * protocol, so that it runs as init
  * 
  * @param   argc   The number of elements in `argv_`
  * @param   argv_  Command line arguments
@@ -463,14 +414,27 @@ static int parent_procedure(void)
  */
 int main(int argc, char** argv_)
 {
-  int r;
+  int i, r, init = 0;
   
-  (void) argc;
   argv = argv_;
   
+  for (i = 1; i < argc; i++)
+    if (!strcmp(argv[i], "--time-startup"))
+      time_startup = 1, timer_now(&phase_start);
+    else if (!strcmp(argv[i], "--init"))
+      init = 1;
+  
   if ((r = initialise_daemon()))
     return errno ? (perror(*argv), r) : r;
   
+  /* As init, daemond takes our place, without daemond-resurrectd. */
+  if (init)
+    {
+      if (sigprocmask(SIG_SETMASK, &original_mask, NULL) == 0)
+	execlp(LIBEXECDIR "/daemond", "daemond", "--init", NULL);
+      return perror(*argv), 1;
+    }
+  
   if (pid = fork(), pid == -1)
     return perror(*argv), 1;
   
@@ -0,0 +1,182 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "config.h"
+#include "status.h"
+#include "service.h"
+#include "timer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+
+
+/**
+ * The pathname of the status table
+ */
+#define STATUS_PATHNAME  RUNDIR "/" PKGNAME "/status"
+
+/**
+ * The size of the status table
+ */
+#define STATUS_SIZE  (sizeof(struct status_header) + STATUS_CAPACITY * sizeof(struct status_record))
+
+
+
+/**
+ * Command line arguments
+ */
+extern char** argv;
+
+/**
+ * The header of the mapped status table, `NULL` if not mapped
+ */
+static struct status_header* header = NULL;
+
+/**
+ * The records of the mapped status table
+ */
+static struct status_record* records;
+
+
+
+/**
+ * Create the status table, replacing any previous table
+ * 
+ * The table is created under a temporary name and renamed into
+ * place, so that readers never see it before it is initialised,
+ * and readers that have mapped the previous table can keep it
+ * 
+ * @return  Zero on success, -1 on error
+ */
+int status_open(void)
+{
+  void* address;
+  int fd;
+  
+  fd = open(STATUS_PATHNAME ".tmp", O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return -1;
+  if (ftruncate(fd, (off_t)STATUS_SIZE) < 0)
+    goto fail;
+  address = mmap(NULL, STATUS_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (address == MAP_FAILED)
+    goto fail;
+  close(fd);
+  
+  header = address;
+  records = (void*)((char*)address + sizeof(struct status_header));
+  memcpy(header->magic, STATUS_MAGIC, sizeof(STATUS_MAGIC));
+  header->version = STATUS_VERSION;
+  header->header_size = (uint32_t)sizeof(struct status_header);
+  header->record_size = (uint32_t)sizeof(struct status_record);
+  header->capacity = STATUS_CAPACITY;
+  header->count = 0;
+  header->pid = (int32_t)getpid();
+  
+  if (rename(STATUS_PATHNAME ".tmp", STATUS_PATHNAME) < 0)
+    {
+      munmap(address, STATUS_SIZE);
+      header = NULL;
+      return unlink(STATUS_PATHNAME ".tmp"), -1;
+    }
+  return 0;
+ 
+ fail:
+  close(fd);
+  return unlink(STATUS_PATHNAME ".tmp"), -1;
+}
+
+
+/**
+ * Publish the status of a service, if it has changed
+ * 
+ * @param  record   The service's record
+ * @param  service  The service
+ */
+static void status_publish(struct status_record* restrict record, const struct service* restrict service)
+{
+  int64_t started = 0;
+  uint32_t sequence;
+  
+  if (service->started.tv_sec || service->started.tv_nsec)
+    started = (int64_t)(service->started.tv_sec) * NANOSECONDS + service->started.tv_nsec;
+  
+  if ((record->state == (int32_t)(service->state)) &&
+      (record->pid == (int32_t)(service->pid)) &&
+      (record->last_status == (int32_t)(service->last_status)) &&
+      (record->restarts == service->metrics.restarts) &&
+      (record->exits == service->metrics.exits) &&
+      (record->started == started))
+    return;
+  
+  /* Readers retry if the sequence is odd, or changed while they read. */
+  sequence = record->sequence;
+  __atomic_store_n(&(record->sequence), sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  
+  record->state = (int32_t)(service->state);
+  record->pid = (int32_t)(service->pid);
+  record->last_status = (int32_t)(service->last_status);
+  record->restarts = service->metrics.restarts;
+  record->exits = service->metrics.exits;
+  record->started = started;
+  
+  __atomic_store_n(&(record->sequence), sequence + 2, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * Publish the services whose status has changed
+ * since the last time this was done
+ * 
+ * Services are never removed, so each service keeps
+ * the record it was given when it was first published
+ */
+void status_update(void)
+{
+  static int overflowed = 0;
+  size_t i, count;
+  
+  if (header == NULL)
+    return;
+  
+  count = header->count;
+  for (i = 0; i < count; i++)
+    status_publish(records + i, services[i]);
+  
+  if (service_count <= count)
+    return;
+  if (service_count > STATUS_CAPACITY)
+    {
+      if (!overflowed)
+	fprintf(stderr, "%s: the status table is full, not publishing all services\n", *argv);
+      overflowed = 1;
+    }
+  
+  /* A new record is complete before it is counted. */
+  for (; (i < service_count) && (i < STATUS_CAPACITY); i++)
+    {
+      strncpy(records[i].name, services[i]->name, STATUS_NAME_SIZE - 1);
+      status_publish(records + i, services[i]);
+    }
+  __atomic_store_n(&(header->count), (uint32_t)i, __ATOMIC_RELEASE);
+}
+
@@ -0,0 +1,160 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef DAEMOND_STATUS_H
+#define DAEMOND_STATUS_H
+
+
+#include <stdint.h>
+
+
+
+/**
+ * The magic bytes at the beginning of the status table
+ */
+#define STATUS_MAGIC  "daemond"
+
+/**
+ * The version of the layout of the status table
+ */
+#define STATUS_VERSION  1
+
+/**
+ * The size of `struct status_record.name`
+ */
+#define STATUS_NAME_SIZE  88
+
+
+
+/**
+ * The header of the status table, it is followed
+ * by `capacity` records of `record_size` bytes
+ */
+struct status_header
+{
+  /**
+   * `STATUS_MAGIC`, NUL-terminated
+   */
+  char magic[8];
+  
+  /**
+   * `STATUS_VERSION`
+   */
+  uint32_t version;
+  
+  /**
+   * The size of the header, the offset of the first record
+   */
+  uint32_t header_size;
+  
+  /**
+   * The size of each record
+   */
+  uint32_t record_size;
+  
+  /**
+   * The number of records there is room for
+   */
+  uint32_t capacity;
+  
+  /**
+   * The number of records in use, services
+   * are only added, never removed
+   */
+  uint32_t count;
+  
+  /**
+   * The PID of daemond
+   */
+  int32_t pid;
+  
+  /**
+   * Reserved for future use, zero
+   */
+  char reserved[32];
+};
+
+
+/**
+ * The status of a service in the status table
+ */
+struct status_record
+{
+  /**
+   * Incremented before and after the record is
+   * modified, so it is odd while it is being modified
+   */
+  uint32_t sequence;
+  
+  /**
+   * The state of the service, an `enum service_state`
+   */
+  int32_t state;
+  
+  /**
+   * The PID of the service, zero if not running
+   */
+  int32_t pid;
+  
+  /**
+   * The status of the service the last time it died,
+   * as returned by `waitpid`, zero if it has not died
+   */
+  int32_t last_status;
+  
+  /**
+   * The number of times the service has been
+   * restarted without being requested to
+   */
+  uint64_t restarts;
+  
+  /**
+   * The number of times the service has died
+   */
+  uint64_t exits;
+  
+  /**
+   * When the service last became ready, in nanoseconds
+   * on `CLOCK_MONOTONIC`, zero if it never has
+   */
+  int64_t started;
+  
+  /**
+   * The name of the service, NUL-terminated,
+   * truncated if it does not fit
+   */
+  char name[STATUS_NAME_SIZE];
+};
+
+
+
+/**
+ * Create the status table, replacing any previous table
+ * 
+ * @return  Zero on success, -1 on error
+ */
+int status_open(void);
+
+/**
+ * Publish the services whose status has changed
+ * since the last time this was done
+ */
+void status_update(void);
+
+
+#endif
+
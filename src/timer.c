@@ -0,0 +1,124 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "timer.h"
+
+#include <sys/time.h>
+#include <stddef.h>
+
+
+
+/**
+ * The earliest requested wake up time
+ */
+static struct timespec wakeup;
+
+/**
+ * Whether `wakeup` is set
+ */
+static int have_wakeup = 0;
+
+
+
+/**
+ * Get the current time on the monotonic clock
+ * 
+ * @param  now  Output parameter for the current time
+ */
+void timer_now(struct timespec* restrict now)
+{
+  if (clock_gettime(CLOCK_MONOTONIC, now) < 0)
+    now->tv_sec = 0, now->tv_nsec = 0;
+}
+
+
+/**
+ * Calculate the number of nanoseconds between two points in time
+ * 
+ * @param   start  The earlier point in time
+ * @param   end    The later point in time
+ * @return         The number of nanoseconds from `start` to `end`,
+ *                 negative if `end` is before `start`
+ */
+long long timer_diff(const struct timespec* restrict start, const struct timespec* restrict end)
+{
+  long long diff = (long long)(end->tv_sec - start->tv_sec);
+  diff *= NANOSECONDS;
+  return diff + (long long)(end->tv_nsec - start->tv_nsec);
+}
+
+
+/**
+ * Move a point in time
+ * 
+ * @param  when  The point in time, will be updated
+ * @param  ns    The number of nanoseconds to move `when` forward
+ */
+void timer_add(struct timespec* restrict when, long long ns)
+{
+  when->tv_sec += (time_t)(ns / NANOSECONDS);
+  when->tv_nsec += (long)(ns % NANOSECONDS);
+  if (when->tv_nsec >= NANOSECONDS)
+    when->tv_sec += 1, when->tv_nsec -= NANOSECONDS;
+}
+
+
+/**
+ * Request that the mane loop is woken up no later than at a specific time
+ * 
+ * @param  when  The point in time at which the mane loop should wake up
+ */
+void timer_wakeup_at(const struct timespec* restrict when)
+{
+  if (!have_wakeup || (timer_diff(when, &wakeup) > 0))
+    wakeup = *when, have_wakeup = 1;
+}
+
+
+/**
+ * Arm the interval timer so that the mane loop is interrupted
+ * by SIGALRM at the earliest time requested with `timer_wakeup_at`
+ * since the last call to this function
+ * 
+ * @return  Zero on success, -1 on error
+ */
+int timer_arm(void)
+{
+  struct itimerval value;
+  struct timespec now;
+  long long delay;
+  
+  value.it_interval.tv_sec = 0;
+  value.it_interval.tv_usec = 0;
+  value.it_value.tv_sec = 0;
+  value.it_value.tv_usec = 0;
+  
+  if (have_wakeup)
+    {
+      timer_now(&now);
+      delay = timer_diff(&now, &wakeup);
+      /* Never disarm the timer by accident, and do not spin. */
+      if (delay < 1000000LL)
+	delay = 1000000LL;
+      value.it_value.tv_sec = (time_t)(delay / NANOSECONDS);
+      value.it_value.tv_usec = (suseconds_t)((delay % NANOSECONDS) / 1000);
+      have_wakeup = 0;
+    }
+  
+  return setitimer(ITIMER_REAL, &value, NULL);
+}
+
@@ -0,0 +1,76 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef DAEMOND_TIMER_H
+#define DAEMOND_TIMER_H
+
+
+#include <time.h>
+
+
+
+/**
+ * The number of nanoseconds in a second
+ */
+#define NANOSECONDS  1000000000LL
+
+
+
+/**
+ * Get the current time on the monotonic clock
+ * 
+ * @param  now  Output parameter for the current time
+ */
+void timer_now(struct timespec* restrict now);
+
+/**
+ * Calculate the number of nanoseconds between two points in time
+ * 
+ * @param   start  The earlier point in time
+ * @param   end    The later point in time
+ * @return         The number of nanoseconds from `start` to `end`,
+ *                 negative if `end` is before `start`
+ */
+long long timer_diff(const struct timespec* restrict start, const struct timespec* restrict end) __attribute__((pure));
+
+/**
+ * Move a point in time
+ * 
+ * @param  when  The point in time, will be updated
+ * @param  ns    The number of nanoseconds to move `when` forward
+ */
+void timer_add(struct timespec* restrict when, long long ns);
+
+/**
+ * Request that the mane loop is woken up no later than at a specific time
+ * 
+ * @param  when  The point in time at which the mane loop should wake up
+ */
+void timer_wakeup_at(const struct timespec* restrict when);
+
+/**
+ * Arm the interval timer so that the mane loop is interrupted
+ * by SIGALRM at the earliest time requested with `timer_wakeup_at`
+ * since the last call to this function
+ * 
+ * @return  Zero on success, -1 on error
+ */
+int timer_arm(void);
+
+
+#endif
+
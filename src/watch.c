@@ -0,0 +1,240 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "config.h"
+#include "watch.h"
+#include "service.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+
+
+
+/**
+ * The events that indicate that a file has been
+ * written, replaced, added or removed
+ */
+#define WATCH_EVENTS  (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)
+
+
+
+/**
+ * Command line arguments
+ */
+extern char** argv;
+
+/**
+ * The inotify instance, -1 if not watching
+ */
+static int watch_fd = -1;
+
+/**
+ * The watch descriptor for the directory of service descriptors
+ */
+static int daemons_wd = -1;
+
+/**
+ * The watch descriptor for the daemond configuration directory
+ */
+static int config_wd = -1;
+
+
+
+/**
+ * Start watching the daemond configuration directory
+ * and the directory of service descriptors for changes,
+ * SIGIO is sent when a change is made
+ * 
+ * @return  Zero on success, -1 on error
+ */
+int watch_open(void)
+{
+  int saved_errno;
+  
+  if (watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC), watch_fd < 0)
+    return -1;
+  
+  /* A directory that does not exist is not watched. */
+  if (daemons_wd = inotify_add_watch(watch_fd, DAEMONDIR, WATCH_EVENTS | IN_ONLYDIR), daemons_wd < 0)
+    if (errno != ENOENT)
+      goto fail;
+  if (config_wd = inotify_add_watch(watch_fd, SYSCONFDIR "/" PKGNAME ".d", WATCH_EVENTS | IN_ONLYDIR), config_wd < 0)
+    if (errno != ENOENT)
+      goto fail;
+  
+  if (fcntl(watch_fd, F_SETOWN, getpid()) < 0)
+    goto fail;
+  if (fcntl(watch_fd, F_SETFL, O_NONBLOCK | O_ASYNC) < 0)
+    goto fail;
+  
+  return 0;
+  
+ fail:
+  saved_errno = errno;
+  close(watch_fd), watch_fd = -1;
+  return errno = saved_errno, -1;
+}
+
+
+/**
+ * Check whether a service still has a descriptor file,
+ * either of its own or, for an instance, of its template
+ * 
+ * @param   name  The name of the service
+ * @return        Whether the service has a descriptor file
+ */
+static int has_descriptor(const char* restrict name)
+{
+  char pathname[sizeof(DAEMONDIR "/" DESCRIPTOR_SUFFIX) + NAME_MAX];
+  const char* at = strchr(name, '@');
+  
+  sprintf(pathname, DAEMONDIR "/%s" DESCRIPTOR_SUFFIX, name);
+  if (access(pathname, F_OK) == 0)
+    return 1;
+  if ((errno != ENOENT) || (at == NULL))
+    return errno != ENOENT;
+  sprintf(pathname, DAEMONDIR "/%.*s" DESCRIPTOR_SUFFIX, (int)(at - name + 1), name);
+  return (access(pathname, F_OK) == 0) || (errno != ENOENT);
+}
+
+
+/**
+ * Apply every service descriptor in the directory of service
+ * descriptors, and the removal of those that are no longer in
+ * it, used when changes may have been missed
+ * 
+ * @return  The return value for `main`, -1 if the caller should not return
+ */
+static int watch_rescan(void)
+{
+  size_t i, n, suffix = strlen(DESCRIPTOR_SUFFIX);
+  char name[NAME_MAX + 1];
+  struct dirent* file;
+  DIR* dir;
+  int r;
+  
+  if (dir = opendir(DAEMONDIR), dir == NULL)
+    return perror(*argv), -1;
+  
+  while (errno = 0, file = readdir(dir), file != NULL)
+    {
+      n = strlen(file->d_name);
+      if ((*(file->d_name) == '.') || (n <= suffix) || strcmp(file->d_name + n - suffix, DESCRIPTOR_SUFFIX))
+	continue;
+      file->d_name[n - suffix] = '\0';
+      if (r = service_reconfigure(file->d_name, 0), r >= 0)
+	return closedir(dir), r;
+    }
+  
+  if (errno)
+    perror(*argv);
+  closedir(dir);
+  
+  /* Services are never forgotten, those that have lost their descriptor are stopped. */
+  for (i = 0; i < service_count; i++)
+    {
+      if ((strlen(services[i]->name) > NAME_MAX - suffix) || has_descriptor(services[i]->name))
+	continue;
+      strcpy(name, services[i]->name);
+      if (r = service_reconfigure(name, 1), r >= 0)
+	return r;
+    }
+  
+  return -1;
+}
+
+
+/**
+ * Apply a change to a file in the directory of service descriptors
+ * 
+ * @param   event  The inotify event
+ * @return         The return value for `main`, -1 if the caller should not return
+ */
+static int watch_descriptor(struct inotify_event* restrict event)
+{
+  size_t n = strlen(event->name), suffix = strlen(DESCRIPTOR_SUFFIX);
+  
+  /* Daemon scripts are read when they are used. */
+  if ((*(event->name) == '.') || (n <= suffix) || strcmp(event->name + n - suffix, DESCRIPTOR_SUFFIX))
+    return -1;
+  
+  event->name[n - suffix] = '\0';
+  return service_reconfigure(event->name, !!(event->mask & (IN_MOVED_FROM | IN_DELETE)));
+}
+
+
+/**
+ * Apply the changes that have been made to
+ * service descriptors and the environtab
+ * 
+ * @return  The return value for `main`, -1 if the caller should not return
+ */
+int watch_dispatch(void)
+{
+  union
+  {
+    struct inotify_event event;
+    char bytes[16 * (sizeof(struct inotify_event) + NAME_MAX + 1)];
+  } buffer;
+  struct inotify_event* event;
+  ssize_t got;
+  size_t off;
+  int r;
+  
+  if (watch_fd < 0)
+    return -1;
+  
+  for (;;)
+    {
+      if (got = read(watch_fd, buffer.bytes, sizeof(buffer.bytes)), got < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  if (errno != EAGAIN)
+	    perror(*argv);
+	  return -1;
+	}
+      
+      for (off = 0; off < (size_t)got; off += sizeof(*event) + event->len)
+	{
+	  event = (void*)(buffer.bytes + off);
+	  if (event->mask & IN_Q_OVERFLOW)
+	    {
+	      fprintf(stderr, "%s: too many configuration changes, rescanning\n", *argv);
+	      service_environment_changed();
+	      if (r = watch_rescan(), r >= 0)
+		return r;
+	    }
+	  else if (event->len == 0)
+	    continue;
+	  else if (event->wd == daemons_wd)
+	    {
+	      if (r = watch_descriptor(event), r >= 0)
+		return r;
+	    }
+	  else if (event->wd == config_wd)
+	    service_environment_changed();
+	}
+    }
+}
+
@@ -0,0 +1,42 @@
+/**
+ * daemond — A daemon managing daemon
+ * Copyright © 2014  Mattias Andrée (maandree@member.fsf.org)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef DAEMOND_WATCH_H
+#define DAEMOND_WATCH_H
+
+
+
+/**
+ * Start watching the daemond configuration directory
+ * and the directory of service descriptors for changes,
+ * SIGIO is sent when a change is made
+ * 
+ * @return  Zero on success, -1 on error
+ */
+int watch_open(void);
+
+/**
+ * Apply the changes that have been made to
+ * service descriptors and the environtab
+ * 
+ * @return  The return value for `main`, -1 if the caller should not return
+ */
+int watch_dispatch(void);
+
+
+#endif
+